@@ -68,7 +68,7 @@ def load_image_uint8(image_path, input_h, input_w):
 
 
 def find_images(image_dir):
-    extensions = ("*.jpg", "*.jpeg", "*.png", "*.bmp")
+    extensions = ("*.jpg", "*.jpeg", "*.png", "*.bmp", "*.ppm")
     paths = []
     for ext in extensions:
         paths.extend(glob.glob(os.path.join(image_dir, ext)))
@@ -30,6 +30,7 @@ PROJECT_ROOT = os.path.join(SCRIPT_DIR, "..", "..", "..")
 OUTPUT_DIR = os.path.join(SCRIPT_DIR, "output")
 DUMP_PATH = os.path.join(OUTPUT_DIR, "dump")
 KMODEL_PATH = os.path.join(DUMP_PATH, "mobile_retinaface.kmodel")
+QUANT_PATH = KMODEL_PATH + ".quant"
 
 INPUT_H, INPUT_W = 320, 320
 
@@ -53,6 +54,17 @@ def load_test_image_uint8(image_path, input_h, input_w):
     return arr
 
 
+def load_quant_params(path):
+    """step3 が書いた <kmodel>.quant を読む (無ければ空)"""
+    params = {}
+    if os.path.exists(path):
+        with open(path) as f:
+            for line in f:
+                idx, qtype, scale, zero_point = line.split()
+                params[int(idx)] = (qtype, float(scale), int(zero_point))
+    return params
+
+
 def main():
     parser = argparse.ArgumentParser(description="実機用 kmodel シミュレーション")
     parser.add_argument("--image", type=str, default=None,
@@ -120,9 +132,15 @@ def main():
         "lmk_40x40", "lmk_20x20", "lmk_10x10",
     ]
 
+    # --quant-outputs の kmodel は float32 に戻して保存する (step5 / host_tools 用)
+    quant_params = load_quant_params(QUANT_PATH)
     for idx in range(simulator.outputs_size):
         result = simulator.get_output_tensor(idx).to_numpy()
         name = output_names[idx] if idx < len(output_names) else f"output_{idx}"
+        if result.dtype in (np.uint8, np.int8) and idx in quant_params:
+            _, scale, zero_point = quant_params[idx]
+            result = (scale * (result.astype(np.float32) - zero_point)).astype(
+                np.float32)
 
         npy_path = os.path.join(DUMP_PATH, f"kmodel_result_{idx}_{name}.npy")
         np.save(npy_path, result)
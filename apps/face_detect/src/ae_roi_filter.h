@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "util.h"
+
+// AE ROI window in sensor pixels.
+struct AeRoiWindow {
+  int x = 0, y = 0, w = 0, h = 0;
+};
+
+// The ISP meters at most this many windows.
+#define AE_ROI_MAX_WINDOWS 8
+
+// Maps face boxes in model (frame) coordinates to sensor windows, clipped to
+// the sensor, keeping at most AE_ROI_MAX_WINDOWS.
+std::vector<AeRoiWindow> FacesToSensorWindows(
+    const std::vector<face_coordinate> &boxes, int model_w, int model_h,
+    int sensor_w, int sensor_h);
+
+struct AeRoiFilterConfig {
+  float alpha = 0.3f;      // EMA weight of a new measurement
+  float match_iou = 0.3f;  // min IoU to match a window to a smoothed one
+  int enter_frames = 3;    // frames a new face is seen before it is metered
+  int hold_frames = 10;    // frames a lost face keeps its window
+  int min_change = 32;     // sensor pixels an edge moves to update the ISP
+  int min_interval = 5;    // frames between two ISP updates
+};
+
+// Turns the per-frame face windows into ISP AE ROI updates. Windows are
+// matched to the previous ones greedily by IoU and smoothed with an EMA.
+// A face is metered only after enter_frames consecutive frames and keeps
+// its window for hold_frames after it is lost, so a flickering detection
+// does not toggle the ROI. The smoothed set is sent to the ISP only when a
+// window appears, disappears or an edge moved by min_change or more since
+// the last update, and never more often than every min_interval frames; a
+// change held back by the rate limit goes out on the first frame allowed.
+//
+// Has no SDK dependency so recorded box sequences can be replayed on a host
+// (roi_sim in apps/host_tools). Not thread-safe.
+class AeRoiFilter {
+ public:
+  explicit AeRoiFilter(const AeRoiFilterConfig &config = {});
+
+  // Called once per frame with the raw windows. True if the ISP should be
+  // updated with Windows().
+  bool Update(const std::vector<AeRoiWindow> &raw);
+
+  // The windows of the last update, in the order the faces appeared.
+  const std::vector<AeRoiWindow> &Windows() const { return applied_; }
+
+  uint64_t Frames() const { return frames_; }
+  uint64_t Applied() const { return applied_count_; }
+  // Frames whose windows stayed within min_change of the last update.
+  uint64_t SkippedSmall() const { return skipped_small_; }
+  // Frames with a change held back by min_interval.
+  uint64_t SkippedRate() const { return skipped_rate_; }
+
+ private:
+  struct Track {
+    float x, y, w, h;
+    int seen;    // consecutive frames matched
+    int misses;  // consecutive frames unmatched
+  };
+  struct Pair {
+    float iou;
+    int track, raw;
+  };
+
+  static float Iou(const Track &t, const AeRoiWindow &w);
+  bool Changed() const;
+
+  AeRoiFilterConfig config_;
+  std::vector<Track> tracks_;
+  std::vector<AeRoiWindow> metered_;  // confirmed tracks of this frame
+  std::vector<AeRoiWindow> applied_;
+  std::vector<Pair> pairs_;
+  std::vector<char> raw_used_;
+  std::vector<char> track_used_;
+  bool has_applied_ = false;
+  int since_apply_ = 0;
+  uint64_t frames_ = 0;
+  uint64_t applied_count_ = 0;
+  uint64_t skipped_small_ = 0;
+  uint64_t skipped_rate_ = 0;
+};
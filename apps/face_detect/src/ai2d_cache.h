@@ -0,0 +1,111 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <vector>
+
+// What an AI2D schedule depends on besides the fixed format and method
+// parameters: input shape, crop window and output shape. crop_w == 0 means
+// no crop.
+struct Ai2dGeometry {
+  int in_c = 0, in_h = 0, in_w = 0;
+  int crop_x = 0, crop_y = 0, crop_w = 0, crop_h = 0;
+  int out_c = 0, out_h = 0, out_w = 0;
+
+  bool operator==(const Ai2dGeometry &o) const {
+    return in_c == o.in_c && in_h == o.in_h && in_w == o.in_w &&
+           crop_x == o.crop_x && crop_y == o.crop_y && crop_w == o.crop_w &&
+           crop_h == o.crop_h && out_c == o.out_c && out_h == o.out_h &&
+           out_w == o.out_w;
+  }
+};
+
+// Caches built AI2D schedules (ai2d_builder after build_schedule) by
+// geometry, so a crop that moves around the frame costs a lookup instead of
+// a schedule build once its positions have been seen. Crop windows are
+// snapped to `grid` pixels first: sizes round up, positions to the nearest
+// step inside the input, so a square crop stays square when the input is a
+// multiple of the grid.
+//
+// Entries are evicted least-recently-used beyond `capacity`. The schedule
+// type is a template parameter so the cache has no SDK dependency. Not
+// thread-safe: acquire schedules from the AI2D stage only.
+template <class Schedule>
+class Ai2dScheduleCache {
+ public:
+  using MakeSchedule = std::function<Schedule(const Ai2dGeometry &)>;
+
+  Ai2dScheduleCache(size_t capacity, int grid, MakeSchedule make_schedule)
+      : capacity_(capacity ? capacity : 1),
+        grid_(grid > 0 ? grid : 1),
+        make_schedule_(std::move(make_schedule)) {
+    entries_.reserve(capacity_);
+  }
+
+  Ai2dScheduleCache(const Ai2dScheduleCache &) = delete;
+  Ai2dScheduleCache &operator=(const Ai2dScheduleCache &) = delete;
+
+  // The geometry Acquire builds for: the crop snapped to the grid. Callers
+  // that map results back to the input must use this window.
+  Ai2dGeometry Quantize(const Ai2dGeometry &g) const {
+    Ai2dGeometry q = g;
+    if (q.crop_w <= 0) return q;
+    q.crop_w = std::min(RoundUp(q.crop_w), q.in_w);
+    q.crop_h = std::min(RoundUp(q.crop_h), q.in_h);
+    q.crop_x = std::max(0, std::min(Nearest(q.crop_x), q.in_w - q.crop_w));
+    q.crop_y = std::max(0, std::min(Nearest(q.crop_y), q.in_h - q.crop_h));
+    return q;
+  }
+
+  Schedule &Acquire(const Ai2dGeometry &geometry) {
+    Ai2dGeometry key = Quantize(geometry);
+    ++clock_;
+    for (auto &e : entries_) {
+      if (e.key == key) {
+        e.last_use = clock_;
+        hits_++;
+        return e.schedule;
+      }
+    }
+
+    misses_++;
+    if (entries_.size() >= capacity_) {
+      size_t lru = 0;
+      for (size_t i = 1; i < entries_.size(); i++) {
+        if (entries_[i].last_use < entries_[lru].last_use) lru = i;
+      }
+      entries_.erase(entries_.begin() + lru);
+      evictions_++;
+    }
+    entries_.push_back({key, make_schedule_(key), clock_});
+    return entries_.back().schedule;
+  }
+
+  size_t Size() const { return entries_.size(); }
+  uint64_t Hits() const { return hits_; }
+  uint64_t Misses() const { return misses_; }
+  uint64_t Evictions() const { return evictions_; }
+
+ private:
+  struct Entry {
+    Ai2dGeometry key;
+    Schedule schedule;
+    uint64_t last_use;
+  };
+
+  int RoundUp(int v) const { return (v + grid_ - 1) / grid_ * grid_; }
+  int Nearest(int v) const { return (v + grid_ / 2) / grid_ * grid_; }
+
+  const size_t capacity_;
+  const int grid_;
+  MakeSchedule make_schedule_;
+  std::vector<Entry> entries_;
+  uint64_t clock_ = 0;
+  uint64_t hits_ = 0;
+  uint64_t misses_ = 0;
+  uint64_t evictions_ = 0;
+};
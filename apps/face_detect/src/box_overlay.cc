@@ -0,0 +1,80 @@
+#include "box_overlay.h"
+
+#include <stdlib.h>
+
+BoxOverlay::BoxOverlay(OverlayDriver &driver, int tolerance)
+    : driver_(driver), tolerance_(tolerance < 0 ? 0 : tolerance) {}
+
+bool BoxOverlay::Near(const OverlayBox &a, const OverlayBox &b) const {
+  return abs(a.x1 - b.x1) <= tolerance_ && abs(a.y1 - b.y1) <= tolerance_ &&
+         abs(a.x2 - b.x2) <= tolerance_ && abs(a.y2 - b.y2) <= tolerance_;
+}
+
+void BoxOverlay::Update(const std::vector<OverlayBox> &boxes) {
+  frames_++;
+  ops_.clear();
+  box_done_.assign(boxes.size(), 0);
+  slot_kept_.assign(slots_.size(), 0);
+
+  // Boxes that did not move keep their slot
+  for (size_t s = 0; s < slots_.size(); s++) {
+    if (!slots_[s].drawn) continue;
+    for (size_t b = 0; b < boxes.size(); b++) {
+      if (box_done_[b] || !Near(slots_[s].box, boxes[b])) continue;
+      box_done_[b] = slot_kept_[s] = 1;
+      kept_++;
+      break;
+    }
+  }
+
+  // The rest are redrawn, into slots whose box went away first so that a
+  // moved box costs one call instead of an erase and a draw
+  size_t next = 0;
+  for (size_t b = 0; b < boxes.size(); b++) {
+    if (box_done_[b]) continue;
+    while (next < slots_.size() && (slot_kept_[next] || !slots_[next].drawn)) {
+      next++;
+    }
+    size_t s = next;
+    if (s == slots_.size()) {
+      // no drawn slot to reuse: the first empty one, or a new one
+      for (s = 0; s < slots_.size(); s++) {
+        if (!slots_[s].drawn && !slot_kept_[s]) break;
+      }
+      if (s == slots_.size()) {
+        slots_.emplace_back();
+        slot_kept_.push_back(0);
+      }
+    }
+    slots_[s].drawn = true;
+    slots_[s].box = boxes[b];
+    slot_kept_[s] = 1;
+    ops_.push_back({static_cast<int>(s) + 1, true, boxes[b]});
+    draws_++;
+  }
+
+  for (size_t s = 0; s < slots_.size(); s++) {
+    if (!slots_[s].drawn || slot_kept_[s]) continue;
+    slots_[s].drawn = false;
+    ops_.push_back({static_cast<int>(s) + 1, false, slots_[s].box});
+    erases_++;
+  }
+  Commit();
+}
+
+void BoxOverlay::Clear() {
+  ops_.clear();
+  for (size_t s = 0; s < slots_.size(); s++) {
+    if (!slots_[s].drawn) continue;
+    slots_[s].drawn = false;
+    ops_.push_back({static_cast<int>(s) + 1, false, slots_[s].box});
+    erases_++;
+  }
+  Commit();
+}
+
+void BoxOverlay::Commit() {
+  if (ops_.empty()) return;
+  driver_.Commit(ops_);
+  commits_++;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+// Rectangle of the VO overlay, in display pixels.
+struct OverlayBox {
+  int x1 = 0, y1 = 0, x2 = 0, y2 = 0;
+};
+
+// One change to a hardware frame slot: draw `box` in it, or erase it. Slots
+// are 1-based, as kd_mpi_vo_draw_frame's frame_num.
+struct OverlayOp {
+  int slot;
+  bool draw;
+  OverlayBox box;
+};
+
+// Applies overlay changes to the display. The device implementation wraps
+// kd_mpi_vo_draw_frame; a host fake can record the calls.
+class OverlayDriver {
+ public:
+  virtual ~OverlayDriver() = default;
+  // All changes of one frame, applied in order. Never called empty.
+  virtual void Commit(const std::vector<OverlayOp> &ops) = 0;
+};
+
+// Keeps the VO box overlay in step with the detections while touching the
+// driver as little as possible. Each Update diffs the new boxes against what
+// the slots currently show: a box within `tolerance` pixels on every edge of
+// a drawn one is left alone, a moved or new box is drawn into a slot that
+// lost its box (or a free one), and slots left over are erased. The changes
+// of a frame reach the driver as one batch, and a frame where nothing moved
+// costs no driver call at all.
+//
+// Because unchanged boxes are compared against the drawn position, not the
+// previous detection, slow drifts are redrawn once they add up to more than
+// the tolerance. Has no SDK dependency (overlay_sim in apps/host_tools).
+// Not thread-safe.
+class BoxOverlay {
+ public:
+  BoxOverlay(OverlayDriver &driver, int tolerance);
+
+  void Update(const std::vector<OverlayBox> &boxes);
+  // Erases every drawn slot.
+  void Clear();
+
+  // What each slot currently shows; slot i + 1 is entry i, empty slots
+  // have drawn == false.
+  struct Slot {
+    bool drawn = false;
+    OverlayBox box;
+  };
+  const std::vector<Slot> &Slots() const { return slots_; }
+
+  uint64_t Frames() const { return frames_; }
+  uint64_t Commits() const { return commits_; }
+  uint64_t Draws() const { return draws_; }
+  uint64_t Erases() const { return erases_; }
+  // Boxes left as drawn because they moved less than the tolerance.
+  uint64_t Kept() const { return kept_; }
+
+ private:
+  bool Near(const OverlayBox &a, const OverlayBox &b) const;
+  void Commit();
+
+  OverlayDriver &driver_;
+  const int tolerance_;
+  std::vector<Slot> slots_;
+  std::vector<OverlayOp> ops_;
+  std::vector<char> box_done_;
+  std::vector<char> slot_kept_;
+  uint64_t frames_ = 0;
+  uint64_t commits_ = 0;
+  uint64_t draws_ = 0;
+  uint64_t erases_ = 0;
+  uint64_t kept_ = 0;
+};
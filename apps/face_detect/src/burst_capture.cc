@@ -0,0 +1,207 @@
+#include "burst_capture.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <cstdio>
+#include <cstring>
+
+BurstCapture::BurstCapture(const char *dir, int frame_w, int frame_h,
+                           const BurstConfig &config)
+    : dir_(dir), frame_w_(frame_w), frame_h_(frame_h), config_(config) {
+  if (config_.frames < 1) config_.frames = 1;
+  if (config_.scale < 1) config_.scale = 1;
+  out_w_ = frame_w_ / config_.scale;
+  out_h_ = frame_h_ / config_.scale;
+  frame_bytes_ = static_cast<size_t>(out_w_) * out_h_ * 3;
+
+  // One ring filling while the previous burst is written
+  size_t count = 2 * config_.frames + config_.post_frames;
+  slots_.resize(count);
+  for (size_t i = 0; i < count; i++) {
+    slots_[i].assign(frame_bytes_, 0);
+    free_.push_back(i);
+  }
+
+  worker_ = std::thread([this] { WorkerLoop(); });
+#if defined(SCHED_IDLE)
+  // Best effort: write only when the frame loop has nothing to do
+  sched_param param;
+  memset(&param, 0, sizeof(param));
+  pthread_setschedparam(worker_.native_handle(), SCHED_IDLE, &param);
+#endif
+}
+
+BurstCapture::~BurstCapture() {
+  if (armed_) Flush();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  jobs_cv_.notify_one();
+  worker_.join();
+}
+
+void BurstCapture::CopyScaled(const uint8_t *src, uint8_t *dst) const {
+  const int s = config_.scale;
+  const size_t plane = static_cast<size_t>(frame_w_) * frame_h_;
+  for (int c = 0; c < 3; c++) {
+    for (int y = 0; y < out_h_; y++) {
+      const uint8_t *row = src + c * plane + static_cast<size_t>(y) * s *
+                                                   frame_w_;
+      if (s == 1) {
+        memcpy(dst, row, out_w_);
+      } else {
+        for (int x = 0; x < out_w_; x++) dst[x] = row[x * s];
+      }
+      dst += out_w_;
+    }
+  }
+}
+
+void BurstCapture::Add(const void *frame) {
+  uint64_t number = frames_++;
+
+  // Overwrite the oldest frame once the ring holds what the burst needs
+  size_t slot;
+  size_t capacity = config_.frames + (armed_ ? config_.post_frames : 0);
+  if (ring_.size() >= capacity) {
+    slot = ring_.front();
+    ring_.pop_front();
+    ring_first_++;
+  } else {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_.empty()) {
+      skipped_++;
+      return;
+    }
+    slot = free_.back();
+    free_.pop_back();
+  }
+  if (ring_.empty()) ring_first_ = number;
+  CopyScaled(static_cast<const uint8_t *>(frame), slots_[slot].data());
+  ring_.push_back(slot);
+
+  if (armed_) {
+    if (post_left_ == 0 || --post_left_ == 0) Flush();
+  } else if (config_.continuous && ring_.size() >= config_.frames) {
+    trigger_frame_ = number;
+    Flush();
+  }
+}
+
+void BurstCapture::Trigger() {
+  if (armed_) return;
+  armed_ = true;
+  post_left_ = config_.post_frames;
+  trigger_frame_ = frames_ ? frames_ - 1 : 0;
+  if (post_left_ == 0 && !ring_.empty()) Flush();
+}
+
+void BurstCapture::Flush() {
+  armed_ = false;
+  if (ring_.empty()) return;
+  Job job;
+  job.slots.assign(ring_.begin(), ring_.end());
+  job.first_frame = ring_first_;
+  job.trigger_frame = trigger_frame_;
+  ring_.clear();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    jobs_.push_back(std::move(job));
+  }
+  jobs_cv_.notify_one();
+}
+
+uint64_t BurstCapture::Bursts() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return bursts_;
+}
+
+uint64_t BurstCapture::FramesWritten() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return frames_written_;
+}
+
+uint64_t BurstCapture::Failed() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return failed_;
+}
+
+void BurstCapture::PrintStats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  printf("burst: %llu bursts, %llu of %llu frames written (%dx%d), "
+         "%llu skipped, %llu failed\n",
+         static_cast<unsigned long long>(bursts_),
+         static_cast<unsigned long long>(frames_written_),
+         static_cast<unsigned long long>(frames_), out_w_, out_h_,
+         static_cast<unsigned long long>(skipped_),
+         static_cast<unsigned long long>(failed_));
+}
+
+void BurstCapture::WorkerLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    jobs_cv_.wait(lock, [this] { return !jobs_.empty() || stop_; });
+    if (jobs_.empty()) return;
+    Job job = std::move(jobs_.front());
+    jobs_.pop_front();
+    int index = next_index_++;
+    lock.unlock();
+
+    bool ok = WriteJob(job, index);
+
+    lock.lock();
+    if (ok) {
+      bursts_++;
+      frames_written_ += job.slots.size();
+    } else {
+      failed_++;
+    }
+  }
+}
+
+bool BurstCapture::WriteJob(const Job &job, int index) {
+  char name[32];
+  snprintf(name, sizeof(name), "/burst_%04d.kcap", index);
+  std::string path = dir_ + name;
+  // Readers only see complete containers
+  std::string part = path + ".part";
+
+  FILE *fp = fopen(part.c_str(), "wb");
+  bool ok = fp != nullptr;
+  if (ok) {
+    std::vector<uint8_t> header(BURST_DATA_OFFSET, 0);
+    BurstFileHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "K230CAP", 8);
+    h.version = 1;
+    h.count = job.slots.size();
+    h.channels = 3;
+    h.height = out_h_;
+    h.width = out_w_;
+    h.data_offset = BURST_DATA_OFFSET;
+    h.first_frame = job.first_frame;
+    h.trigger_frame = job.trigger_frame;
+    memcpy(header.data(), &h, sizeof(h));
+    ok = fwrite(header.data(), 1, header.size(), fp) == header.size();
+  }
+  // Each frame's slot goes back to the ring as soon as it is on disk
+  for (size_t slot : job.slots) {
+    if (ok) {
+      ok = fwrite(slots_[slot].data(), 1, frame_bytes_, fp) == frame_bytes_;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(slot);
+  }
+  if (fp && fclose(fp) != 0) ok = false;
+  if (ok && rename(part.c_str(), path.c_str()) != 0) ok = false;
+  if (ok) {
+    printf("Captured burst: %s (%zu frames)\n", path.c_str(),
+           job.slots.size());
+  } else {
+    printf("burst: cannot write %s\n", path.c_str());
+    remove(part.c_str());
+  }
+  return ok;
+}
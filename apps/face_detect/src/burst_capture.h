@@ -0,0 +1,111 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct BurstConfig {
+  size_t frames = 32;       // frames kept from before the trigger
+  size_t post_frames = 0;   // frames added after the trigger before a flush
+  int scale = 2;            // keep every scale-th pixel of every scale-th row
+  bool continuous = false;  // flush every `frames` frames, no trigger needed
+};
+
+// Header of the container BurstCapture writes (burst_NNNN.kcap). It is
+// padded to data_offset, and the frames follow back to back as uint8 CHW,
+// one chunk per frame, so the file maps directly as a count x channels x
+// height x width array (np.memmap in step3_compile_kmodel.py). Fields are
+// little-endian; the header is 48 bytes with no implicit padding.
+struct BurstFileHeader {
+  char magic[8];           // "K230CAP"
+  uint32_t version;        // 1
+  uint32_t count;          // frames in the file
+  uint32_t channels;       // 3, RGB planes
+  uint32_t height, width;  // of the stored, scaled frames
+  uint32_t data_offset;    // BURST_DATA_OFFSET
+  uint64_t first_frame;    // frame number of the first stored frame
+  uint64_t trigger_frame;  // frame number the flush was triggered on
+};
+
+static_assert(sizeof(BurstFileHeader) == 48, "kcap header layout");
+
+#define BURST_DATA_OFFSET 4096
+
+// Pre-trigger burst capture for calibration data. Add keeps the last
+// `frames` frames, downscaled, in a RAM ring; Trigger (or a full ring in
+// continuous mode) hands them, plus `post_frames` more, to a writer thread
+// that streams them into one burst_NNNN.kcap container. The frame loop only
+// pays for the scaled copy: slots are preallocated (twice the ring, so a
+// new ring fills while the previous burst is written) and a frame that
+// finds none free is skipped and counted instead of blocking.
+//
+// Add and Trigger are called from the frame loop only. Pending bursts are
+// written before the destructor returns.
+class BurstCapture {
+ public:
+  BurstCapture(const char *dir, int frame_w, int frame_h,
+               const BurstConfig &config = {});
+  ~BurstCapture();
+
+  BurstCapture(const BurstCapture &) = delete;
+  BurstCapture &operator=(const BurstCapture &) = delete;
+
+  // `frame` is a CHW RGB frame of the constructor size.
+  void Add(const void *frame);
+  // Flushes the ring once post_frames more frames have been added; the last
+  // added frame is the trigger frame. Ignored while a trigger is pending.
+  void Trigger();
+
+  uint64_t Frames() const { return frames_; }
+  uint64_t Skipped() const { return skipped_; }  // no free slot
+  uint64_t Bursts() const;                       // containers written
+  uint64_t FramesWritten() const;
+  uint64_t Failed() const;  // containers that could not be written
+  void PrintStats() const;
+
+ private:
+  struct Job {
+    std::vector<size_t> slots;
+    uint64_t first_frame;
+    uint64_t trigger_frame;
+  };
+
+  void CopyScaled(const uint8_t *src, uint8_t *dst) const;
+  void Flush();
+  void WorkerLoop();
+  bool WriteJob(const Job &job, int index);
+
+  const std::string dir_;
+  const int frame_w_, frame_h_;
+  BurstConfig config_;
+  int out_w_, out_h_;
+  size_t frame_bytes_;
+  std::vector<std::vector<uint8_t>> slots_;
+
+  // Frame loop side
+  std::deque<size_t> ring_;
+  uint64_t ring_first_ = 0;  // frame number of ring_.front()
+  bool armed_ = false;
+  size_t post_left_ = 0;
+  uint64_t trigger_frame_ = 0;
+  uint64_t frames_ = 0;
+  uint64_t skipped_ = 0;
+
+  // Shared with the writer
+  std::thread worker_;
+  mutable std::mutex mutex_;
+  std::condition_variable jobs_cv_;
+  std::vector<size_t> free_;
+  std::deque<Job> jobs_;
+  bool stop_ = false;
+  int next_index_ = 0;
+  uint64_t bursts_ = 0;
+  uint64_t frames_written_ = 0;
+  uint64_t failed_ = 0;
+};
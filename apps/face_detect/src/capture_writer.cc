@@ -0,0 +1,189 @@
+#include "capture_writer.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <cstdio>
+#include <cstring>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+CaptureWriter::CaptureWriter(const char *dir, int frame_w, int frame_h,
+                             const CaptureConfig &config)
+    : dir_(dir), frame_w_(frame_w), frame_h_(frame_h), config_(config) {
+  // Allocate and touch the ring up front so the first capture does not
+  // fault pages in on the frame loop
+  size_t count = config_.slots ? config_.slots : 1;
+  slots_.resize(count);
+  for (size_t i = 0; i < count; i++) {
+    slots_[i].data.assign(static_cast<size_t>(frame_w_) * frame_h_ * 3, 0);
+    free_.push_back(i);
+  }
+  row_.resize(static_cast<size_t>(frame_w_) * 3);
+
+  worker_ = std::thread([this] { WorkerLoop(); });
+#if defined(SCHED_IDLE)
+  // Best effort: encode only when the frame loop has nothing to do
+  sched_param param;
+  memset(&param, 0, sizeof(param));
+  pthread_setschedparam(worker_.native_handle(), SCHED_IDLE, &param);
+#endif
+}
+
+CaptureWriter::~CaptureWriter() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  queued_cv_.notify_one();
+  worker_.join();
+}
+
+bool CaptureWriter::Submit(const void *frame, std::function<void()> release) {
+  size_t slot;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_.empty()) {
+      dropped_++;
+      return false;
+    }
+    slot = free_.back();
+    free_.pop_back();
+    slots_[slot].index = next_index_++;
+    submitted_++;
+    if (held_.size() < config_.max_held) {
+      slots_[slot].frame = frame;
+      slots_[slot].release = std::move(release);
+      held_.push_back(slot);
+      queued_cv_.notify_one();
+      return true;
+    }
+    copied_++;
+  }
+  // The slot belongs to the caller until it is queued
+  memcpy(slots_[slot].data.data(), frame, slots_[slot].data.size());
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queued_.push_back(slot);
+  }
+  queued_cv_.notify_one();
+  return false;
+}
+
+uint64_t CaptureWriter::Submitted() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return submitted_;
+}
+
+uint64_t CaptureWriter::Written() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return written_;
+}
+
+uint64_t CaptureWriter::Dropped() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return dropped_;
+}
+
+uint64_t CaptureWriter::Copied() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return copied_;
+}
+
+uint64_t CaptureWriter::Failed() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return failed_;
+}
+
+void CaptureWriter::PrintStats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  printf("capture: %llu submitted, %llu written, %llu dropped (ring of %zu), "
+         "%llu failed, %llu copied on the frame loop\n",
+         static_cast<unsigned long long>(submitted_),
+         static_cast<unsigned long long>(written_),
+         static_cast<unsigned long long>(dropped_), slots_.size(),
+         static_cast<unsigned long long>(failed_),
+         static_cast<unsigned long long>(copied_));
+}
+
+void CaptureWriter::WorkerLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    queued_cv_.wait(lock, [this] {
+      return !held_.empty() || !queued_.empty() || stop_;
+    });
+    if (!held_.empty()) {
+      // Copy from the uncached mapping here rather than on the frame loop,
+      // and give every held buffer back before the next slow encode
+      size_t slot = held_.front();
+      Slot &s = slots_[slot];
+      lock.unlock();
+      memcpy(s.data.data(), s.frame, s.data.size());
+      if (s.release) s.release();
+      s.frame = nullptr;
+      s.release = nullptr;
+      lock.lock();
+      held_.pop_front();
+      queued_.push_back(slot);
+      continue;
+    }
+    if (queued_.empty()) return;
+    size_t slot = queued_.front();
+    queued_.pop_front();
+    lock.unlock();
+
+    char name[32];
+    snprintf(name, sizeof(name), "/capture_%04d.%s", slots_[slot].index,
+             config_.raw ? "ppm" : "png");
+    std::string path = dir_ + name;
+    bool ok = config_.raw ? WritePpm(slots_[slot], path)
+                          : WritePng(slots_[slot], path);
+    if (ok) {
+      printf("Captured: %s\n", path.c_str());
+    } else {
+      printf("capture: cannot write %s\n", path.c_str());
+    }
+
+    lock.lock();
+    if (ok) {
+      written_++;
+    } else {
+      failed_++;
+    }
+    free_.push_back(slot);
+  }
+}
+
+bool CaptureWriter::WritePng(const Slot &slot, const std::string &path) {
+  // VICAP の RGB planar フレームを OpenCV の Mat に変換して PNG 保存
+  const int h = frame_h_, w = frame_w_;
+  auto *base = const_cast<uint8_t *>(slot.data.data());
+  std::vector<cv::Mat> channels = {
+      cv::Mat(h, w, CV_8UC1, base + 2 * h * w),  // B plane
+      cv::Mat(h, w, CV_8UC1, base + 1 * h * w),  // G plane
+      cv::Mat(h, w, CV_8UC1, base + 0 * h * w),  // R plane
+  };
+  cv::Mat bgr;
+  cv::merge(channels, bgr);
+  return cv::imwrite(path, bgr);
+}
+
+bool CaptureWriter::WritePpm(const Slot &slot, const std::string &path) {
+  FILE *fp = fopen(path.c_str(), "wb");
+  if (!fp) return false;
+  const size_t plane = static_cast<size_t>(frame_w_) * frame_h_;
+  const uint8_t *r = slot.data.data();
+  const uint8_t *g = r + plane;
+  const uint8_t *b = g + plane;
+  bool ok = fprintf(fp, "P6\n%d %d\n255\n", frame_w_, frame_h_) > 0;
+  for (int y = 0; y < frame_h_ && ok; y++) {
+    size_t off = static_cast<size_t>(y) * frame_w_;
+    for (int x = 0; x < frame_w_; x++) {
+      row_[3 * x + 0] = r[off + x];
+      row_[3 * x + 1] = g[off + x];
+      row_[3 * x + 2] = b[off + x];
+    }
+    ok = fwrite(row_.data(), 1, row_.size(), fp) == row_.size();
+  }
+  return fclose(fp) == 0 && ok;
+}
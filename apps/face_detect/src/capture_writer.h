@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct CaptureConfig {
+  size_t slots = 4;  // frames the RAM ring holds while the writer catches up
+  bool raw = false;  // write uncompressed PPM instead of PNG
+  // Caller buffers the writer may hold before it has copied them; past this
+  // Submit copies on the caller's thread. Keep it below what the caller's
+  // buffer pool can spare, or the pool runs dry while the writer is starved.
+  size_t max_held = 1;
+};
+
+// Saves captured frames off the frame loop. Submit hands the CHW RGB frame
+// to a low-priority worker thread and returns without touching the pixels.
+// The worker copies the frame into a preallocated ring slot and calls
+// `release` so the caller's buffer goes back to its pool. It copies and
+// releases every frame handed to it before it encodes any copy (PNG, or PPM
+// on the raw path, which skips compression) and writes capture_NNNN.png /
+// .ppm to the directory. When `max_held` frames are already waiting for the
+// copy, Submit copies the frame itself. When every slot is still waiting for
+// the writer the capture is dropped and counted instead of blocking the
+// caller. Pending captures are copied, released and written before the
+// destructor returns.
+class CaptureWriter {
+ public:
+  CaptureWriter(const char *dir, int frame_w, int frame_h,
+                const CaptureConfig &config = {});
+  ~CaptureWriter();
+
+  CaptureWriter(const CaptureWriter &) = delete;
+  CaptureWriter &operator=(const CaptureWriter &) = delete;
+
+  // True if the worker took the frame: `frame` must stay valid until it
+  // calls `release`. False if the frame was copied here or the ring is full;
+  // the caller keeps the frame and `release` is never called.
+  bool Submit(const void *frame, std::function<void()> release);
+
+  uint64_t Submitted() const;
+  uint64_t Written() const;
+  uint64_t Dropped() const;  // ring full
+  uint64_t Copied() const;   // copied by Submit, max_held reached
+  uint64_t Failed() const;   // encode or write error
+  void PrintStats() const;
+
+ private:
+  struct Slot {
+    std::vector<uint8_t> data;
+    int index;  // number in the file name
+    const void *frame;  // caller's buffer until copied
+    std::function<void()> release;
+  };
+
+  void WorkerLoop();
+  bool WritePng(const Slot &slot, const std::string &path);
+  bool WritePpm(const Slot &slot, const std::string &path);
+
+  const std::string dir_;
+  const int frame_w_, frame_h_;
+  const CaptureConfig config_;
+  std::vector<Slot> slots_;
+  std::vector<uint8_t> row_;  // interleaved row for the raw path
+
+  std::thread worker_;
+  mutable std::mutex mutex_;
+  std::condition_variable queued_cv_;
+  std::vector<size_t> free_;
+  std::deque<size_t> held_;    // caller's frame not copied yet
+  std::deque<size_t> queued_;  // copied, waiting for the encode
+  bool stop_ = false;
+  int next_index_ = 0;
+  uint64_t submitted_ = 0;
+  uint64_t written_ = 0;
+  uint64_t dropped_ = 0;
+  uint64_t copied_ = 0;
+  uint64_t failed_ = 0;
+};
@@ -0,0 +1,177 @@
+#include "classifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+
+using namespace nncase;
+using namespace nncase::runtime;
+using namespace nncase::runtime::k230;
+using namespace nncase::F::k230;
+
+// Crop schedules kept for the faces of recent frames; face boxes are
+// snapped to a coarse grid so a face that barely moves keeps its schedule
+#define CROP_CACHE_CAPACITY 16
+#define CROP_GRID 32
+
+Classifier::Classifier(const char *kmodel_file, const char *labels_file,
+                       size_t channel, size_t height, size_t width,
+                       size_t max_crops)
+    : Model("Classifier", kmodel_file),
+      ai2d_input_c_(channel),
+      ai2d_input_h_(height),
+      ai2d_input_w_(width),
+      max_crops_(max_crops) {
+  // Load labels
+  std::ifstream ifs(labels_file);
+  std::string line;
+  while (std::getline(ifs, line)) {
+    // Trim trailing whitespace
+    while (!line.empty() &&
+           (line.back() == '\n' || line.back() == '\r' || line.back() == ' ')) {
+      line.pop_back();
+    }
+    if (!line.empty()) {
+      labels_.push_back(line);
+    }
+  }
+  printf("Loaded %zu labels\n", labels_.size());
+
+  // AI2D output tensor = kmodel input tensor
+  ai2d_out_tensor_ = InputTensor(0);
+
+  // AI2D config: stretch resize (no padding, no aspect ratio preservation)
+  ai2d_in_shape_ = {1, ai2d_input_c_, ai2d_input_h_, ai2d_input_w_};
+  auto out_shape = InputShape(0);
+  if (max_crops_ > 0) {
+    InitCascade(out_shape);
+    return;
+  }
+
+  ai2d_datatype_t ai2d_dtype{ai2d_format::NCHW_FMT, ai2d_format::NCHW_FMT,
+                             typecode_t::dt_uint8, typecode_t::dt_uint8};
+  ai2d_crop_param_t crop_param{false, 0, 0, 0, 0};
+  ai2d_shift_param_t shift_param{false, 0};
+  ai2d_pad_param_t pad_param{false,
+                             {{0, 0}, {0, 0}, {0, 0}, {0, 0}},
+                             ai2d_pad_mode::constant,
+                             {0, 0, 0}};
+  ai2d_resize_param_t resize_param{true, ai2d_interp_method::tf_bilinear,
+                                   ai2d_interp_mode::half_pixel};
+  ai2d_affine_param_t affine_param{false};
+
+  ai2d_builder_.reset(new ai2d_builder(ai2d_in_shape_, out_shape, ai2d_dtype,
+                                       crop_param, shift_param, pad_param,
+                                       resize_param, affine_param));
+  BuildAi2dSchedule();
+}
+
+void Classifier::InitCascade(const dims_t &in_shape) {
+  // one AI2D output per image of the batch
+  batch_ = in_shape[0];
+  if (OutputShape(0)[0] != batch_) {
+    std::cerr << "Classifier: output batch does not match input batch "
+              << batch_ << std::endl;
+    std::abort();
+  }
+  auto input = InputTensor(0);
+  if (batch_ == 1) {
+    batch_inputs_.push_back(input);
+  } else {
+    auto host =
+        input.impl()->to_host().unwrap()->buffer().as_host().unwrap();
+    uintptr_t paddr = host.physical_address().expect(
+        "classifier input has no physical address");
+    input_map_ = host.map(map_access_::map_write).expect("cannot map input");
+    auto *data = input_map_.buffer().data();
+    size_t image_bytes = input_map_.buffer().size_bytes() / batch_;
+    dims_t image_shape = in_shape;
+    image_shape[0] = 1;
+    for (size_t i = 0; i < batch_; i++) {
+      batch_inputs_.push_back(
+          host_runtime_tensor::create(
+              typecode_t::dt_uint8, image_shape,
+              {data + i * image_bytes, image_bytes}, false, hrt::pool_shared,
+              paddr + i * image_bytes)
+              .expect("cannot create batch input tensor"));
+    }
+  }
+  crop_cache_.reset(
+      new CropCache(CROP_CACHE_CAPACITY, CROP_GRID, MakeCropBuilder));
+  printf("Classifier: cascade of up to %zu crops, batch %zu\n", max_crops_,
+         batch_);
+}
+
+Classifier::~Classifier() {}
+
+void Classifier::SetCrops(const std::vector<face_coordinate> &boxes) {
+  size_t n = std::min(boxes.size(), max_crops_);
+  crops_.assign(boxes.begin(), boxes.begin() + n);
+  crop_results_.resize(n);
+  pre_pass_ = 0;
+  post_pass_ = 0;
+}
+
+Ai2dGeometry Classifier::CropGeometry(const face_coordinate &box) const {
+  auto shape = batch_inputs_[0].shape();
+  Ai2dGeometry g;
+  g.in_c = static_cast<int>(ai2d_input_c_);
+  g.in_h = static_cast<int>(ai2d_input_h_);
+  g.in_w = static_cast<int>(ai2d_input_w_);
+  int x1 = std::max(box.x1, 0), y1 = std::max(box.y1, 0);
+  int x2 = std::min(box.x2, g.in_w), y2 = std::min(box.y2, g.in_h);
+  g.crop_x = x1;
+  g.crop_y = y1;
+  g.crop_w = std::max(x2 - x1, 1);
+  g.crop_h = std::max(y2 - y1, 1);
+  g.out_c = static_cast<int>(shape[1]);
+  g.out_h = static_cast<int>(shape[2]);
+  g.out_w = static_cast<int>(shape[3]);
+  return g;
+}
+
+void Classifier::Preprocess(runtime_tensor &input) {
+  ScopedTiming st(Stage::kAi2d);
+
+  if (max_crops_ == 0) {
+    ai2d_builder_->invoke(input, ai2d_out_tensor_)
+        .expect("error occurred in ai2d running");
+    return;
+  }
+
+  // crops of this pass into consecutive images of the batch; images past
+  // the last crop keep stale data and their results are ignored
+  size_t first = pre_pass_++ * batch_;
+  size_t n = std::min(batch_, crops_.size() - first);
+  for (size_t i = 0; i < n; i++) {
+    auto &builder = crop_cache_->Acquire(CropGeometry(crops_[first + i]));
+    builder->invoke(input, batch_inputs_[i])
+        .expect("error occurred in ai2d running");
+  }
+}
+
+void Classifier::Postprocess() {
+  ScopedTiming st(Stage::kDecode);
+
+  auto out_shape = OutputShape(0);
+  int num_classes = static_cast<int>(out_shape[1]);
+  if (max_crops_ == 0) {
+    InvalidateOutputs();
+    ClassifierPostprocess(OutputData(0), OutputQuantParams(0), num_classes,
+                          labels_, &result_);
+    return;
+  }
+
+  size_t first = post_pass_++ * batch_;
+  size_t n = std::min(batch_, crops_.size() - first);
+  size_t row_bytes = OutputBytes(0) / batch_;
+  // only the rows of this pass's crops are read
+  InvalidateOutput(0, 0, n * row_bytes);
+  auto *rows = static_cast<const uint8_t *>(OutputData(0));
+  for (size_t i = 0; i < n; i++) {
+    ClassifierPostprocess(rows + i * row_bytes, OutputQuantParams(0),
+                          num_classes, labels_, &crop_results_[first + i]);
+  }
+}
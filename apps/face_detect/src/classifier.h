@@ -0,0 +1,59 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ai2d_cache.h"
+#include "classifier_postprocess.h"
+#include "model.h"
+#include "util.h"
+
+// Classifies the whole frame after a stretch resize, or with max_crops > 0
+// (cascade mode) up to max_crops regions of it, such as detected faces.
+// Crops fill the batch dimension of the kmodel input, so a kmodel compiled
+// with batch N classifies N crops per KPU run; more crops than the batch
+// take further passes over the same frame.
+class Classifier : public Model {
+ public:
+  Classifier(const char *kmodel_file, const char *labels_file, size_t channel,
+             size_t height, size_t width, size_t max_crops = 0);
+  ~Classifier();
+  ClassifyResult GetResult() const { return result_; }
+
+  // Cascade mode: regions of the next frame to classify, in frame
+  // coordinates. Boxes beyond max_crops are ignored.
+  void SetCrops(const std::vector<face_coordinate> &boxes);
+  // Preprocess/KPU/postprocess passes the crops set last need.
+  size_t Passes() const { return (crops_.size() + batch_ - 1) / batch_; }
+  // One result per crop, valid after all passes.
+  const std::vector<ClassifyResult> &CropResults() const {
+    return crop_results_;
+  }
+  size_t Batch() const { return batch_; }
+
+ protected:
+  void Preprocess(nr::runtime_tensor &input) override;
+  void Postprocess() override;
+
+ private:
+  size_t ai2d_input_c_;
+  size_t ai2d_input_h_;
+  size_t ai2d_input_w_;
+  std::vector<std::string> labels_;
+  ClassifyResult result_;
+
+  using CropCache = Ai2dScheduleCache<std::unique_ptr<nfk::ai2d_builder>>;
+  size_t max_crops_;
+  size_t batch_ = 1;
+  nr::mapped_buffer input_map_;  // batch > 1: backs batch_inputs_
+  std::vector<nr::runtime_tensor> batch_inputs_;  // one image of the input
+  std::vector<face_coordinate> crops_;
+  std::vector<ClassifyResult> crop_results_;
+  size_t pre_pass_ = 0;
+  size_t post_pass_ = 0;
+  std::unique_ptr<CropCache> crop_cache_;
+
+  void InitCascade(const nncase::dims_t &in_shape);
+  Ai2dGeometry CropGeometry(const face_coordinate &box) const;
+};
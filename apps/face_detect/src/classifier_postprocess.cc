@@ -0,0 +1,66 @@
+#include "classifier_postprocess.h"
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+
+void ClassifierPostprocess(const float *logits, int num_classes,
+                           const std::vector<std::string> &labels,
+                           ClassifyResult *result) {
+  // Argmax
+  int max_idx =
+      static_cast<int>(std::max_element(logits, logits + num_classes) - logits);
+
+  // Softmax of the top-1 only: p(top) = 1 / sum_j exp(l_j - l_top)
+  float sum = 0.0f;
+  for (int i = 0; i < num_classes; i++) {
+    sum += std::exp(logits[i] - logits[max_idx]);
+  }
+
+  result->class_id = max_idx;
+  result->confidence = 1.0f / sum;
+  result->label =
+      (max_idx < static_cast<int>(labels.size())) ? labels[max_idx] : "???";
+}
+
+template <class T>
+static void QuantizedTop1(const T *q, const OutputQuant &quant,
+                          int num_classes,
+                          const std::vector<std::string> &labels,
+                          ClassifyResult *result) {
+  // The scale is positive, so the order of the integers is the order of the
+  // logits
+  int max_idx = static_cast<int>(std::max_element(q, q + num_classes) - q);
+
+  // p(top) = 1 / sum_j exp(scale * (q_j - q_top))
+  float sum = 0.0f;
+  for (int i = 0; i < num_classes; i++) {
+    sum += std::exp(quant.scale * static_cast<float>(q[i] - q[max_idx]));
+  }
+
+  result->class_id = max_idx;
+  result->confidence = 1.0f / sum;
+  result->label =
+      (max_idx < static_cast<int>(labels.size())) ? labels[max_idx] : "???";
+}
+
+void ClassifierPostprocess(const void *output, const OutputQuant &quant,
+                           int num_classes,
+                           const std::vector<std::string> &labels,
+                           ClassifyResult *result) {
+  switch (quant.type) {
+    case OutputType::kFloat32:
+      ClassifierPostprocess(static_cast<const float *>(output), num_classes,
+                            labels, result);
+      break;
+    case OutputType::kUint8:
+      QuantizedTop1(static_cast<const uint8_t *>(output), quant, num_classes,
+                    labels, result);
+      break;
+    case OutputType::kInt8:
+      QuantizedTop1(static_cast<const int8_t *>(output), quant, num_classes,
+                    labels, result);
+      break;
+  }
+}
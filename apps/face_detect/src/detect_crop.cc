@@ -0,0 +1,34 @@
+#include "detect_crop.h"
+
+#include <algorithm>
+
+static int AlignUp(int v, int align) { return (v + align - 1) / align * align; }
+
+DetectCrop PlanDetectCrop(const std::vector<face_coordinate> &faces,
+                          int frame_w, int frame_h, int model_size,
+                          const DetectCropConfig &config) {
+  DetectCrop crop;
+  if (faces.empty()) return crop;
+
+  int x1 = frame_w, y1 = frame_h, x2 = 0, y2 = 0, face_size = 0;
+  for (const auto &f : faces) {
+    x1 = std::min(x1, f.x1);
+    y1 = std::min(y1, f.y1);
+    x2 = std::max(x2, f.x2);
+    y2 = std::max(y2, f.y2);
+    face_size = std::max(face_size, std::max(f.x2 - f.x1, f.y2 - f.y1));
+  }
+  int margin = static_cast<int>(face_size * config.margin);
+  int side = std::max(std::max(x2 - x1, y2 - y1) + 2 * margin, model_size);
+  side = AlignUp(side, config.align);
+  if (side > std::min(frame_w, frame_h)) return crop;
+
+  // Centre on the faces, then slide back inside the frame
+  int x = (x1 + x2 - side) / 2 / config.align * config.align;
+  int y = (y1 + y2 - side) / 2 / config.align * config.align;
+  crop.x = std::max(0, std::min(x, frame_w - side));
+  crop.y = std::max(0, std::min(y, frame_h - side));
+  crop.side = side;
+  crop.enabled = true;
+  return crop;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <vector>
+
+#include "util.h"
+
+// Region of the frame fed to the detector. A crop is a square that AI2D
+// resizes to the model input without padding; otherwise the whole frame is
+// letterboxed.
+struct DetectCrop {
+  bool enabled = false;
+  int x = 0, y = 0, side = 0;
+};
+
+struct DetectCropConfig {
+  float margin = 1.0f;  // context around the faces, in face sizes per side
+  int align = 16;       // crop position and size step, so a still scene
+                        // keeps reusing the same AI2D schedule
+};
+
+// Plans the crop for the next detection from the faces found so far: the
+// union of the boxes grown by the margin, made square and never smaller
+// than the model input, so small faces reach the model at native
+// resolution instead of being scaled down with the whole frame. Falls back
+// to the full frame when there are no faces or the square would not fit in
+// the frame. SDK-free.
+DetectCrop PlanDetectCrop(const std::vector<face_coordinate> &faces,
+                          int frame_w, int frame_h, int model_size,
+                          const DetectCropConfig &config = {});
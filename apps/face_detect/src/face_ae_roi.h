@@ -1,21 +1,54 @@
 #pragma once
 
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 
+#include "ae_roi_filter.h"
 #include "k_isp_comm.h"
 #include "mpi_isp_api.h"
 #include "util.h"
 
+// Meters AE on the detected faces. By default every Update sends the raw
+// boxes to the ISP. SetFilter smooths them and drops small or too frequent
+// changes (AeRoiFilter); StartWorker moves the ISP call to a worker thread
+// so Update never blocks on the driver. The worker applies only the latest
+// ROI: one posted while the previous is still being applied replaces any
+// older one that has not been applied yet.
 class FaceAeRoi {
  public:
   FaceAeRoi(k_isp_dev dev, k_u32 model_w, k_u32 model_h, k_u32 sensor_w,
             k_u32 sensor_h);
+  ~FaceAeRoi();
 
   void SetEnable(bool enable);
+  void SetFilter(const AeRoiFilterConfig& config);
+  void StartWorker();
   void Update(const std::vector<face_coordinate>& boxes);
 
+  const AeRoiFilter* Filter() const { return filter_.get(); }
+  // ROIs handed to the ISP, and ROIs the worker replaced before applying.
+  uint64_t IspUpdates() const;
+  uint64_t Superseded() const;
+  void PrintStats() const;
+
  private:
+  void Apply(const std::vector<AeRoiWindow>& windows);
+  void WorkerLoop();
+
   k_isp_dev dev_;
   k_u32 model_w_, model_h_;
   k_u32 sensor_w_, sensor_h_;
+  std::unique_ptr<AeRoiFilter> filter_;
+
+  std::thread worker_;
+  mutable std::mutex mutex_;
+  std::condition_variable posted_;
+  k_isp_ae_roi pending_;
+  bool has_pending_ = false;
+  bool stop_ = false;
+  uint64_t isp_updates_ = 0;
+  uint64_t superseded_ = 0;
 };
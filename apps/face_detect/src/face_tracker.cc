@@ -0,0 +1,195 @@
+#include "face_tracker.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+// Filter noise as fractions of the face size, so small and large faces are
+// tracked alike: measurement jitter of a detection, and how much position
+// and velocity may change per frame beyond the constant-velocity model.
+#define MEAS_SIGMA 0.05f
+#define POS_SIGMA 0.02f
+#define VEL_SIGMA 0.02f
+#define INIT_VEL_SIGMA 0.1f
+
+static inline float Sq(float x) { return x * x; }
+
+// IoU of two boxes in center form
+static float CenterIou(const float a[4], const float b[4]) {
+  float ix = std::min(a[0] + a[2] / 2, b[0] + b[2] / 2) -
+             std::max(a[0] - a[2] / 2, b[0] - b[2] / 2);
+  float iy = std::min(a[1] + a[3] / 2, b[1] + b[3] / 2) -
+             std::max(a[1] - a[3] / 2, b[1] - b[3] / 2);
+  if (ix <= 0 || iy <= 0) return 0;
+  float inter = ix * iy;
+  return inter / (a[2] * a[3] + b[2] * b[3] - inter);
+}
+
+static void ToCenter(const face_coordinate &box, float c[4]) {
+  c[2] = static_cast<float>(std::max(box.x2 - box.x1, 1));
+  c[3] = static_cast<float>(std::max(box.y2 - box.y1, 1));
+  c[0] = box.x1 + c[2] / 2;
+  c[1] = box.y1 + c[3] / 2;
+}
+
+void FaceTracker::KalmanAxis::Init(float z, float r, float pv) {
+  x = z;
+  v = 0;
+  p00 = r;
+  p01 = 0;
+  p11 = pv;
+}
+
+void FaceTracker::KalmanAxis::Predict(float q_pos, float q_vel) {
+  // F = [1 1; 0 1], P = F P F' + diag(q_pos, q_vel)
+  x += v;
+  p00 += 2 * p01 + p11 + q_pos;
+  p01 += p11;
+  p11 += q_vel;
+}
+
+void FaceTracker::KalmanAxis::Update(float z, float r) {
+  // H = [1 0]
+  float s = p00 + r;
+  float k0 = p00 / s;
+  float k1 = p01 / s;
+  float y = z - x;
+  x += k0 * y;
+  v += k1 * y;
+  p11 -= k1 * p01;
+  p01 -= k0 * p01;
+  p00 -= k0 * p00;
+}
+
+FaceTracker::FaceTracker(int frame_w, int frame_h,
+                         const TrackerConfig &config)
+    : frame_w_(frame_w), frame_h_(frame_h), config_(config) {
+  if (config_.max_interval < 1) config_.max_interval = 1;
+}
+
+bool FaceTracker::DetectNext() {
+  frames_++;
+  if (++since_detect_ < interval_) return false;
+  since_detect_ = 0;
+  detections_++;
+  return true;
+}
+
+void FaceTracker::StepTrack(Track &t) {
+  float w = std::max(t.axis[2].x, 1.0f);
+  float h = std::max(t.axis[3].x, 1.0f);
+  for (int i = 0; i < 4; i++) {
+    float size = i % 2 ? h : w;
+    t.axis[i].Predict(Sq(POS_SIGMA * size), Sq(VEL_SIGMA * size));
+  }
+}
+
+void FaceTracker::Update(const std::vector<face_coordinate> &boxes) {
+  for (auto &t : tracks_) StepTrack(t);
+
+  // Greedy association, best IoU first
+  const int num_tracks = static_cast<int>(tracks_.size());
+  const int num_dets = static_cast<int>(boxes.size());
+  pairs_.clear();
+  for (int i = 0; i < num_tracks; i++) {
+    float pred[4];
+    for (int k = 0; k < 4; k++) pred[k] = tracks_[i].axis[k].x;
+    for (int j = 0; j < num_dets; j++) {
+      float det[4];
+      ToCenter(boxes[j], det);
+      float iou = CenterIou(pred, det);
+      if (iou >= config_.match_iou) pairs_.push_back({iou, i, j});
+    }
+  }
+  std::sort(pairs_.begin(), pairs_.end(),
+            [](const Pair &a, const Pair &b) { return a.iou > b.iou; });
+
+  track_used_.assign(num_tracks, 0);
+  det_used_.assign(num_dets, 0);
+  bool stable = true;
+  for (const auto &p : pairs_) {
+    if (track_used_[p.track] || det_used_[p.det]) continue;
+    track_used_[p.track] = 1;
+    det_used_[p.det] = 1;
+    stable = stable && p.iou >= config_.confident_iou;
+
+    Track &t = tracks_[p.track];
+    float det[4];
+    ToCenter(boxes[p.det], det);
+    for (int k = 0; k < 4; k++) {
+      float size = k % 2 ? det[3] : det[2];
+      t.axis[k].Update(det[k], Sq(MEAS_SIGMA * size));
+    }
+    t.misses = 0;
+  }
+
+  // Unmatched tracks coast until they miss too many detections
+  size_t kept = 0;
+  for (int i = 0; i < num_tracks; i++) {
+    if (!track_used_[i]) {
+      stable = false;
+      if (++tracks_[i].misses > config_.max_misses) continue;
+    }
+    tracks_[kept++] = tracks_[i];
+  }
+  tracks_.resize(kept);
+
+  for (int j = 0; j < num_dets; j++) {
+    if (det_used_[j]) continue;
+    stable = false;
+    Track t;
+    t.id = next_id_++;
+    t.misses = 0;
+    float det[4];
+    ToCenter(boxes[j], det);
+    for (int k = 0; k < 4; k++) {
+      float size = k % 2 ? det[3] : det[2];
+      t.axis[k].Init(det[k], Sq(MEAS_SIGMA * size),
+                     Sq(INIT_VEL_SIGMA * size));
+    }
+    tracks_.push_back(t);
+  }
+
+  // Back off while every face is where it was predicted to be, but never
+  // let the fastest one move more than max_drift of its size unobserved
+  if (stable) {
+    int limit = config_.max_interval;
+    for (const auto &t : tracks_) {
+      float speed = hypotf(t.axis[0].v, t.axis[1].v) /
+                    std::max(std::max(t.axis[2].x, t.axis[3].x), 1.0f);
+      if (speed * limit > config_.max_drift) {
+        limit = std::max(static_cast<int>(config_.max_drift / speed), 1);
+      }
+    }
+    interval_ = std::min(interval_ * 2, limit);
+  } else {
+    interval_ = 1;
+  }
+  Publish();
+}
+
+void FaceTracker::Predict() {
+  for (auto &t : tracks_) StepTrack(t);
+  Publish();
+}
+
+face_coordinate FaceTracker::Box(const Track &t) const {
+  float cx = t.axis[0].x, cy = t.axis[1].x;
+  float w = std::max(t.axis[2].x, 1.0f), h = std::max(t.axis[3].x, 1.0f);
+  face_coordinate box;
+  box.x1 = std::max(static_cast<int>(cx - w / 2), 0);
+  box.y1 = std::max(static_cast<int>(cy - h / 2), 0);
+  box.x2 = std::min(static_cast<int>(cx + w / 2), frame_w_);
+  box.y2 = std::min(static_cast<int>(cy + h / 2), frame_h_);
+  return box;
+}
+
+void FaceTracker::Publish() {
+  faces_.clear();
+  for (const auto &t : tracks_) {
+    // a track coasting out of the frame has nothing left to draw
+    face_coordinate box = Box(t);
+    if (box.x2 <= box.x1 || box.y2 <= box.y1) continue;
+    faces_.push_back({t.id, box});
+  }
+}
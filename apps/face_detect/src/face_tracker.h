@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "util.h"
+
+struct TrackerConfig {
+  int max_interval = 8;        // detect at least every N frames
+  float match_iou = 0.3f;      // min IoU to match a detection to a track
+  float confident_iou = 0.7f;  // prediction vs detection IoU to back off
+  float max_drift = 0.2f;      // box sizes a face may move between detections
+  int max_misses = 1;          // missed detections before a track is dropped
+};
+
+struct TrackedFace {
+  int id;  // stable for the life of the track
+  face_coordinate box;
+};
+
+// Fills the frames between detections. Each face is a track with a
+// constant-velocity Kalman filter per box coordinate; detections are matched
+// to the predicted boxes greedily by IoU. Output boxes are the filtered
+// states, so they are smooth on detection frames too.
+//
+// The detection cadence adapts to how well the tracks are predicted: after a
+// detection in which every track was matched with high IoU and nothing
+// appeared or vanished, the interval doubles, up to max_interval and to the
+// number of frames the fastest face needs to move max_drift of its size.
+// Anything else drops it back to every frame.
+//
+// Has no SDK dependency so recorded box sequences can be replayed on a host
+// (track_sim in apps/host_tools). Not thread-safe.
+class FaceTracker {
+ public:
+  FaceTracker(int frame_w, int frame_h, const TrackerConfig &config = {});
+
+  // Called once per frame, in frame order, before its inference: true if
+  // the detector should run on it. Then call Update or Predict.
+  bool DetectNext();
+  // Detection frame: match, correct, start and drop tracks.
+  void Update(const std::vector<face_coordinate> &boxes);
+  // Frame without detection: advance every track by one frame.
+  void Predict();
+
+  const std::vector<TrackedFace> &Faces() const { return faces_; }
+  int Interval() const { return interval_; }
+  uint64_t Frames() const { return frames_; }
+  uint64_t Detections() const { return detections_; }
+  int TracksStarted() const { return next_id_; }
+
+ private:
+  // One box coordinate with position and velocity per frame.
+  struct KalmanAxis {
+    float x, v;
+    float p00, p01, p11;
+    void Init(float z, float r, float pv);
+    void Predict(float q_pos, float q_vel);
+    void Update(float z, float r);
+  };
+  struct Track {
+    int id;
+    KalmanAxis axis[4];  // cx, cy, w, h
+    int misses;
+  };
+  struct Pair {
+    float iou;
+    int track, det;
+  };
+
+  static void StepTrack(Track &t);
+  face_coordinate Box(const Track &t) const;
+  void Publish();
+
+  int frame_w_, frame_h_;
+  TrackerConfig config_;
+  std::vector<Track> tracks_;
+  std::vector<TrackedFace> faces_;
+  std::vector<Pair> pairs_;  // candidate matches of the current Update
+  std::vector<char> det_used_;
+  std::vector<char> track_used_;
+  int interval_ = 1;
+  int since_detect_ = 0;
+  int next_id_ = 0;
+  uint64_t frames_ = 0;
+  uint64_t detections_ = 0;
+};
@@ -0,0 +1,122 @@
+#include "init_graph.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <thread>
+
+void InitGraph::Add(const char *name, const std::vector<const char *> &deps,
+                    std::function<int()> fn) {
+  Step step;
+  step.name = name;
+  for (const char *dep : deps) {
+    int idx = Find(dep);
+    if (idx < 0) {
+      fprintf(stderr, "init step %s: unknown dependency %s\n", name, dep);
+      abort();
+    }
+    step.deps.push_back(static_cast<size_t>(idx));
+  }
+  step.fn = std::move(fn);
+  step.state = State::kPending;
+  step.result = 0;
+  step.start_us = 0;
+  step.duration_us = 0;
+  steps_.push_back(std::move(step));
+}
+
+int InitGraph::Run() {
+  start_ = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  threads.reserve(steps_.size());
+  for (size_t i = 0; i < steps_.size(); i++) {
+    threads.emplace_back(&InitGraph::RunStep, this, i);
+  }
+  for (auto &t : threads) t.join();
+  total_us_ = NowUs();
+
+  for (const auto &step : steps_) {
+    if (step.state == State::kFailed) return step.result;
+  }
+  return 0;
+}
+
+void InitGraph::RunStep(size_t idx) {
+  Step &step = steps_[idx];
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    bool failed = false;
+    done_cv_.wait(lock, [&] {
+      for (size_t dep : step.deps) {
+        State s = steps_[dep].state;
+        if (s == State::kFailed || s == State::kSkipped) {
+          failed = true;
+          return true;
+        }
+        if (s != State::kDone) return false;
+      }
+      return true;
+    });
+    if (failed) {
+      step.state = State::kSkipped;
+      done_cv_.notify_all();
+      return;
+    }
+    step.state = State::kRunning;
+    step.start_us = NowUs();
+  }
+
+  int result = step.fn();
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  step.duration_us = NowUs() - step.start_us;
+  step.result = result;
+  step.state = result == 0 ? State::kDone : State::kFailed;
+  done_cv_.notify_all();
+}
+
+uint64_t InitGraph::NowUs() const {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - start_)
+      .count();
+}
+
+int InitGraph::Find(const char *name) const {
+  for (size_t i = 0; i < steps_.size(); i++) {
+    if (steps_[i].name == name) return static_cast<int>(i);
+  }
+  return -1;
+}
+
+bool InitGraph::Succeeded(const char *name) const {
+  int idx = Find(name);
+  std::lock_guard<std::mutex> lock(mutex_);
+  return idx >= 0 && steps_[idx].state == State::kDone;
+}
+
+double InitGraph::TotalMs() const { return total_us_ / 1000.0; }
+
+double InitGraph::SerialMs() const {
+  uint64_t sum = 0;
+  for (const auto &step : steps_) sum += step.duration_us;
+  return sum / 1000.0;
+}
+
+void InitGraph::PrintReport() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  printf("init: %.1f ms (%.1f ms one after another)\n", TotalMs(),
+         SerialMs());
+  for (const auto &step : steps_) {
+    switch (step.state) {
+      case State::kDone:
+      case State::kFailed:
+        printf("  %-10s %7.1f ms from %6.1f ms%s\n", step.name.c_str(),
+               step.duration_us / 1000.0, step.start_us / 1000.0,
+               step.state == State::kFailed ? "  FAILED" : "");
+        break;
+      default:
+        printf("  %-10s skipped\n", step.name.c_str());
+        break;
+    }
+  }
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Runs startup steps concurrently in dependency order. Each step declares
+// the steps it needs by name; Run starts every step on its own thread as
+// soon as those have finished, so independent bring-up (kmodel load, VB,
+// connector, sensor) overlaps and only the dependency chains are serial. A
+// step that fails (returns non-zero) skips every step that depends on it.
+// Run records when each step started and how long it took for PrintReport.
+//
+// Has no SDK dependency. Steps are added before Run; Add and Run are called
+// from one thread.
+class InitGraph {
+ public:
+  // `deps` name steps added earlier, which keeps the graph acyclic. `fn`
+  // returns 0 on success.
+  void Add(const char *name, const std::vector<const char *> &deps,
+           std::function<int()> fn);
+
+  // Runs all steps and returns when they are done: 0 if every step
+  // succeeded, else the result of the first step that failed.
+  int Run();
+
+  bool Succeeded(const char *name) const;
+  // Wall time of Run, and what the steps would take one after another.
+  double TotalMs() const;
+  double SerialMs() const;
+  void PrintReport() const;
+
+ private:
+  enum class State { kPending, kRunning, kDone, kFailed, kSkipped };
+  struct Step {
+    std::string name;
+    std::vector<size_t> deps;
+    std::function<int()> fn;
+    State state;
+    int result;
+    uint64_t start_us;
+    uint64_t duration_us;
+  };
+
+  void RunStep(size_t idx);
+  uint64_t NowUs() const;
+  int Find(const char *name) const;
+
+  std::vector<Step> steps_;
+  std::chrono::steady_clock::time_point start_;
+  uint64_t total_us_ = 0;
+  mutable std::mutex mutex_;
+  std::condition_variable done_cv_;
+};
@@ -0,0 +1,66 @@
+#include "kpu_scheduler.h"
+
+#include <chrono>
+
+static uint64_t NowUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+int KpuScheduler::Add(Model &model, const std::string &name, int priority,
+                      double target_fps) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  models_.push_back(&model);
+  return policy_.AddClient(name, priority, target_fps);
+}
+
+bool KpuScheduler::Admit(int id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return policy_.Admit(id, NowUs());
+}
+
+void KpuScheduler::RunPreprocess(int id, size_t slot,
+                                 nr::runtime_tensor &input, bool sync) {
+  Acquire(id, KpuResource::kAi2d);
+  models_[id]->RunPreprocess(slot, input, sync);
+  Release(id, KpuResource::kAi2d);
+}
+
+void KpuScheduler::RunKpu(int id, size_t slot) {
+  Acquire(id, KpuResource::kKpu);
+  models_[id]->RunKpu(slot);
+  Release(id, KpuResource::kKpu);
+}
+
+bool KpuScheduler::Run(int id, nr::runtime_tensor &input, bool sync,
+                       size_t passes) {
+  if (!Admit(id)) return false;
+  for (size_t i = 0; i < passes; i++) {
+    // the input only needs writing back once per frame
+    RunPreprocess(id, 0, input, sync && i == 0);
+    RunKpu(id, 0);
+    models_[id]->RunPostprocess(0);
+  }
+  return true;
+}
+
+void KpuScheduler::PrintStats(FILE *fp) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  policy_.Report(fp, NowUs());
+}
+
+void KpuScheduler::Acquire(int id, KpuResource res) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  policy_.Enqueue(id, res, NowUs());
+  granted_.wait(lock, [&] { return policy_.Pick(res) == id; });
+  policy_.Begin(id, res, NowUs());
+}
+
+void KpuScheduler::Release(int id, KpuResource res) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    policy_.End(id, res, NowUs());
+  }
+  granted_.notify_all();
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "model.h"
+#include "schedule_policy.h"
+
+// Shares the AI2D and the KPU between several Model instances in one
+// process. Each model is driven from its own thread (or pipeline stage)
+// and goes through the scheduler for the hardware steps; postprocessing
+// runs on the CPU and is not arbitrated. Ordering and rate limiting are
+// decided by SchedulePolicy.
+class KpuScheduler {
+ public:
+  // priority: larger runs first when both want the same unit.
+  // target_fps: 0 admits every frame.
+  int Add(Model &model, const std::string &name, int priority,
+          double target_fps);
+
+  // Rate gate: false means the model should skip this frame.
+  bool Admit(int id);
+  void RunPreprocess(int id, size_t slot, nr::runtime_tensor &input,
+                     bool sync);
+  void RunKpu(int id, size_t slot);
+  // Admit, AI2D, KPU and postprocess on slot 0. Returns false if skipped.
+  // A model that needs several passes over one frame (cascaded crops) runs
+  // them back to back; each pass queues for the units like a frame.
+  bool Run(int id, nr::runtime_tensor &input, bool sync, size_t passes = 1);
+
+  void PrintStats(FILE *fp = stdout) const;
+
+ private:
+  void Acquire(int id, KpuResource res);
+  void Release(int id, KpuResource res);
+
+  std::vector<Model *> models_;
+  SchedulePolicy policy_;
+  mutable std::mutex mutex_;
+  std::condition_variable granted_;
+};
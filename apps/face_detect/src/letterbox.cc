@@ -0,0 +1,17 @@
+#include "letterbox.h"
+
+Letterbox FitLetterbox(int frame_w, int frame_h, int model_w, int model_h) {
+  Letterbox lb;
+  float w_ratio = static_cast<float>(frame_w) / model_w;
+  float h_ratio = static_cast<float>(frame_h) / model_h;
+  lb.ratio = w_ratio > h_ratio ? w_ratio : h_ratio;
+  int h_pad = model_h - static_cast<int>(frame_h / lb.ratio);
+  int w_pad = model_w - static_cast<int>(frame_w / lb.ratio);
+  if (h_pad < 0) h_pad = 0;
+  if (w_pad < 0) w_pad = 0;
+  lb.pad_top = h_pad / 2;
+  lb.pad_bottom = h_pad - lb.pad_top;
+  lb.pad_left = w_pad / 2;
+  lb.pad_right = w_pad - lb.pad_left;
+  return lb;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+// How AI2D fits a whole frame into the model input: scaled by 1 / ratio to
+// fit, keeping the aspect ratio, and centered with constant padding. Pads
+// are in model pixels; the odd pixel of an uneven pad goes after.
+struct Letterbox {
+  float ratio = 1.0f;  // frame pixels per model pixel
+  int pad_top = 0, pad_bottom = 0;
+  int pad_left = 0, pad_right = 0;
+};
+
+// Letterbox of a frame_w x frame_h frame in a model_w x model_h input. Both
+// the AI2D pad parameters and the mapping of detections back to the frame
+// are derived from it, so they agree for any channel geometry. SDK-free.
+Letterbox FitLetterbox(int frame_w, int frame_h, int model_w, int model_h);
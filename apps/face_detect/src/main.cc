@@ -1,18 +1,29 @@
 #include <nncase/runtime/runtime_op_utility.h>
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <thread>
 
+#include "box_overlay.h"
+#include "burst_capture.h"
+#include "capture_writer.h"
+#include "classifier.h"
+#include "detect_crop.h"
 #include "face_ae_roi.h"
+#include "face_tracker.h"
+#include "frame_registry.h"
+#include "init_graph.h"
+#include "kpu_scheduler.h"
 #include "mobile_retinaface.h"
+#include "motion_gate.h"
 #include "mpi_sys_api.h"
-
-// OpenCV (キャプチャ用)
-#include <opencv2/core.hpp>
-#include <opencv2/imgcodecs.hpp>
+#include "pipeline.h"
 
 using namespace nncase;
 using namespace nncase::runtime;
@@ -49,10 +60,23 @@ using namespace nncase::runtime::detail;
 
 #define CHANNEL 3
 
+// Default chn1 (AI input) size; -i selects another at runtime
 #define ISP_CHN1_HEIGHT (720)
 #define ISP_CHN1_WIDTH (1280)
 #define ISP_CHN0_WIDTH (1920)
 #define ISP_CHN0_HEIGHT (1080)
+// The AI2D input pool; NOCACHE lets the registry skip the per-frame sync
+#define CHN1_POOL_MODE VB_REMAP_MODE_NOCACHE
+#define CHN1_POOL_BLOCKS 5
+// Mapped chn1 buffers kept by the frame registry (the pool has 5 blocks)
+#define FRAME_REGISTRY_CAPACITY 8
+// Captured frames held in RAM until the writer thread saves them
+#define CAPTURE_RING_SLOTS 4
+// Burst frames keep every Nth pixel and row down to about this width: 320
+// wide is what the 320x320 detector input holds of a letterboxed frame
+#define BURST_WIDTH 320
+// Display pixels a drawn face box may be off before it is redrawn
+#define OVERLAY_TOLERANCE 4
 
 #define ISP_INPUT_WIDTH (1920)
 #define ISP_INPUT_HEIGHT (1080)
@@ -60,12 +84,21 @@ using namespace nncase::runtime::detail;
 #define LCD_WIDTH (1080)
 #define LCD_HEIGHT (1920)
 
+// Upper bound for -p; every in-flight frame holds a VICAP buffer
+#define MAX_PIPELINE_DEPTH 4
+
+#define DEFAULT_CLASSIFY_FPS 5.0
+
 int sample_sys_bind_init(void);
 
 std::atomic<bool> quit(true);
 
 bool app_run = true;
+// chn1 size, set once from -i before the VB pools and VICAP are configured
+int chn1_width = ISP_CHN1_WIDTH;
+int chn1_height = ISP_CHN1_HEIGHT;
 std::atomic<bool> capture_requested(false);
+std::atomic<bool> burst_requested(false);
 
 void fun_sig(int sig) {
   if (sig == SIGINT) {
@@ -74,8 +107,6 @@ void fun_sig(int sig) {
   }
 }
 
-k_vo_draw_frame vo_frame = {1, 16, 16, 128, 128, 1};
-
 int vo_creat_layer_test(k_vo_layer chn_id, layer_info *info) {
   k_vo_video_layer_attr attr;
 
@@ -147,14 +178,12 @@ k_s32 sample_connector_init(void) {
   return 0;
 }
 
-static k_s32 vo_layer_vdss_bind_vo_config(void) {
+static k_s32 sample_vo_layer_init(void) {
   layer_info info;
   k_vo_layer chn_id = K_VO_LAYER1;
 
   memset(&info, 0, sizeof(info));
 
-  sample_connector_init();
-
   info.act_size.width = ISP_CHN0_WIDTH;
   info.act_size.height = ISP_CHN0_HEIGHT;
   info.format = PIXEL_FORMAT_YVU_PLANAR_420;
@@ -162,21 +191,7 @@ static k_s32 vo_layer_vdss_bind_vo_config(void) {
   info.global_alptha = 0xff;
   info.offset.x = 0;
   info.offset.y = 0;
-  vo_creat_layer_test(chn_id, &info);
-
-  return 0;
-}
-
-static void sample_vo_fn(void *arg) {
-  usleep(10000);
-  vo_layer_vdss_bind_vo_config();
-  sample_sys_bind_init();
-  return;
-}
-
-static void *sample_vo_thread(void *arg) {
-  sample_vo_fn(arg);
-  return nullptr;
+  return vo_creat_layer_test(chn_id, &info);
 }
 
 k_vicap_dev vicap_dev;
@@ -185,7 +200,6 @@ k_vicap_dev_attr dev_attr;
 k_vicap_chn_attr chn_attr;
 k_vicap_sensor_info sensor_info;
 k_vicap_sensor_type sensor_type;
-k_video_frame_info dump_info;
 
 static void sample_vicap_unbind_vo(k_mpp_chn vicap_mpp_chn,
                                    k_mpp_chn vo_mpp_chn) {
@@ -217,6 +231,37 @@ int sample_sys_bind_init(void) {
   return ret;
 }
 
+// Maps VB blocks for the frame registry. The chn1 pool is NOCACHE and
+// kd_mpi_sys_mmap returns an uncached mapping, so frames never need a cache
+// write-back before AI2D reads them.
+class VbFrameMapper : public FrameMapper {
+ public:
+  void *Map(uint64_t paddr, size_t size) override {
+    ScopedTiming st(Stage::kMmap);
+    return kd_mpi_sys_mmap(paddr, size);
+  }
+  void Unmap(void *vaddr, size_t size) override {
+    kd_mpi_sys_munmap(vaddr, size);
+  }
+};
+
+class VoOverlayDriver : public OverlayDriver {
+ public:
+  void Commit(const std::vector<OverlayOp> &ops) override {
+    k_vo_draw_frame frame;
+    memset(&frame, 0, sizeof(frame));
+    for (const auto &op : ops) {
+      frame.draw_en = op.draw ? 1 : 0;
+      frame.line_x_start = op.box.x1;
+      frame.line_y_start = op.box.y1;
+      frame.line_x_end = op.box.x2;
+      frame.line_y_end = op.box.y2;
+      frame.frame_num = op.slot;
+      kd_mpi_vo_draw_frame(&frame);
+    }
+  }
+};
+
 int sample_vb_init(void) {
   k_s32 ret;
   k_vb_config config;
@@ -229,10 +274,10 @@ int sample_vb_init(void) {
       (ISP_CHN0_WIDTH * ISP_CHN0_HEIGHT * 3 / 2), VICAP_ALIGN_1K);
 
   // VB for RGB888 output
-  config.comm_pool[1].blk_cnt = 5;
-  config.comm_pool[1].mode = VB_REMAP_MODE_NOCACHE;
+  config.comm_pool[1].blk_cnt = CHN1_POOL_BLOCKS;
+  config.comm_pool[1].mode = CHN1_POOL_MODE;
   config.comm_pool[1].blk_size =
-      VICAP_ALIGN_UP((ISP_CHN1_HEIGHT * ISP_CHN1_WIDTH * 3), VICAP_ALIGN_1K);
+      VICAP_ALIGN_UP((chn1_height * chn1_width * 3), VICAP_ALIGN_1K);
 
   ret = kd_mpi_vb_set_config(&config);
   if (ret) {
@@ -316,8 +361,8 @@ int sample_vivcap_init(void) {
   // set chn1 output rgb888p
   chn_attr.out_win.h_start = 0;
   chn_attr.out_win.v_start = 0;
-  chn_attr.out_win.width = ISP_CHN1_WIDTH;
-  chn_attr.out_win.height = ISP_CHN1_HEIGHT;
+  chn_attr.out_win.width = chn1_width;
+  chn_attr.out_win.height = chn1_height;
 
   chn_attr.crop_win = dev_attr.acq_win;
   chn_attr.scale_win = chn_attr.out_win;
@@ -327,7 +372,7 @@ int sample_vivcap_init(void) {
   chn_attr.pix_format = PIXEL_FORMAT_RGB_888_PLANAR;
   chn_attr.buffer_num = VICAP_MAX_FRAME_COUNT;  // at least 3 buffers for isp
   chn_attr.buffer_size =
-      VICAP_ALIGN_UP((ISP_CHN1_HEIGHT * ISP_CHN1_WIDTH * 3), VICAP_ALIGN_1K);
+      VICAP_ALIGN_UP((chn1_height * chn1_width * 3), VICAP_ALIGN_1K);
 
   ret = kd_mpi_vicap_set_chn_attr(vicap_dev, VICAP_CHN_ID_1, chn_attr);
   if (ret) {
@@ -345,37 +390,34 @@ int sample_vivcap_init(void) {
   ret = kd_mpi_vicap_init(vicap_dev);
   if (ret) {
     printf("sample_vicap, kd_mpi_vicap_init failed.\n");
-    return ret;
   }
-  ret = kd_mpi_vicap_start_stream(vicap_dev);
+  return ret;
+}
+
+int sample_vicap_start(void) {
+  k_s32 ret = kd_mpi_vicap_start_stream(vicap_dev);
   if (ret) {
     printf("sample_vicap, kd_mpi_vicap_start_stream failed.\n");
-    return ret;
   }
   return ret;
 }
 
-static void save_frame_as_png(void *vaddr, int h, int w,
-                              const char *capture_dir, int count) {
-  // VICAP の RGB planar フレームを OpenCV の Mat に変換して PNG 保存
-  auto *base = reinterpret_cast<uint8_t *>(vaddr);
-  std::vector<cv::Mat> channels = {
-      cv::Mat(h, w, CV_8UC1, base + 2 * h * w),  // B plane
-      cv::Mat(h, w, CV_8UC1, base + 1 * h * w),  // G plane
-      cv::Mat(h, w, CV_8UC1, base + 0 * h * w),  // R plane
-  };
-  cv::Mat bgr;
-  cv::merge(channels, bgr);
-
-  char filename[256];
-  snprintf(filename, sizeof(filename), "%s/capture_%04d.png", capture_dir,
-           count);
-  cv::imwrite(filename, bgr);
-  printf("Captured: %s\n", filename);
-}
+struct Frame {
+  k_video_frame_info info;
+  void *vaddr;
+  nr::runtime_tensor input;  // cached AI2D input wrapper of the VB block
+  size_t slot;  // model tensor slot, reused once the frame is released
+  bool still;   // the motion gate saw no change; the last result is reused
+  bool detect;  // false when the tracker predicts this frame instead
+  DetectCrop crop;  // region the detector runs on
+  DetectResult result;
+  bool classified;  // false when the classifier skipped this frame
+  ClassifyResult label;
+  std::vector<ClassifyResult> labels;  // per face with -b
+};
 
 static void *input_thread(void *arg) {
-  printf("press 'q' to exit, 'c' to capture frame\n");
+  printf("press 'q' to exit, 'c' to capture frame, 'b' to flush a burst\n");
   while (app_run) {
     int ch = getchar();
     if (ch == 'q') {
@@ -383,30 +425,206 @@ static void *input_thread(void *arg) {
       break;
     } else if (ch == 'c') {
       capture_requested.store(true);
+    } else if (ch == 'b') {
+      burst_requested.store(true);
     }
   }
   return nullptr;
 }
 
+static void usage(const char *prog) {
+  std::cerr << "Usage: " << prog
+            << " [-p depth] [-s secs] [-d score] [-m frames] [-t interval]"
+            << " [-r interval] [-i WxH] [-u] [-k frames [-g trigger]]"
+            << " [-c kmodel -l labels [-f fps] [-b crops]] <kmodel> <ae_roi>"
+            << " [capture_dir]"
+            << std::endl;
+  std::cerr << "  -p depth: pipeline stages on separate threads with up to"
+            << " <depth> frames in flight (1-" << MAX_PIPELINE_DEPTH
+            << ", default 0 = serial)" << std::endl;
+  std::cerr << "  -s secs: print per-stage latency (p50/p99/max) every"
+            << " <secs> seconds" << std::endl;
+  std::cerr << "  -d score: face score mode, softmax (default) or logit"
+            << std::endl;
+  std::cerr << "  -m frames: reuse the last result while the scene is"
+            << " static, for at most <frames> frames (default 0 = off)"
+            << std::endl;
+  std::cerr << "  -t interval: track faces between detections, detecting"
+            << " at least every <interval> frames (default 0 = every frame)"
+            << std::endl;
+  std::cerr << "  -r interval: detect in a crop around the known faces, on"
+            << " the full frame at least every <interval> detections"
+            << std::endl;
+  std::cerr << "  -c kmodel: also classify the whole frame with this model,"
+            << " sharing the KPU with detection" << std::endl;
+  std::cerr << "  -l labels: label file for -c" << std::endl;
+  std::cerr << "  -f fps: classification rate (default "
+            << DEFAULT_CLASSIFY_FPS << ")" << std::endl;
+  std::cerr << "  -b crops: classify up to <crops> detected faces per frame"
+            << " instead of the whole frame" << std::endl;
+  std::cerr << "  -i WxH: AI input (ISP chn1) size, e.g. 640x360 or 320x180;"
+            << " width a multiple of 16 (default " << ISP_CHN1_WIDTH << "x"
+            << ISP_CHN1_HEIGHT << ")" << std::endl;
+  std::cerr << "  -u: save captures as uncompressed PPM instead of PNG"
+            << std::endl;
+  std::cerr << "  -k frames: keep the last <frames> frames for burst capture"
+            << " to capture_dir" << std::endl;
+  std::cerr << "  -g trigger: burst trigger, key ('b', default), face (a"
+            << " face appears) or count (every <frames> frames)" << std::endl;
+  std::cerr << "  ae_roi: 0=disable, 1=enable, 2=enable with smoothed,"
+            << " rate-limited updates from a worker thread" << std::endl;
+  std::cerr << "  capture_dir: directory to save captures to (optional)"
+            << std::endl;
+}
+
 int main(int argc, char *argv[]) {
+  const auto app_start = std::chrono::steady_clock::now();
   /*Allow one frame time for the VO to release the VB block*/
   k_u32 display_ms = 1000 / 33;
-  int face_count = 1;
   int ret;
   const char *capture_dir = nullptr;
-  int capture_count = 0;
+  CaptureConfig capture_config;
+  capture_config.slots = CAPTURE_RING_SLOTS;
+  BurstConfig burst_config;
+  int burst_frames = 0;
+  bool burst_on_face = false;
+  int pipeline_depth = 0;
+  int stats_interval = 0;
+  const char *classifier_file = nullptr;
+  const char *labels_file = nullptr;
+  double classify_fps = DEFAULT_CLASSIFY_FPS;
+  int cascade_crops = 0;
+  int motion_stale = 0;
+  int track_interval = 0;
+  int roi_interval = 0;
+  RetinafaceScoreMode score_mode = RetinafaceScoreMode::kSoftmax;
+  const char *prog = argv[0];
+
+  int opt;
+  while ((opt = getopt(argc, argv, "p:s:d:m:t:r:c:l:f:b:uk:g:i:")) != -1) {
+    switch (opt) {
+      case 'p':
+        pipeline_depth = atoi(optarg);
+        if (pipeline_depth < 0 || pipeline_depth > MAX_PIPELINE_DEPTH) {
+          usage(prog);
+          return -1;
+        }
+        break;
+      case 's':
+        stats_interval = atoi(optarg);
+        if (stats_interval <= 0) {
+          usage(prog);
+          return -1;
+        }
+        break;
+      case 'd':
+        if (strcmp(optarg, "logit") == 0) {
+          score_mode = RetinafaceScoreMode::kLogit;
+        } else if (strcmp(optarg, "softmax") == 0) {
+          score_mode = RetinafaceScoreMode::kSoftmax;
+        } else {
+          usage(prog);
+          return -1;
+        }
+        break;
+      case 'm':
+        motion_stale = atoi(optarg);
+        if (motion_stale < 0) {
+          usage(prog);
+          return -1;
+        }
+        break;
+      case 't':
+        track_interval = atoi(optarg);
+        if (track_interval < 0) {
+          usage(prog);
+          return -1;
+        }
+        break;
+      case 'r':
+        roi_interval = atoi(optarg);
+        if (roi_interval < 0) {
+          usage(prog);
+          return -1;
+        }
+        break;
+      case 'c':
+        classifier_file = optarg;
+        break;
+      case 'l':
+        labels_file = optarg;
+        break;
+      case 'f':
+        classify_fps = atof(optarg);
+        if (classify_fps <= 0) {
+          usage(prog);
+          return -1;
+        }
+        break;
+      case 'b':
+        cascade_crops = atoi(optarg);
+        if (cascade_crops <= 0) {
+          usage(prog);
+          return -1;
+        }
+        break;
+      case 'u':
+        capture_config.raw = true;
+        break;
+      case 'i':
+        if (sscanf(optarg, "%dx%d", &chn1_width, &chn1_height) != 2 ||
+            chn1_width <= 0 || chn1_width > ISP_CHN0_WIDTH ||
+            chn1_width % 16 != 0 || chn1_height <= 0 ||
+            chn1_height > ISP_CHN0_HEIGHT || chn1_height % 2 != 0) {
+          usage(prog);
+          return -1;
+        }
+        break;
+      case 'k':
+        burst_frames = atoi(optarg);
+        if (burst_frames <= 0) {
+          usage(prog);
+          return -1;
+        }
+        break;
+      case 'g':
+        if (strcmp(optarg, "key") == 0) {
+          burst_config.continuous = false;
+          burst_on_face = false;
+        } else if (strcmp(optarg, "face") == 0) {
+          burst_config.continuous = false;
+          burst_on_face = true;
+        } else if (strcmp(optarg, "count") == 0) {
+          burst_config.continuous = true;
+          burst_on_face = false;
+        } else {
+          usage(prog);
+          return -1;
+        }
+        break;
+      default:
+        usage(prog);
+        return -1;
+    }
+  }
+  // Shift so the positional arguments keep their original indices
+  argc -= optind - 1;
+  argv += optind - 1;
 
   if (argc < 3 || argc > 4) {
-    std::cerr << "Usage: " << argv[0] << " <kmodel> <ae_roi> [capture_dir]"
-              << std::endl;
-    std::cerr << "  ae_roi: 0=disable, 1=enable" << std::endl;
-    std::cerr << "  capture_dir: directory to save PNG captures (optional)"
-              << std::endl;
+    usage(prog);
     return -1;
   }
   if (argc == 4) {
     capture_dir = argv[3];
   }
+  if ((classifier_file && !labels_file) ||
+      (cascade_crops > 0 && !classifier_file) ||
+      (burst_frames > 0 && !capture_dir)) {
+    usage(prog);
+    return -1;
+  }
+  burst_config.scale = std::max(1, chn1_width / BURST_WIDTH);
 
   /****fixed operation for ctrl+c****/
   struct sigaction sa;
@@ -415,99 +633,395 @@ int main(int argc, char *argv[]) {
   sigfillset(&sa.sa_mask);
   sigaction(SIGINT, &sa, nullptr);
 
-  pthread_t vo_thread_handle;
+  // SIGUSR1 prints per-stage latency, SIGUSR2 toggles recording
+  if (stats_interval > 0) {
+    StageProfiler::Get().SetEnabled(true);
+  }
+  StageProfiler::Get().StartReporter(stats_interval);
+
   pthread_t input_thread_handle;
   pthread_create(&input_thread_handle, nullptr, input_thread, nullptr);
 
-  size_t size = CHANNEL * ISP_CHN1_HEIGHT * ISP_CHN1_WIDTH;
+  size_t size = CHANNEL * chn1_height * chn1_width;
 
-  MobileRetinaface model(argv[1], CHANNEL, ISP_CHN1_HEIGHT, ISP_CHN1_WIDTH);
-  DetectResult box_result;
+  size_t frame_seq = 0;
   std::vector<face_coordinate> boxes;
 
-  ret = sample_vb_init();
-  if (ret) {
-    goto vb_init_error;
+  // With -m frames of a static scene skip inference and reuse the result of
+  // the last inferred frame
+  std::unique_ptr<MotionGate> motion_gate;
+  DetectResult still_result;
+  if (motion_stale > 0) {
+    MotionGateConfig config;
+    config.max_stale = motion_stale;
+    motion_gate.reset(new MotionGate(chn1_width, chn1_height, config));
   }
 
-  pthread_create(&vo_thread_handle, nullptr, sample_vo_thread, nullptr);
-  ret = sample_vivcap_init();
-  pthread_join(vo_thread_handle, nullptr);
+  // With -t the tracker fills the frames between detections and decides
+  // which frames still run the detector
+  std::unique_ptr<FaceTracker> tracker;
+  std::mutex tracker_mutex;
+  if (track_interval > 0) {
+    TrackerConfig config;
+    config.max_interval = track_interval;
+    tracker.reset(new FaceTracker(chn1_width, chn1_height, config));
+  }
+
+  // With -r detection runs on a crop around the faces decoded last, so
+  // small faces keep their native resolution
+  std::mutex roi_mutex;
+  std::vector<face_coordinate> roi_faces;
+  int crops_since_full = 0;
+  uint64_t detect_frames = 0, crop_frames = 0;
+
+  // Bring-up runs as a dependency graph: the kmodel loads while VB, the
+  // display and the sensor come up, and each chain starts as soon as what
+  // it needs is ready
+  std::unique_ptr<MobileRetinaface> detector;
+  std::unique_ptr<Classifier> classifier;
+  InitGraph init;
+  init.Add("model", {}, [&]() {
+    // One tensor slot per in-flight frame so AI2D, KPU and decode can
+    // overlap
+    detector.reset(new MobileRetinaface(argv[1], CHANNEL, chn1_height,
+                                        chn1_width,
+                                        pipeline_depth > 0 ? pipeline_depth
+                                                           : 1));
+    detector->SetScoreMode(score_mode);
+    return 0;
+  });
+  if (classifier_file) {
+    // After the detector rather than beside it: both allocate from the
+    // nncase runtime, which is not documented as thread-safe
+    init.Add("classifier", {"model"}, [&]() {
+      classifier.reset(new Classifier(classifier_file, labels_file, CHANNEL,
+                                      chn1_height, chn1_width,
+                                      cascade_crops));
+      return 0;
+    });
+  }
+  init.Add("vb", {}, sample_vb_init);
+  init.Add("connector", {}, sample_connector_init);
+  init.Add("vo", {"connector"}, sample_vo_layer_init);
+  init.Add("sensor", {"vb"}, sample_vivcap_init);
+  init.Add("bind", {"vo", "sensor"}, sample_sys_bind_init);
+  init.Add("stream", {"bind"}, sample_vicap_start);
+  ret = init.Run();
+  init.PrintReport();
+  if (detector) detector->PrintStartup();
+  if (classifier) classifier->PrintStartup();
+  if (!init.Succeeded("vb")) {
+    goto vb_init_error;
+  }
   if (ret) {
     goto vicap_init_error;
   }
 
   {
-    FaceAeRoi face_ae_roi(static_cast<k_isp_dev>(vicap_dev), ISP_CHN1_WIDTH,
-                          ISP_CHN1_HEIGHT, sensor_info.width,
-                          sensor_info.height);
-    face_ae_roi.SetEnable(atoi(argv[2]) == 1);
-
-    while (app_run) {
-      memset(&dump_info, 0, sizeof(k_video_frame_info));
-      ret = kd_mpi_vicap_dump_frame(vicap_dev, VICAP_CHN_ID_1, VICAP_DUMP_YUV,
-                                    &dump_info, 1000);
+    MobileRetinaface &model = *detector;
+
+    // Detection runs on every frame and wins the KPU over classification
+    KpuScheduler scheduler;
+    int detect_id = scheduler.Add(model, "detect", 1, 0);
+    int classify_id = -1;
+    std::string last_label;
+    if (classifier) {
+      classify_id = scheduler.Add(*classifier, "classify", 0, classify_fps);
+    }
+    bool detected_once = false;
+
+    FaceAeRoi face_ae_roi(static_cast<k_isp_dev>(vicap_dev), chn1_width,
+                          chn1_height, sensor_info.width, sensor_info.height);
+    const int ae_roi_mode = atoi(argv[2]);
+    face_ae_roi.SetEnable(ae_roi_mode >= 1);
+    if (ae_roi_mode == 2) {
+      face_ae_roi.SetFilter(AeRoiFilterConfig());
+      face_ae_roi.StartWorker();
+    }
+
+    VbFrameMapper mapper;
+    FrameRegistry<nr::runtime_tensor> frames(
+        mapper, size, FRAME_REGISTRY_CAPACITY,
+        [&](void *vaddr, uint64_t paddr) {
+          return model.WrapInput(reinterpret_cast<uintptr_t>(vaddr), paddr);
+        });
+    const bool sync_input = CHN1_POOL_MODE != VB_REMAP_MODE_NOCACHE;
+
+    std::unique_ptr<CaptureWriter> capture;
+    if (capture_dir != nullptr) {
+      // The writer may hold what the pipeline's frames and the one VICAP is
+      // filling leave of the chn1 pool
+      size_t in_flight = pipeline_depth > 0 ? pipeline_depth : 1;
+      capture_config.max_held = CHN1_POOL_BLOCKS - 1 - in_flight;
+      capture.reset(new CaptureWriter(capture_dir, chn1_width, chn1_height,
+                                      capture_config));
+    }
+    // With a trigger, half the burst comes from after it
+    std::unique_ptr<BurstCapture> burst;
+    bool had_faces = false;
+    if (burst_frames > 0) {
+      burst_config.frames = burst_frames;
+      burst_config.post_frames =
+          burst_config.continuous ? 0 : burst_frames / 2;
+      burst.reset(new BurstCapture(capture_dir, chn1_width, chn1_height,
+                                   burst_config));
+    }
+
+    VoOverlayDriver overlay_driver;
+    BoxOverlay overlay(overlay_driver, OVERLAY_TOLERANCE);
+    std::vector<OverlayBox> overlay_boxes;
+
+    Pipeline<Frame> pipeline(pipeline_depth);
+
+    pipeline.SetSource("capture", [&](Frame &f) {
+      if (!app_run) return false;
+      memset(&f.info, 0, sizeof(k_video_frame_info));
+      f.classified = false;
+      int ret;
+      {
+        ScopedTiming st(Stage::kDumpFrame);
+        ret = kd_mpi_vicap_dump_frame(vicap_dev, VICAP_CHN_ID_1,
+                                      VICAP_DUMP_YUV, &f.info, 1000);
+      }
       if (ret) {
+        StageProfiler::Get().Count(Counter::kDumpErrors);
         quit.store(false);
         printf("sample_vicap...kd_mpi_vicap_dump_frame failed.\n");
-        break;
+        return false;
+      }
+      auto &buf = frames.Acquire(f.info.v_frame.phys_addr[0]);
+      f.vaddr = buf.vaddr;
+      f.input = buf.payload;
+      f.slot = frame_seq++ % model.Slots();
+      f.still = false;
+      if (motion_gate) {
+        ScopedTiming st(Stage::kMotion);
+        f.still = !motion_gate->Check(static_cast<const uint8_t *>(f.vaddr));
+      }
+      f.detect = !f.still;
+      if (tracker && !f.still) {
+        std::lock_guard<std::mutex> lock(tracker_mutex);
+        f.detect = tracker->DetectNext();
+      }
+      f.crop = DetectCrop();
+      if (f.detect && roi_interval > 0) {
+        if (crops_since_full + 1 < roi_interval) {
+          std::lock_guard<std::mutex> lock(roi_mutex);
+          f.crop = PlanDetectCrop(roi_faces, chn1_width, chn1_height,
+                                  model.ModelSize());
+        }
+        crops_since_full = f.crop.enabled ? crops_since_full + 1 : 0;
+        crop_frames += f.crop.enabled;
+      }
+      if (f.detect) {
+        detect_frames++;
+        scheduler.Admit(detect_id);
+      }
+      return true;
+    });
+
+    pipeline.AddStage("ai2d", [&](Frame &f) {
+      if (!f.detect) return;
+      model.SetCrop(f.slot, f.crop);
+      scheduler.RunPreprocess(detect_id, f.slot, f.input, sync_input);
+    });
+
+    pipeline.AddStage("kpu", [&](Frame &f) {
+      if (!f.detect) return;
+      scheduler.RunKpu(detect_id, f.slot);
+    });
+
+    pipeline.AddStage("decode", [&](Frame &f) {
+      if (f.still) {
+        f.result = still_result;
+        return;
+      }
+      if (f.detect) {
+        model.RunPostprocess(f.slot);
+        // get face boxes
+        f.result = model.GetResult();
+        if (!detected_once) {
+          detected_once = true;
+          printf("first detection %.1f ms after start\n",
+                 std::chrono::duration<double, std::milli>(
+                     std::chrono::steady_clock::now() - app_start)
+                     .count());
+        }
+      }
+      if (tracker) {
+        ScopedTiming st(Stage::kTrack);
+        std::lock_guard<std::mutex> lock(tracker_mutex);
+        if (f.detect) {
+          tracker->Update(f.result.boxes);
+        } else {
+          tracker->Predict();
+        }
+        // draw the smoothed tracks; landmarks are not tracked
+        f.result.boxes.clear();
+        f.result.landmarks.clear();
+        for (const auto &face : tracker->Faces()) {
+          f.result.boxes.push_back(face.box);
+        }
+      }
+      if (roi_interval > 0) {
+        std::lock_guard<std::mutex> lock(roi_mutex);
+        roi_faces = f.result.boxes;
+      }
+      if (motion_gate) still_result = f.result;
+    });
+
+    if (classifier) {
+      pipeline.AddStage("classify", [&](Frame &f) {
+        if (f.still) return;
+        if (cascade_crops == 0) {
+          f.classified = scheduler.Run(classify_id, f.input, sync_input);
+          if (f.classified) f.label = classifier->GetResult();
+          return;
+        }
+        // every face of the frame in as few KPU runs as the batch allows
+        if (f.result.boxes.empty()) return;
+        classifier->SetCrops(f.result.boxes);
+        f.classified = scheduler.Run(classify_id, f.input, sync_input,
+                                     classifier->Passes());
+        if (f.classified) f.labels = classifier->CropResults();
+      });
+    }
+
+    pipeline.AddStage("present", [&](Frame &f) {
+      boxes = f.result.boxes;
+
+      StageProfiler::Get().Count(Counter::kFrames);
+      StageProfiler::Get().Count(Counter::kDetections, boxes.size());
+
+      {
+        ScopedTiming st(Stage::kVoDraw);
+        overlay_boxes.resize(boxes.size());
+        for (size_t i = 0; i < boxes.size(); i++) {
+          OverlayBox &o = overlay_boxes[i];
+          o.x1 = static_cast<uint32_t>(boxes[i].x1) * ISP_CHN0_WIDTH /
+                 chn1_width;
+          o.y1 = static_cast<uint32_t>(boxes[i].y1) * ISP_CHN0_HEIGHT /
+                 chn1_height;
+          o.x2 = static_cast<uint32_t>(boxes[i].x2) * ISP_CHN0_WIDTH /
+                 chn1_width;
+          o.y2 = static_cast<uint32_t>(boxes[i].y2) * ISP_CHN0_HEIGHT /
+                 chn1_height;
+        }
+        overlay.Update(overlay_boxes);
       }
 
-      auto vbvaddr = kd_mpi_sys_mmap(dump_info.v_frame.phys_addr[0], size);
-      boxes.clear();
-      // run kpu
-      model.Run(reinterpret_cast<uintptr_t>(vbvaddr),
-                reinterpret_cast<uintptr_t>(dump_info.v_frame.phys_addr[0]));
-      // get face boxes
-      box_result = model.GetResult();
-      boxes = box_result.boxes;
-
-      if (boxes.size() < face_count) {
-        for (size_t i = boxes.size(); i < face_count; i++) {
-          vo_frame.draw_en = 0;
-          vo_frame.frame_num = i + 1;
-          kd_mpi_vo_draw_frame(&vo_frame);
+      if (f.classified && cascade_crops > 0) {
+        std::string labels, line;
+        char conf[16];
+        for (const auto &l : f.labels) {
+          labels += l.label + ";";
+          snprintf(conf, sizeof(conf), " (%.2f)", l.confidence);
+          line += (line.empty() ? "" : ", ") + l.label + conf;
+        }
+        if (labels != last_label) {
+          printf("faces: %s\n", line.c_str());
+          last_label = labels;
         }
+      } else if (f.classified && f.label.label != last_label) {
+        printf("class: %s (%.2f)\n", f.label.label.c_str(),
+               f.label.confidence);
+        last_label = f.label.label;
       }
 
-      for (size_t i = 0, j = 0; i < boxes.size(); i += 1) {
-        vo_frame.draw_en = 1;
-        vo_frame.line_x_start = static_cast<uint32_t>(boxes[i].x1) *
-                                ISP_CHN0_WIDTH / ISP_CHN1_WIDTH;
-        vo_frame.line_y_start = static_cast<uint32_t>(boxes[i].y1) *
-                                ISP_CHN0_HEIGHT / ISP_CHN1_HEIGHT;
-        vo_frame.line_x_end = static_cast<uint32_t>(boxes[i].x2) *
-                              ISP_CHN0_WIDTH / ISP_CHN1_WIDTH;
-        vo_frame.line_y_end = static_cast<uint32_t>(boxes[i].y2) *
-                              ISP_CHN0_HEIGHT / ISP_CHN1_HEIGHT;
-        vo_frame.frame_num = ++j;
-        kd_mpi_vo_draw_frame(&vo_frame);
+      {
+        ScopedTiming st(Stage::kAeRoi);
+        face_ae_roi.Update(boxes);
       }
-      face_count = boxes.size();
 
-      face_ae_roi.Update(boxes);
+      if (burst) {
+        ScopedTiming st(Stage::kCapture);
+        burst->Add(f.vaddr);
+        if (burst_requested.exchange(false) ||
+            (burst_on_face && !had_faces && !boxes.empty())) {
+          burst->Trigger();
+        }
+        had_faces = !boxes.empty();
+      }
 
-      // 'c' が押されていたらキャプチャ
-      if (capture_requested.load() && capture_dir != nullptr) {
-        save_frame_as_png(vbvaddr, ISP_CHN1_HEIGHT, ISP_CHN1_WIDTH, capture_dir,
-                          capture_count++);
+      // 'c' が押されていたらキャプチャ。受け付けられたフレームはライターの
+      // スレッドがコピーしてから解放するので、ここでは解放しない
+      bool handed_off = false;
+      if (capture_requested.load() && capture) {
+        ScopedTiming st(Stage::kCapture);
+        k_video_frame_info info = f.info;
+        handed_off = capture->Submit(f.vaddr, [info]() mutable {
+          if (kd_mpi_vicap_dump_release(vicap_dev, VICAP_CHN_ID_1, &info)) {
+            printf("sample_vicap...kd_mpi_vicap_dump_release failed.\n");
+          }
+        });
         capture_requested.store(false);
       }
 
-      kd_mpi_sys_munmap(vbvaddr, size);
-      ret = kd_mpi_vicap_dump_release(vicap_dev, VICAP_CHN_ID_1, &dump_info);
-      if (ret) {
-        printf("sample_vicap...kd_mpi_vicap_dump_release failed.\n");
+      if (!handed_off) {
+        int ret =
+            kd_mpi_vicap_dump_release(vicap_dev, VICAP_CHN_ID_1, &f.info);
+        if (ret) {
+          printf("sample_vicap...kd_mpi_vicap_dump_release failed.\n");
+        }
       }
+    });
+
+    pipeline.Run();
+    overlay.Clear();
+    if (pipeline_depth > 0) {
+      pipeline.PrintStats();
+    }
+    if (classifier) {
+      scheduler.PrintStats();
+    }
+    if (roi_interval > 0) {
+      printf("roi: %llu of %llu detections on a crop\n",
+             static_cast<unsigned long long>(crop_frames),
+             static_cast<unsigned long long>(detect_frames));
+      const auto &cache = model.CropSchedules();
+      printf("ai2d crop schedules: %zu cached, %llu hits, %llu misses, "
+             "%llu evictions\n",
+             cache.Size(), static_cast<unsigned long long>(cache.Hits()),
+             static_cast<unsigned long long>(cache.Misses()),
+             static_cast<unsigned long long>(cache.Evictions()));
+    }
+    if (motion_gate) {
+      printf("motion gate: inferred %llu of %llu frames\n",
+             static_cast<unsigned long long>(motion_gate->Inferred()),
+             static_cast<unsigned long long>(motion_gate->Frames()));
+    }
+    if (ae_roi_mode == 2) {
+      face_ae_roi.PrintStats();
+    }
+    printf("vo overlay: %llu commits for %llu frames, %llu draws, "
+           "%llu erases, %llu kept\n",
+           static_cast<unsigned long long>(overlay.Commits()),
+           static_cast<unsigned long long>(overlay.Frames()),
+           static_cast<unsigned long long>(overlay.Draws()),
+           static_cast<unsigned long long>(overlay.Erases()),
+           static_cast<unsigned long long>(overlay.Kept()));
+    if (capture) {
+      capture->PrintStats();
+    }
+    if (burst) {
+      burst->PrintStats();
+    }
+    if (tracker) {
+      printf("tracker: detected %llu of %llu frames, %d tracks\n",
+             static_cast<unsigned long long>(tracker->Detections()),
+             static_cast<unsigned long long>(tracker->Frames()),
+             tracker->TracksStarted());
+    }
+    printf("frame registry: %zu buffers, %llu hits, %llu misses\n",
+           frames.Size(), static_cast<unsigned long long>(frames.Hits()),
+           static_cast<unsigned long long>(frames.Misses()));
+    StageProfiler::Get().StopReporter();
+    if (StageProfiler::Get().Enabled()) {
+      StageProfiler::Get().Dump(stdout);
     }
   }
 
   pthread_join(input_thread_handle, nullptr);
-  for (size_t i = 0; i < boxes.size(); i++) {
-    vo_frame.draw_en = 0;
-    vo_frame.frame_num = i + 1;
-    kd_mpi_vo_draw_frame(&vo_frame);
-  }
   boxes.clear();
   ret = kd_mpi_vicap_stop_stream(vicap_dev);
   if (ret) {
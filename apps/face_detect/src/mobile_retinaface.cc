@@ -1,9 +1,12 @@
 #include "mobile_retinaface.h"
 
+#include <algorithm>
 #include <chrono>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
 
+#include "letterbox.h"
 #include "util.h"
 
 using namespace nncase;
@@ -11,394 +14,117 @@ using namespace nncase::runtime;
 using namespace nncase::runtime::k230;
 using namespace nncase::F::k230;
 
-#define MIN_SIZE 200
-#define LOC_SIZE 4
-#define CONF_SIZE 2
-#define LAND_SIZE 10
+// Crop schedules kept for a crop moving around the frame
+#define CROP_CACHE_CAPACITY 8
 
-extern float anchors320[4200][4];
-typedef int (*__compar_fn_t)(__const void*, __const void*);
 static float umeyama_args[] = {76.5892,  103.3926, 147.0636, 103.0028,
                                112.0504, 143.4732, 83.0986,  184.731,
                                141.4598, 184.4082};
 
 MobileRetinaface::MobileRetinaface(const char* kmodel_file, size_t channel,
-                                   size_t height, size_t width)
-    : Model("MobileRetinaface", kmodel_file),
+                                   size_t height, size_t width, size_t slots)
+    : Model("MobileRetinaface", kmodel_file, slots),
       ai2d_input_c_(channel),
       ai2d_input_h_(height),
-      ai2d_input_w_(width) {
+      ai2d_input_w_(width),
+      crop_cache_(CROP_CACHE_CAPACITY, DetectCropConfig().align,
+                  MakeCropBuilder) {
   // ai2d output tensor
   ai2d_out_tensor_ = InputTensor(0);
 
   // ai2d config
-  dims_t in_shape{1, ai2d_input_c_, ai2d_input_h_, ai2d_input_w_};
+  ai2d_in_shape_ = {1, ai2d_input_c_, ai2d_input_h_, ai2d_input_w_};
   auto out_shape = InputShape(0);
 
   ai2d_datatype_t ai2d_dtype{ai2d_format::NCHW_FMT, ai2d_format::NCHW_FMT,
                              typecode_t::dt_uint8, typecode_t::dt_uint8};
   ai2d_crop_param_t crop_param{false, 0, 0, 0, 0};
   ai2d_shift_param_t shift_param{false, 0};
-  float h_ratio = static_cast<float>(height) / out_shape[2];
-  float w_ratio = static_cast<float>(width) / out_shape[3];
-  float ratio = h_ratio > w_ratio ? h_ratio : w_ratio;
-  int h_pad = out_shape[2] - height / ratio;
-  int h_pad_before = h_pad / 2;
-  int h_pad_after = h_pad - h_pad_before;
-  int w_pad = out_shape[3] - width / ratio;
-  int w_pad_before = w_pad / 2;
-  int w_pad_after = w_pad - w_pad_before;
-
+  // the same letterbox RetinafacePostprocess maps the faces back from
+  Letterbox lb = FitLetterbox(static_cast<int>(width), static_cast<int>(height),
+                              static_cast<int>(out_shape[3]),
+                              static_cast<int>(out_shape[2]));
   ai2d_pad_param_t pad_param{true,
-                             {{0, 0}, {0, 0}, {70, 70}, {0, 0}},
+                             {{0, 0},
+                              {0, 0},
+                              {lb.pad_top, lb.pad_bottom},
+                              {lb.pad_left, lb.pad_right}},
                              ai2d_pad_mode::constant,
                              {0, 0, 0}};
   ai2d_resize_param_t resize_param{true, ai2d_interp_method::tf_bilinear,
                                    ai2d_interp_mode::half_pixel};
   ai2d_affine_param_t affine_param{false};
-  ai2d_builder_.reset(new ai2d_builder(in_shape, out_shape, ai2d_dtype,
+  ai2d_builder_.reset(new ai2d_builder(ai2d_in_shape_, out_shape, ai2d_dtype,
                                        crop_param, shift_param, pad_param,
                                        resize_param, affine_param));
-  ai2d_builder_->build_schedule();
-}
-
-MobileRetinaface::~MobileRetinaface() {}
-
-void MobileRetinaface::Preprocess(uintptr_t vaddr, uintptr_t paddr) {
-#if ENABLE_PROFILING
-  ScopedTiming st(ModelName() + " " + __FUNCTION__);
-#endif
-
-  // ai2d input tensor
-  dims_t in_shape{1, ai2d_input_c_, ai2d_input_h_, ai2d_input_w_};
-  auto ai2d_in_tensor =
-      host_runtime_tensor::create(
-          typecode_t::dt_uint8, in_shape,
-          {reinterpret_cast<gsl::byte*>(vaddr), compute_size(in_shape)}, false,
-          hrt::pool_shared, paddr)
-          .expect("cannot create input tensor");
-  hrt::sync(ai2d_in_tensor, sync_op_t::sync_write_back, true)
-      .expect("sync write_back failed");
-
-  // run ai2d
-  ai2d_builder_->invoke(ai2d_in_tensor, ai2d_out_tensor_)
-      .expect("error occurred in ai2d running");
-}
-
-void MobileRetinaface::Postprocess() {
-#if ENABLE_PROFILING
-  ScopedTiming st(ModelName() + " " + __FUNCTION__);
-#endif
-
-  std::vector<box_t> pred_box;
-  pred_box.reserve(16);
-  std::vector<landmarks_t> landmarks;
-
-  Decode(pred_box, landmarks);
-
-  int long_side = ai2d_input_h_ > ai2d_input_w_ ? ai2d_input_h_ : ai2d_input_w_;
-  int short_side =
-      ai2d_input_h_ < ai2d_input_w_ ? ai2d_input_h_ : ai2d_input_w_;
-  int pad = (long_side - short_side) / 2;
-  bool width_pad = long_side == ai2d_input_h_ ? true : false;
-
-  // boxes
-  result_.boxes.clear();
-  result_.boxes.reserve(pred_box.size());
-  for (size_t i = 0; i < pred_box.size(); i++) {
-    face_coordinate box;
+  BuildAi2dSchedule();
 
-    if (width_pad) {
-      box.x1 = static_cast<int>(pred_box[i].x * long_side -
-                                pred_box[i].w * long_side / 2) -
-               pad;
-      box.y1 = static_cast<int>(pred_box[i].y * long_side -
-                                pred_box[i].h * long_side / 2);
-      box.x2 = static_cast<int>(pred_box[i].x * long_side +
-                                pred_box[i].w * long_side / 2) -
-               pad;
-      box.y2 = static_cast<int>(pred_box[i].y * long_side +
-                                pred_box[i].h * long_side / 2);
-    } else {
-      box.x1 = static_cast<int>(pred_box[i].x * long_side -
-                                pred_box[i].w * long_side / 2);
-      box.y1 = static_cast<int>(pred_box[i].y * long_side -
-                                pred_box[i].h * long_side / 2) -
-               pad;
-      box.x2 = static_cast<int>(pred_box[i].x * long_side +
-                                pred_box[i].w * long_side / 2);
-      box.y2 = static_cast<int>(pred_box[i].y * long_side +
-                                pred_box[i].h * long_side / 2) -
-               pad;
-    }
-
-    box.x1 = box.x1 < 0 ? 1 : box.x1;
-    box.y1 = box.y1 < 0 ? 1 : box.y1;
-    box.x2 = box.x2 > ai2d_input_w_ ? ai2d_input_w_ : box.x2;
-    box.y2 = box.y2 > ai2d_input_h_ ? ai2d_input_h_ : box.y2;
-
-    result_.boxes.push_back(box);
+  // crops are squares, resized to the model input without padding
+  if (out_shape[2] != out_shape[3]) {
+    std::cerr << "MobileRetinaface: model input must be square" << std::endl;
+    std::abort();
   }
-
-  // landmarks
-  result_.landmarks.clear();
-  for (size_t i = 0; i < landmarks.size(); i++) {
-    auto landmark = landmarks[i];
-    int x = 0, y = 0;
-    for (uint32_t j = 0; j < 5; j++) {
-      if (width_pad) {
-        x = static_cast<int>(landmark.points[2 * j + 0] * long_side) - pad;
-        y = static_cast<int>(landmark.points[2 * j + 1] * long_side);
-      } else {
-        x = static_cast<int>(landmark.points[2 * j + 0] * long_side);
-        y = static_cast<int>(landmark.points[2 * j + 1] * long_side) - pad;
-      }
-
-      landmark.points[2 * j + 0] = x;
-      landmark.points[2 * j + 1] = y;
-    }
-    result_.landmarks.push_back(landmark);
+  model_size_ = static_cast<int>(out_shape[2]);
+  crops_.resize(Slots());
+
+  // decode workspace, sized from the conf heads ([1, 4, H, W] per stride)
+  int conf_size[3];
+  for (int i = 0; i < 3; i++) {
+    auto shape = OutputShape(3 + i);
+    conf_size[i] = static_cast<int>(shape[2] * shape[3]);
   }
+  post_.reset(new RetinafacePostprocess(static_cast<int>(out_shape[2]),
+                                        static_cast<int>(out_shape[3]),
+                                        conf_size, height, width));
+  post_->SetInvalidator([this](int output, size_t offset, size_t bytes) {
+    InvalidateOutput(output, offset, bytes);
+  });
 }
 
-float MobileRetinaface::Overlap(float x1, float w1, float x2, float w2) {
-  float l1 = x1 - w1 / 2;
-  float l2 = x2 - w2 / 2;
-  float left = l1 > l2 ? l1 : l2;
-  float r1 = x1 + w1 / 2;
-  float r2 = x2 + w2 / 2;
-  float right = r1 < r2 ? r1 : r2;
-
-  return right - left;
-}
-
-float MobileRetinaface::BoxIntersection(box_t a, box_t b) {
-  float w = Overlap(a.x, a.w, b.x, b.w);
-  float h = Overlap(a.y, a.h, b.y, b.h);
-
-  if (w < 0 || h < 0) return 0;
-  return w * h;
-}
-
-float MobileRetinaface::BoxUnion(box_t a, box_t b) {
-  float i = BoxIntersection(a, b);
-  float u = a.w * a.h + b.w * b.h - i;
-
-  return u;
-}
-
-float MobileRetinaface::BoxIou(box_t a, box_t b) {
-  return BoxIntersection(a, b) / BoxUnion(a, b);
-}
-
-void MobileRetinaface::DealConfOpt(float* conf, float* s_probs, int* s,
-                                   int size, int* obj_cnt, int* real_count,
-                                   float* tmp) {
-  softmax_2group_vec(size, conf, conf + size, tmp, tmp + size);  //
-  softmax_2group_vec(size, conf + 2 * size, conf + 3 * size, tmp + 2 * size,
-                     tmp + 3 * size);
-  register int cnt = *obj_cnt;
-  register int index_s = *real_count;
-
-  for (int i = 0; i < size; ++i) {
-    register float soft_vlaue = tmp[size + i];
-    if (soft_vlaue >= obj_threshold_) {
-      s[index_s] = cnt;
-      s_probs[index_s] = soft_vlaue;
-      ++index_s;
-    }
-    cnt += 1;
-    soft_vlaue = tmp[size * 3 + i];
-    if (soft_vlaue >= obj_threshold_) {
-      s[index_s] = cnt;
-      s_probs[index_s] = soft_vlaue;
-      ++index_s;
-    }
-    cnt += 1;
-  }
-
-  *obj_cnt = cnt;
-  *real_count = index_s;
-}
-
-void MobileRetinaface::DealLocOpt(float* loc, float* boxes, int size,
-                                  int* obj_cnt, int* s, int* real_count) {
-  register int cnt = *obj_cnt;
-  register int index_s = *real_count;
-  for (uint32_t ww = 0; ww < size; ww++) {
-    for (uint32_t hh = 0; hh < 2; hh++) {
-      if (cnt == s[index_s]) {
-        for (uint32_t cc = 0; cc < LOC_SIZE; cc++) {
-          boxes[index_s * LOC_SIZE + cc] =
-              loc[(hh * LOC_SIZE + cc) * size + ww];
-        }
-        index_s += 1;
-      }
-      cnt += 1;
-    }
-  }
-  *obj_cnt = cnt;
-  *real_count = index_s;
-}
-
-void MobileRetinaface::DealLandmsOpt(float* landms, float* landmarks, int size,
-                                     int* obj_cnt, int* s, int* real_count) {
-  register int cnt = *obj_cnt;
-  register int index_s = *real_count;
-  for (uint32_t ww = 0; ww < size; ww++) {
-    for (uint32_t hh = 0; hh < 2; hh++) {
-      if (cnt == s[index_s]) {
-        for (uint32_t cc = 0; cc < LAND_SIZE; cc++) {
-          landmarks[index_s * LAND_SIZE + cc] =
-              landms[(hh * LAND_SIZE + cc) * size + ww];
-        }
-        index_s += 1;
-      }
-      cnt += 1;
-    }
-  }
-  *obj_cnt = cnt;
-  *real_count = index_s;
-}
-
-box_t MobileRetinaface::GetBoxOpt(float* boxes, int obj_index,
-                                  int index_anchors) {
-  float x, y, w, h;
-  x = boxes[obj_index * LOC_SIZE + 0];
-  y = boxes[obj_index * LOC_SIZE + 1];
-  w = boxes[obj_index * LOC_SIZE + 2];
-  h = boxes[obj_index * LOC_SIZE + 3];
-  x = anchors320[index_anchors][0] + x * 0.1 * anchors320[index_anchors][2];
-  y = anchors320[index_anchors][1] + y * 0.1 * anchors320[index_anchors][3];
-  w = anchors320[index_anchors][2] * k230_expf(w * 0.2);
-  h = anchors320[index_anchors][3] * k230_expf(h * 0.2);
-  box_t box;
-  box.x = x;
-  box.y = y;
-  box.w = w;
-  box.h = h;
-  return box;
-}
+MobileRetinaface::~MobileRetinaface() {}
 
-landmarks_t MobileRetinaface::GetLandmarkOpt(float* landmarks, int obj_index,
-                                             int index_anchors) {
-  landmarks_t landmark;
-  for (uint32_t ll = 0; ll < 5; ll++) {
-    landmark.points[2 * ll + 0] =
-        anchors320[index_anchors][0] +
-        landmarks[obj_index * LAND_SIZE + 2 * ll + 0] * 0.1 *
-            anchors320[index_anchors][2];
-    landmark.points[2 * ll + 1] =
-        anchors320[index_anchors][1] +
-        landmarks[obj_index * LAND_SIZE + 2 * ll + 1] * 0.1 *
-            anchors320[index_anchors][3];
+void MobileRetinaface::Preprocess(runtime_tensor &input) {
+  ScopedTiming st(Stage::kAi2d);
+
+  DetectCrop& crop = crops_[PreprocessSlot()];
+  ai2d_builder* builder = ai2d_builder_.get();
+  if (crop.enabled) {
+    Ai2dGeometry g;
+    g.in_c = static_cast<int>(ai2d_input_c_);
+    g.in_h = static_cast<int>(ai2d_input_h_);
+    g.in_w = static_cast<int>(ai2d_input_w_);
+    g.crop_x = crop.x;
+    g.crop_y = crop.y;
+    g.crop_w = g.crop_h = crop.side;
+    g.out_c = g.in_c;
+    g.out_h = g.out_w = model_size_;
+    // decode maps the faces back from the window that was actually cropped
+    g = crop_cache_.Quantize(g);
+    crop.x = g.crop_x;
+    crop.y = g.crop_y;
+    crop.side = g.crop_w;
+    builder = crop_cache_.Acquire(g).get();
   }
-  return landmark;
-}
-
-static float* cmp_prob;
-int nms_comparator2(void* pa, void* pb) {
-  int a = *static_cast<int*>(pa);
-  int b = *static_cast<int*>(pb);
 
-  if (cmp_prob[a] < cmp_prob[b])
-    return 1;
-  else if (cmp_prob[a] > cmp_prob[b])
-    return -1;
-  else
-    return 0;
+  // run ai2d
+  builder->invoke(input, ai2d_out_tensor_)
+      .expect("error occurred in ai2d running");
 }
 
-void MobileRetinaface::Decode(std::vector<box_t>& pred_box,
-                              std::vector<landmarks_t>& pred_landmarks) {
-  const size_t size = 9;
-  float* out[size];
-  for (size_t i = 0; i < size; i++) {
-    auto tensor = OutputTensor(i);
-    auto buf = tensor.impl()
-                   ->to_host()
-                   .unwrap()
-                   ->buffer()
-                   .as_host()
-                   .unwrap()
-                   .map(map_access_::map_read)
-                   .unwrap()
-                   .buffer();
-    out[i] = reinterpret_cast<float*>(buf.data());
-  }
-
-  float* loc0 = out[0];
-  float* loc1 = out[1];
-  float* loc2 = out[2];
-  float* conf0 = out[3];
-  float* conf1 = out[4];
-  float* conf2 = out[5];
-  float* landms0 = out[6];
-  float* landms1 = out[7];
-  float* landms2 = out[8];
-
-  int objs_num = MIN_SIZE * (1 + 4 + 16);
-  int* s = static_cast<int*>(malloc(objs_num * sizeof(int)));
-  float* s_probs = static_cast<float*>(malloc(objs_num * sizeof(float)));
-  cmp_prob = s_probs;
-  int obj_cnt = 0;
-  int real_count = 0;
-
-  float* tmp = static_cast<float*>(
-      malloc(16 * MIN_SIZE / 2 * sizeof(float) * CONF_SIZE * 2));
-
-  DealConfOpt(conf0, s_probs, s, 16 * MIN_SIZE / 2, &obj_cnt, &real_count, tmp);
-  DealConfOpt(conf1, s_probs, s, 4 * MIN_SIZE / 2, &obj_cnt, &real_count, tmp);
-  DealConfOpt(conf2, s_probs, s, 1 * MIN_SIZE / 2, &obj_cnt, &real_count, tmp);
-
-  float* boxes =
-      static_cast<float*>(malloc(objs_num * LOC_SIZE * sizeof(float)));
-  obj_cnt = 0;
-  int real_count_box = 0;
-
-  DealLocOpt(loc0, boxes, 16 * MIN_SIZE / 2, &obj_cnt, s, &real_count_box);
-  DealLocOpt(loc1, boxes, 4 * MIN_SIZE / 2, &obj_cnt, s, &real_count_box);
-  DealLocOpt(loc2, boxes, 1 * MIN_SIZE / 2, &obj_cnt, s, &real_count_box);
-
-  float* landmarks =
-      static_cast<float*>(malloc(objs_num * LAND_SIZE * sizeof(float)));
-  obj_cnt = 0;
-  int real_count_landms = 0;
-  DealLandmsOpt(landms0, landmarks, 16 * MIN_SIZE / 2, &obj_cnt, s,
-                &real_count_landms);
-  DealLandmsOpt(landms1, landmarks, 4 * MIN_SIZE / 2, &obj_cnt, s,
-                &real_count_landms);
-  DealLandmsOpt(landms2, landmarks, 1 * MIN_SIZE / 2, &obj_cnt, s,
-                &real_count_landms);
-
-  objs_num = real_count;
-  int* s_int = static_cast<int*>(malloc(objs_num * sizeof(int)));
-  for (int i = 0; i < objs_num; ++i) {
-    s_int[i] = i;
+void MobileRetinaface::Postprocess() {
+  ScopedTiming st(Stage::kDecode);
+
+  const void* out[9];
+  OutputQuant quant[9];
+  const DetectCrop& crop = crops_[PostprocessSlot()];
+  if (crop.enabled) {
+    post_->SetCrop(crop.x, crop.y, crop.side);
+  } else {
+    post_->SetFullFrame();
   }
-  qsort(s_int, objs_num, sizeof(int),
-        reinterpret_cast<__compar_fn_t>(nms_comparator2));
-
-  for (int i = 0; i < objs_num; ++i) {
-    int obj_index = s_int[i];
-    if (s_probs[obj_index] < obj_threshold_) continue;
-    box_t a = GetBoxOpt(boxes, obj_index, s[obj_index]);
-    pred_box.push_back(a);
-
-    landmarks_t l = GetLandmarkOpt(landmarks, obj_index, s[obj_index]);
-    pred_landmarks.push_back(l);
-    for (int j = i + 1; j < objs_num; ++j) {
-      obj_index = s_int[j];
-      if (s_probs[obj_index] < obj_threshold_) continue;
-      box_t b = GetBoxOpt(boxes, obj_index, s[obj_index]);
-      if (BoxIou(a, b) >= nms_threshold_) s_probs[obj_index] = 0;
-    }
+  for (size_t i = 0; i < 9; i++) {
+    out[i] = OutputData(i);
+    quant[i] = OutputQuantParams(i);
   }
-
-  free(s_int);
-  free(landmarks);
-  free(boxes);
-  free(tmp);
-  free(s_probs);
-  free(s);
+  post_->Run(out, quant);
 }
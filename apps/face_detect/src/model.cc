@@ -1,46 +1,243 @@
 #include "model.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <chrono>
-#include <fstream>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <string>
 
+#include "mpi_sys_api.h"
 #include "util.h"
 
 using namespace nncase;
 using namespace nncase::runtime;
 using namespace nncase::runtime::detail;
+using namespace nncase::runtime::k230;
+using namespace nncase::F::k230;
+
+namespace {
+
+// data cache line of the C908 cores
+const size_t kCacheLine = 64;
+
+uint64_t ElapsedUs(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+}  // namespace
+
+Model::KmodelImage::~KmodelImage() {
+  if (map_) munmap(map_, size_);
+  free(buffer_);
+}
 
-Model::Model(const char *model_name, const char *kmodel_file)
-    : model_name_(model_name) {
-  // load kmodel
-  std::ifstream ifs(kmodel_file, std::ios::binary);
-  interp_.load_model(ifs).expect("load_model failed");
+bool Model::KmodelImage::Load(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    close(fd);
+    return false;
+  }
+  size_ = static_cast<size_t>(st.st_size);
+  void *map = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map != MAP_FAILED) {
+    close(fd);
+    map_ = map;
+    data_ = static_cast<const uint8_t *>(map);
+    return true;
+  }
+
+  // One sized read; loops only if the file system returns it in pieces
+  if (posix_memalign(&buffer_, 4096, size_) != 0) {
+    buffer_ = nullptr;
+    close(fd);
+    return false;
+  }
+  size_t done = 0;
+  while (done < size_) {
+    ssize_t n = read(fd, static_cast<uint8_t *>(buffer_) + done, size_ - done);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    done += static_cast<size_t>(n);
+  }
+  close(fd);
+  if (done != size_) return false;
+  data_ = static_cast<const uint8_t *>(buffer_);
+  return true;
+}
+
+Model::Model(const char *model_name, const char *kmodel_file, size_t slots)
+    : model_name_(model_name), slots_(slots ? slots : 1) {
+  // load kmodel; the interpreter parses it in place without a copy
+  auto start = std::chrono::steady_clock::now();
+  if (!kmodel_.Load(kmodel_file)) {
+    std::cerr << model_name_ << ": cannot read " << kmodel_file << std::endl;
+    std::abort();
+  }
+  interp_
+      .load_model({reinterpret_cast<const gsl::byte *>(kmodel_.Data()),
+                   kmodel_.Size()},
+                  false)
+      .expect("load_model failed");
+  startup_.load_us = ElapsedUs(start);
+  startup_.kmodel_bytes = kmodel_.Size();
+  startup_.mapped = kmodel_.Mapped();
+  LoadOutputQuantParams(kmodel_file);
 
-  // create kpu input tensors
-  for (size_t i = 0; i < interp_.inputs_size(); i++) {
-    auto desc = interp_.input_desc(i);
-    auto shape = interp_.input_shape(i);
-    auto tensor =
-        host_runtime_tensor::create(desc.datatype, shape, hrt::pool_shared)
-            .expect("cannot create input tensor");
-    interp_.input_tensor(i, tensor).expect("cannot set input tensor");
+  // create kpu input/output tensors for every slot
+  start = std::chrono::steady_clock::now();
+  for (auto &slot : slots_) {
+    for (size_t i = 0; i < interp_.inputs_size(); i++) {
+      auto desc = interp_.input_desc(i);
+      auto shape = interp_.input_shape(i);
+      slot.inputs.push_back(
+          host_runtime_tensor::create(desc.datatype, shape, hrt::pool_shared)
+              .expect("cannot create input tensor"));
+    }
+    for (size_t i = 0; i < interp_.outputs_size(); i++) {
+      auto desc = interp_.output_desc(i);
+      auto shape = interp_.output_shape(i);
+      slot.outputs.push_back(
+          host_runtime_tensor::create(desc.datatype, shape, hrt::pool_shared)
+              .expect("cannot create output tensor"));
+    }
+    MapOutputs(slot);
   }
+  BindSlot(0);
+  startup_.tensors_us = ElapsedUs(start);
 }
 
 Model::~Model() {}
 
 void Model::Run(uintptr_t vaddr, uintptr_t paddr) {
-  Preprocess(vaddr, paddr);
+  RunPreprocess(0, vaddr, paddr);
+  RunKpu(0);
+  RunPostprocess(0);
+}
+
+void Model::Run(runtime_tensor &input, bool sync) {
+  RunPreprocess(0, input, sync);
+  RunKpu(0);
+  RunPostprocess(0);
+}
+
+std::string Model::ModelName() const { return model_name_; }
+
+void Model::PrintStartup() const {
+  printf("%s startup: load %.1f ms (%zu KiB, %s), tensors %.1f ms, "
+         "ai2d %.1f ms\n",
+         model_name_.c_str(), startup_.load_us / 1000.0,
+         startup_.kmodel_bytes / 1024, startup_.mapped ? "mmap" : "read",
+         startup_.tensors_us / 1000.0, startup_.ai2d_us / 1000.0);
+}
+
+void Model::BuildAi2dSchedule() {
+  auto start = std::chrono::steady_clock::now();
+  ai2d_builder_->build_schedule();
+  startup_.ai2d_us += ElapsedUs(start);
+}
+
+void Model::RunPreprocess(size_t slot, uintptr_t vaddr, uintptr_t paddr) {
+  auto input = WrapInput(vaddr, paddr);
+  RunPreprocess(slot, input, true);
+}
+
+void Model::RunPreprocess(size_t slot, runtime_tensor &input, bool sync) {
+  if (sync) {
+    hrt::sync(input, sync_op_t::sync_write_back, true)
+        .expect("sync write_back failed");
+  }
+  ai2d_out_tensor_ = slots_[slot].inputs[0];
+  pre_slot_ = slot;
+  Preprocess(input);
+}
+
+runtime_tensor Model::WrapInput(uintptr_t vaddr, uintptr_t paddr) const {
+  return host_runtime_tensor::create(
+             typecode_t::dt_uint8, ai2d_in_shape_,
+             {reinterpret_cast<gsl::byte *>(vaddr),
+              compute_size(ai2d_in_shape_)},
+             false, hrt::pool_shared, paddr)
+      .expect("cannot create input tensor");
+}
+
+void Model::RunKpu(size_t slot) {
+  BindSlot(slot);
   KpuRun();
+}
+
+void Model::RunPostprocess(size_t slot) {
+  post_slot_ = slot;
+  for (auto &view : slots_[slot].views) view.synced = false;
+  invalidate_us_ = 0;
   Postprocess();
+  if (StageProfiler::Get().Enabled()) {
+    StageProfiler::Get().Record(Stage::kMapOutputs, invalidate_us_);
+  }
 }
 
-std::string Model::ModelName() const { return model_name_; }
+void Model::BindSlot(size_t slot) {
+  if (slot == bound_slot_) return;
+  auto &tensors = slots_[slot];
+  for (size_t i = 0; i < tensors.inputs.size(); i++) {
+    interp_.input_tensor(i, tensors.inputs[i])
+        .expect("cannot set input tensor");
+  }
+  for (size_t i = 0; i < tensors.outputs.size(); i++) {
+    interp_.output_tensor(i, tensors.outputs[i])
+        .expect("cannot set output tensor");
+  }
+  bound_slot_ = slot;
+}
+
+void Model::LoadOutputQuantParams(const char *kmodel_file) {
+  size_t count = interp_.outputs_size();
+  std::vector<OutputType> types(count, OutputType::kFloat32);
+  bool quantized = false;
+  for (size_t i = 0; i < count; i++) {
+    auto datatype = interp_.output_desc(i).datatype;
+    if (datatype == typecode_t::dt_uint8) {
+      types[i] = OutputType::kUint8;
+    } else if (datatype == typecode_t::dt_int8) {
+      types[i] = OutputType::kInt8;
+    } else if (datatype != typecode_t::dt_float32) {
+      std::cerr << model_name_ << ": unsupported type of output " << i
+                << std::endl;
+      std::abort();
+    }
+    quantized = quantized || types[i] != OutputType::kFloat32;
+  }
+
+  output_quant_.assign(count, OutputQuant());
+  if (!quantized) return;
+
+  // int8/uint8 outputs cannot be interpreted without their scale
+  std::string path = std::string(kmodel_file) + ".quant";
+  bool ok = LoadOutputQuant(path, output_quant_) &&
+            output_quant_.size() == count;
+  for (size_t i = 0; ok && i < count; i++) {
+    ok = output_quant_[i].type == types[i];
+  }
+  if (!ok) {
+    std::cerr << model_name_ << ": quantized outputs need a matching " << path
+              << std::endl;
+    std::abort();
+  }
+  printf("%s: quantized outputs, params from %s\n", model_name_.c_str(),
+         path.c_str());
+}
 
 void Model::KpuRun() {
-#if ENABLE_PROFILING
-  ScopedTiming st(ModelName() + " " + __FUNCTION__);
-#endif
+  ScopedTiming st(Stage::kKpu);
 
   interp_.run().expect("error occurred in running model");
 }
@@ -54,7 +251,92 @@ void Model::InputTensor(size_t idx, runtime_tensor &tensor) {
 }
 
 runtime_tensor Model::OutputTensor(size_t idx) {
-  return interp_.output_tensor(idx).expect("cannot get output tensor");
+  return slots_[post_slot_].outputs[idx];
+}
+
+void Model::MapOutputs(TensorSlot &slot) {
+  for (auto &tensor : slot.outputs) {
+    auto host =
+        tensor.impl()->to_host().unwrap()->buffer().as_host().unwrap();
+    auto paddr = host.physical_address();
+    OutputView view;
+    view.map = host.map(map_access_::map_read).expect("cannot map output");
+    view.data = view.map.buffer().data();
+    view.bytes = view.map.buffer().size_bytes();
+    view.paddr = paddr.is_ok() ? paddr.unwrap() : 0;
+    view.synced = false;
+    slot.views.push_back(std::move(view));
+  }
+}
+
+void Model::InvalidateOutput(size_t idx, size_t offset, size_t bytes) {
+  const bool timed = StageProfiler::Get().Enabled();
+  auto start = timed ? std::chrono::steady_clock::now()
+                     : std::chrono::steady_clock::time_point();
+
+  auto &slot = slots_[post_slot_];
+  auto &view = slot.views[idx];
+  size_t end = offset + bytes < view.bytes ? offset + bytes : view.bytes;
+  offset &= ~(kCacheLine - 1);
+  end = (end + kCacheLine - 1) & ~(kCacheLine - 1);
+  if (end > view.bytes) end = view.bytes;
+  if (offset >= end) return;
+  if (view.paddr) {
+    // the KPU wrote the buffer behind the CPU cache; the CPU never writes
+    // it, so clean+invalidate only drops stale lines
+    if (kd_mpi_sys_mmz_flush_cache(view.paddr + offset,
+                                   static_cast<uint8_t *>(view.data) + offset,
+                                   end - offset) != K_SUCCESS) {
+      std::cerr << model_name_ << ": cannot invalidate output " << idx
+                << std::endl;
+      std::abort();
+    }
+  } else if (!view.synced) {
+    // no physical address to flush a range of; sync it whole once a frame
+    hrt::sync(slot.outputs[idx], sync_op_t::sync_invalidate, true)
+        .expect("sync invalidate failed");
+    view.synced = true;
+  }
+  if (timed) invalidate_us_ += ElapsedUs(start);
+}
+
+void Model::InvalidateOutputs() {
+  auto &views = slots_[post_slot_].views;
+  for (size_t i = 0; i < views.size(); i++) {
+    InvalidateOutput(i, 0, views[i].bytes);
+  }
+}
+
+const void *Model::OutputData(size_t idx) const {
+  return slots_[post_slot_].views[idx].data;
+}
+
+size_t Model::OutputBytes(size_t idx) const {
+  return slots_[post_slot_].views[idx].bytes;
+}
+
+std::unique_ptr<nfk::ai2d_builder> Model::MakeCropBuilder(
+    const Ai2dGeometry &g) {
+  dims_t in_shape{1, static_cast<size_t>(g.in_c), static_cast<size_t>(g.in_h),
+                  static_cast<size_t>(g.in_w)};
+  dims_t out_shape{1, static_cast<size_t>(g.out_c),
+                   static_cast<size_t>(g.out_h), static_cast<size_t>(g.out_w)};
+  ai2d_datatype_t ai2d_dtype{ai2d_format::NCHW_FMT, ai2d_format::NCHW_FMT,
+                             typecode_t::dt_uint8, typecode_t::dt_uint8};
+  ai2d_crop_param_t crop_param{true, g.crop_x, g.crop_y, g.crop_w, g.crop_h};
+  ai2d_shift_param_t shift_param{false, 0};
+  ai2d_pad_param_t pad_param{false,
+                             {{0, 0}, {0, 0}, {0, 0}, {0, 0}},
+                             ai2d_pad_mode::constant,
+                             {0, 0, 0}};
+  ai2d_resize_param_t resize_param{true, ai2d_interp_method::tf_bilinear,
+                                   ai2d_interp_mode::half_pixel};
+  ai2d_affine_param_t affine_param{false};
+  std::unique_ptr<ai2d_builder> builder(
+      new ai2d_builder(in_shape, out_shape, ai2d_dtype, crop_param,
+                       shift_param, pad_param, resize_param, affine_param));
+  builder->build_schedule();
+  return builder;
 }
 
 dims_t Model::InputShape(size_t idx) { return interp_.input_shape(idx); }
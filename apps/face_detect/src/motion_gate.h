@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+struct MotionGateConfig {
+  int cell = 16;            // frame pixels per thumbnail pixel, each way
+  int cell_threshold = 12;  // luma change of a thumbnail pixel that is motion
+  int min_changed = 2;      // moving thumbnail pixels that make a frame move
+  int max_stale = 30;       // run inference at least every N frames
+};
+
+// Decides whether a frame needs inference. Each frame is reduced to a small
+// luma thumbnail (the green plane of the planar RGB frame, 16 samples per
+// cell) and compared with the thumbnail of the last frame that was
+// inferred; while fewer than min_changed thumbnail pixels moved by more
+// than cell_threshold, the caller reuses the previous result, for at most
+// max_stale frames. Comparing against the last inferred frame rather than
+// the previous one keeps slow drifts from slipping through.
+//
+// The sampling and compare kernels use RVV when the compiler provides the
+// v1.0 intrinsics, and plain loops otherwise. Has no SDK dependency.
+// Not thread-safe.
+class MotionGate {
+ public:
+  MotionGate(int frame_w, int frame_h, const MotionGateConfig &config = {});
+
+  // `frame` is a CHW RGB frame of the constructor size. True if it should
+  // be inferred; its thumbnail then becomes the reference.
+  bool Check(const uint8_t *frame);
+
+  int LastChanged() const { return changed_; }
+  uint64_t Frames() const { return frames_; }
+  uint64_t Inferred() const { return inferred_; }
+
+ private:
+  void MakeThumbnail(const uint8_t *frame, uint8_t *thumb);
+
+  int frame_w_, frame_h_;
+  int thumb_w_, thumb_h_;
+  MotionGateConfig config_;
+  std::vector<uint8_t> current_;
+  std::vector<uint8_t> reference_;
+  std::vector<uint16_t> acc_;  // one thumbnail row of sample sums
+  bool has_reference_ = false;
+  int since_infer_ = 0;
+  int changed_ = 0;
+  uint64_t frames_ = 0;
+  uint64_t inferred_ = 0;
+};
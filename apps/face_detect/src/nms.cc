@@ -0,0 +1,145 @@
+#include "nms.h"
+
+#include <algorithm>
+#include <cmath>
+
+void Nms::Reserve(size_t n) {
+  x1_.reserve(n);
+  y1_.reserve(n);
+  x2_.reserve(n);
+  y2_.reserve(n);
+  area_.reserve(n);
+  score_.reserve(n);
+  cls_.reserve(n);
+  order_.reserve(n);
+}
+
+void Nms::Clear() {
+  x1_.clear();
+  y1_.clear();
+  x2_.clear();
+  y2_.clear();
+  area_.clear();
+  score_.clear();
+  cls_.clear();
+}
+
+int Nms::Add(float x1, float y1, float x2, float y2, float score, int cls) {
+  x1_.push_back(x1);
+  y1_.push_back(y1);
+  x2_.push_back(x2);
+  y2_.push_back(y2);
+  area_.push_back((x2 - x1) * (y2 - y1));
+  score_.push_back(score);
+  cls_.push_back(cls);
+  return static_cast<int>(score_.size()) - 1;
+}
+
+int Nms::AddCenter(float x, float y, float w, float h, float score, int cls) {
+  x1_.push_back(x - w / 2);
+  y1_.push_back(y - h / 2);
+  x2_.push_back(x + w / 2);
+  y2_.push_back(y + h / 2);
+  area_.push_back(w * h);
+  score_.push_back(score);
+  cls_.push_back(cls);
+  return static_cast<int>(score_.size()) - 1;
+}
+
+void Nms::Run(const NmsConfig &config, std::vector<int> &keep) {
+  keep.clear();
+  if (score_.empty()) return;
+
+  SelectOrder(config.top_k);
+  if (config.mode == NmsMode::kHard) {
+    RunHard(config, keep);
+  } else {
+    RunSoft(config, keep);
+  }
+}
+
+void Nms::SelectOrder(size_t top_k) {
+  size_t n = score_.size();
+  order_.resize(n);
+  for (size_t i = 0; i < n; i++) {
+    order_[i] = static_cast<int>(i);
+  }
+
+  // Ties break on insertion order so results do not depend on the sort.
+  auto by_score = [this](int a, int b) {
+    return score_[a] > score_[b] || (score_[a] == score_[b] && a < b);
+  };
+  if (top_k > 0 && top_k < n) {
+    std::partial_sort(order_.begin(), order_.begin() + top_k, order_.end(),
+                      by_score);
+    order_.resize(top_k);
+  } else {
+    std::sort(order_.begin(), order_.end(), by_score);
+  }
+}
+
+float Nms::Iou(int a, int b) const {
+  float w = std::min(x2_[a], x2_[b]) - std::max(x1_[a], x1_[b]);
+  float h = std::min(y2_[a], y2_[b]) - std::max(y1_[a], y1_[b]);
+  if (w < 0 || h < 0) return 0;
+  float inter = w * h;
+  return inter / (area_[a] + area_[b] - inter);
+}
+
+void Nms::RunHard(const NmsConfig &config, std::vector<int> &keep) {
+  // order_ holds the live candidates; each kept box compacts away the ones
+  // it suppresses so later passes only scan survivors.
+  size_t n = order_.size();
+  for (size_t i = 0; i < n; i++) {
+    int a = order_[i];
+    keep.push_back(a);
+    if (config.max_output && keep.size() >= config.max_output) break;
+
+    float ax1 = x1_[a], ay1 = y1_[a], ax2 = x2_[a], ay2 = y2_[a];
+    float aarea = area_[a];
+    size_t live = i + 1;
+    for (size_t j = i + 1; j < n; j++) {
+      int b = order_[j];
+      bool suppress = false;
+      if (!config.class_aware || cls_[a] == cls_[b]) {
+        float w = std::min(ax2, x2_[b]) - std::max(ax1, x1_[b]);
+        float h = std::min(ay2, y2_[b]) - std::max(ay1, y1_[b]);
+        if (w >= 0 && h >= 0) {
+          float inter = w * h;
+          suppress = inter / (aarea + area_[b] - inter) >= config.iou_threshold;
+        }
+      }
+      order_[live] = b;
+      live += !suppress;
+    }
+    n = live;
+  }
+}
+
+void Nms::RunSoft(const NmsConfig &config, std::vector<int> &keep) {
+  size_t n = order_.size();
+  for (size_t i = 0; i < n; i++) {
+    // Decay can reorder the remaining boxes, so pick the current best.
+    size_t best = i;
+    for (size_t j = i + 1; j < n; j++) {
+      if (score_[order_[j]] > score_[order_[best]]) best = j;
+    }
+    std::swap(order_[i], order_[best]);
+
+    int a = order_[i];
+    if (score_[a] < config.score_threshold) break;
+    keep.push_back(a);
+    if (config.max_output && keep.size() >= config.max_output) break;
+
+    for (size_t j = i + 1; j < n; j++) {
+      int b = order_[j];
+      if (config.class_aware && cls_[a] != cls_[b]) continue;
+      float iou = Iou(a, b);
+      if (config.mode == NmsMode::kSoftLinear) {
+        if (iou >= config.iou_threshold) score_[b] *= 1.0f - iou;
+      } else {
+        score_[b] *= std::exp(-iou * iou / config.sigma);
+      }
+    }
+  }
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <vector>
+
+enum class NmsMode {
+  kHard,          // drop boxes with IoU >= iou_threshold
+  kSoftLinear,    // score *= (1 - IoU) when IoU >= iou_threshold
+  kSoftGaussian,  // score *= exp(-IoU^2 / sigma)
+};
+
+struct NmsConfig {
+  NmsMode mode = NmsMode::kHard;
+  float iou_threshold = 0.5f;
+  float score_threshold = 0.0f;  // soft modes drop boxes decayed below this
+  float sigma = 0.5f;            // kSoftGaussian only
+  bool class_aware = false;      // only suppress boxes of the same class
+  size_t top_k = 0;              // consider the best K candidates (0 = all)
+  size_t max_output = 0;         // stop after this many boxes (0 = all)
+};
+
+// Non-maximum suppression over candidates stored as structure-of-arrays.
+//
+// Boxes are decoded once by the caller and stored in corner form; areas are
+// computed on insertion so the inner IoU loop is a handful of min/max ops.
+// All state lives in the instance, so one Nms per thread is safe. Buffers
+// are kept between runs; after Reserve() no call allocates unless the
+// candidate count grows.
+class Nms {
+ public:
+  void Reserve(size_t n);
+  void Clear();
+  // Returns the candidate index passed back by Run().
+  int Add(float x1, float y1, float x2, float y2, float score, int cls = 0);
+  // Center form; the area is w * h, matching box_t based IoU exactly.
+  int AddCenter(float x, float y, float w, float h, float score, int cls = 0);
+
+  // Writes surviving candidate indices to `keep`, highest score first.
+  // In soft modes Score() returns the decayed score afterwards.
+  void Run(const NmsConfig &config, std::vector<int> &keep);
+
+  size_t Size() const { return score_.size(); }
+  float Score(int idx) const { return score_[idx]; }
+
+ private:
+  void SelectOrder(size_t top_k);
+  void RunHard(const NmsConfig &config, std::vector<int> &keep);
+  void RunSoft(const NmsConfig &config, std::vector<int> &keep);
+  float Iou(int a, int b) const;
+
+  std::vector<float> x1_, y1_, x2_, y2_, area_, score_;
+  std::vector<int> cls_;
+  std::vector<int> order_;
+};
@@ -0,0 +1,241 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Blocking FIFO with a fixed capacity. Push blocks while full, Pop blocks
+// while empty. After Close, Push fails and Pop drains what is left.
+template <class T>
+class BoundedQueue {
+ public:
+  explicit BoundedQueue(size_t capacity) : capacity_(capacity ? capacity : 1) {}
+
+  bool Push(T item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock, [&] { return closed_ || items_.size() < capacity_; });
+    if (closed_) return false;
+    items_.push_back(std::move(item));
+    not_empty_.notify_one();
+    return true;
+  }
+
+  bool Pop(T &item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [&] { return closed_ || !items_.empty(); });
+    if (items_.empty()) return false;
+    item = std::move(items_.front());
+    items_.pop_front();
+    not_full_.notify_one();
+    return true;
+  }
+
+  void Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    not_full_.notify_all();
+    not_empty_.notify_all();
+  }
+
+  size_t Size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return items_.size();
+  }
+
+  size_t Capacity() const { return capacity_; }
+
+ private:
+  const size_t capacity_;
+  mutable std::mutex mutex_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+  std::deque<T> items_;
+  bool closed_ = false;
+};
+
+struct StageStats {
+  std::string name;
+  uint64_t frames = 0;
+  uint64_t busy_us = 0;      // time spent inside the stage function
+  uint64_t starved_us = 0;   // time waiting for input
+  uint64_t blocked_us = 0;   // time waiting for room downstream
+  uint64_t queue_sum = 0;    // input queue depth sampled at each pop
+  size_t queue_max = 0;
+};
+
+// Linear chain of stages, one thread per stage, connected by bounded queues.
+//
+// The first stage is the source: it fills an item and returns false at end of
+// stream. Every later stage transforms the item in place. The pipeline owns
+// `depth` items and hands them back to the source once the last stage is done
+// with them, so at most `depth` items are in flight, which bounds the number
+// of VICAP buffers held by the pipeline. Items are reused rather than
+// rebuilt, so their vectors keep their capacity; the source must reset every
+// field a later stage reads.
+//
+// depth == 0 runs all stages back-to-back on the calling thread with a single
+// item, which is the plain serial loop with the same stage functions.
+template <class T>
+class Pipeline {
+ public:
+  using SourceFn = std::function<bool(T &)>;
+  using StageFn = std::function<void(T &)>;
+
+  explicit Pipeline(size_t depth) : depth_(depth) {}
+
+  void SetSource(const std::string &name, SourceFn fn) {
+    source_ = std::move(fn);
+    AddStats(name);
+  }
+
+  void AddStage(const std::string &name, StageFn fn) {
+    stages_.push_back(std::move(fn));
+    AddStats(name);
+  }
+
+  // Blocks until the source reports end of stream and every stage drained.
+  void Run() {
+    if (depth_ == 0) {
+      RunSerial();
+    } else {
+      RunThreaded();
+    }
+  }
+
+  size_t Depth() const { return depth_; }
+
+  // Snapshot of per-stage counters. Safe to call while running.
+  std::vector<StageStats> Stats() const {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    return stats_;
+  }
+
+  void PrintStats() const {
+    auto stats = Stats();
+    printf("%-12s %8s %10s %10s %10s %8s %6s\n", "stage", "frames",
+           "busy_ms", "starve_ms", "block_ms", "avg_q", "max_q");
+    for (const auto &s : stats) {
+      double avg_busy = s.frames ? s.busy_us / 1000.0 / s.frames : 0.0;
+      double avg_starved = s.frames ? s.starved_us / 1000.0 / s.frames : 0.0;
+      double avg_blocked = s.frames ? s.blocked_us / 1000.0 / s.frames : 0.0;
+      double avg_q = s.frames ? static_cast<double>(s.queue_sum) / s.frames
+                              : 0.0;
+      printf("%-12s %8llu %10.2f %10.2f %10.2f %8.2f %6zu\n", s.name.c_str(),
+             static_cast<unsigned long long>(s.frames), avg_busy, avg_starved,
+             avg_blocked, avg_q, s.queue_max);
+    }
+  }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  static uint64_t ElapsedUs(Clock::time_point from, Clock::time_point to) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(to - from)
+        .count();
+  }
+
+  void AddStats(const std::string &name) {
+    StageStats s;
+    s.name = name;
+    stats_.push_back(s);
+  }
+
+  void Account(size_t idx, uint64_t busy, uint64_t starved, uint64_t blocked,
+               size_t queue) {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    auto &s = stats_[idx];
+    s.frames++;
+    s.busy_us += busy;
+    s.starved_us += starved;
+    s.blocked_us += blocked;
+    s.queue_sum += queue;
+    if (queue > s.queue_max) s.queue_max = queue;
+  }
+
+  void RunSerial() {
+    T item{};
+    for (;;) {
+      auto t0 = Clock::now();
+      if (!source_(item)) break;
+      auto t1 = Clock::now();
+      Account(0, ElapsedUs(t0, t1), 0, 0, 0);
+      for (size_t i = 0; i < stages_.size(); i++) {
+        t0 = Clock::now();
+        stages_[i](item);
+        t1 = Clock::now();
+        Account(i + 1, ElapsedUs(t0, t1), 0, 0, 0);
+      }
+    }
+  }
+
+  void RunThreaded() {
+    // The items circulate between a free list and the stage queues, so the
+    // source blocks once all `depth` of them are in flight.
+    std::vector<T> pool(depth_);
+    BoundedQueue<T *> free_items(depth_);
+    for (auto &item : pool) free_items.Push(&item);
+
+    std::vector<std::unique_ptr<BoundedQueue<T *>>> queues;
+    for (size_t i = 0; i < stages_.size(); i++) {
+      queues.emplace_back(new BoundedQueue<T *>(depth_));
+    }
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < stages_.size(); i++) {
+      threads.emplace_back([this, i, &queues, &free_items] {
+        BoundedQueue<T *> &in = *queues[i];
+        BoundedQueue<T *> &out =
+            i + 1 < queues.size() ? *queues[i + 1] : free_items;
+        for (;;) {
+          T *item = nullptr;
+          auto t0 = Clock::now();
+          size_t queued = in.Size();
+          if (!in.Pop(item)) break;
+          auto t1 = Clock::now();
+          stages_[i](*item);
+          auto t2 = Clock::now();
+          out.Push(item);
+          auto t3 = Clock::now();
+          Account(i + 1, ElapsedUs(t1, t2), ElapsedUs(t0, t1),
+                  ElapsedUs(t2, t3), queued);
+        }
+        if (i + 1 < queues.size()) queues[i + 1]->Close();
+      });
+    }
+
+    BoundedQueue<T *> &first = queues.empty() ? free_items : *queues[0];
+    for (;;) {
+      T *item = nullptr;
+      auto t0 = Clock::now();
+      free_items.Pop(item);
+      auto t1 = Clock::now();
+      if (!source_(*item)) break;
+      auto t2 = Clock::now();
+      first.Push(item);
+      auto t3 = Clock::now();
+      Account(0, ElapsedUs(t1, t2), 0, ElapsedUs(t0, t1) + ElapsedUs(t2, t3),
+              0);
+    }
+    if (!queues.empty()) queues[0]->Close();
+
+    for (auto &t : threads) t.join();
+  }
+
+  const size_t depth_;
+  SourceFn source_;
+  std::vector<StageFn> stages_;
+
+  mutable std::mutex stats_mutex_;
+  std::vector<StageStats> stats_;
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+// Element type of a kmodel output as the CPU reads it.
+enum class OutputType { kFloat32, kUint8, kInt8 };
+
+// Affine quantization of one output: real = scale * (q - zero_point).
+// Float outputs keep the identity mapping.
+struct OutputQuant {
+  OutputType type = OutputType::kFloat32;
+  float scale = 1.0f;
+  int zero_point = 0;
+};
+
+inline float Dequantize(int q, const OutputQuant &quant) {
+  return quant.scale * static_cast<float>(q - quant.zero_point);
+}
+
+// The nncase runtime's output descriptors carry only the data type, so
+// step3 --quant-outputs writes the scale and zero point next to the kmodel
+// as <kmodel>.quant, one "<index> <float32|uint8|int8> <scale> <zero_point>"
+// line per output. Returns false if the file is missing or malformed.
+inline bool LoadOutputQuant(const std::string &path,
+                            std::vector<OutputQuant> &quant) {
+  FILE *fp = fopen(path.c_str(), "r");
+  if (!fp) return false;
+  quant.clear();
+  bool ok = true;
+  int idx, zero_point;
+  char type[16];
+  float scale;
+  while (ok && fscanf(fp, "%d %15s %f %d", &idx, type, &scale,
+                      &zero_point) == 4) {
+    OutputQuant q;
+    std::string name = type;
+    if (name == "uint8") {
+      q.type = OutputType::kUint8;
+    } else if (name == "int8") {
+      q.type = OutputType::kInt8;
+    } else if (name != "float32") {
+      ok = false;
+    }
+    q.scale = scale;
+    q.zero_point = zero_point;
+    ok = ok && idx == static_cast<int>(quant.size()) && scale > 0;
+    quant.push_back(q);
+  }
+  ok = ok && feof(fp);
+  fclose(fp);
+  return ok && !quant.empty();
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <array>
+#include <vector>
+
+// One RetinaFace prior with the box variances folded in:
+//   x = cx + loc_x * vw    w = w * exp(loc_w * 0.2)
+struct RetinafaceAnchor {
+  float cx, cy;  // center, normalized to the input size
+  float vw, vh;  // 0.1 * w, 0.1 * h (center/landmark variance)
+  float w, h;    // prior size, normalized to the input size
+};
+
+// mobilenet0.25 RetinaFace prior configuration.
+struct RetinafacePriors {
+  static constexpr int kStrides = 3;
+  static constexpr int kAnchorsPerCell = 2;
+  static constexpr int kSteps[kStrides] = {8, 16, 32};
+  static constexpr int kMinSizes[kStrides][kAnchorsPerCell] = {
+      {16, 32}, {64, 128}, {256, 512}};
+};
+
+constexpr int RetinafaceAnchorCount(int height, int width) {
+  int count = 0;
+  for (int k = 0; k < RetinafacePriors::kStrides; k++) {
+    int step = RetinafacePriors::kSteps[k];
+    count += ((height + step - 1) / step) * ((width + step - 1) / step) *
+             RetinafacePriors::kAnchorsPerCell;
+  }
+  return count;
+}
+
+// Writes the priors for a height x width input in decoder order: strides
+// from fine to coarse, cells row-major, then anchors of the cell.
+constexpr void GenerateRetinafaceAnchors(int height, int width,
+                                         RetinafaceAnchor *out) {
+  int n = 0;
+  for (int k = 0; k < RetinafacePriors::kStrides; k++) {
+    int step = RetinafacePriors::kSteps[k];
+    int rows = (height + step - 1) / step;
+    int cols = (width + step - 1) / step;
+    for (int i = 0; i < rows; i++) {
+      for (int j = 0; j < cols; j++) {
+        for (int a = 0; a < RetinafacePriors::kAnchorsPerCell; a++) {
+          float min_size = RetinafacePriors::kMinSizes[k][a];
+          float w = min_size / width;
+          float h = min_size / height;
+          out[n++] = {(j + 0.5f) * step / width,
+                      (i + 0.5f) * step / height,
+                      w * 0.1f,
+                      h * 0.1f,
+                      w,
+                      h};
+        }
+      }
+    }
+  }
+}
+
+template <int H, int W>
+constexpr std::array<RetinafaceAnchor, RetinafaceAnchorCount(H, W)>
+MakeRetinafaceAnchors() {
+  std::array<RetinafaceAnchor, RetinafaceAnchorCount(H, W)> anchors{};
+  GenerateRetinafaceAnchors(H, W, anchors.data());
+  return anchors;
+}
+
+// Returns the prior table for the input size. 256, 320 and 640 square
+// inputs come from tables built at compile time; other sizes are generated
+// into `storage`.
+const RetinafaceAnchor *RetinafaceAnchors(
+    int height, int width, std::vector<RetinafaceAnchor> &storage);
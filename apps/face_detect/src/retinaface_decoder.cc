@@ -0,0 +1,374 @@
+#include "retinaface_decoder.h"
+
+#include <math.h>
+#include <stdint.h>
+
+#if defined(K230_BIGCORE)
+#include "rvv_math.h"
+#endif
+
+#if defined(K230_BIGCORE) && defined(__riscv_v_intrinsic) && \
+    __riscv_v_intrinsic >= 12000
+#include <riscv_vector.h>
+#define GATHER_RVV 1
+#endif
+
+// Softmax chunk; a multiple of the RVV register length so chunking does
+// not change how softmax_2group_vec splits its vectors.
+#define GATHER_CHUNK 256
+
+// Worst-case softmax error of a face score, as a probability. The logit
+// guard band is this error mapped through dp/dlogit = p (1 - p).
+#define SCORE_EPSILON 1e-4f
+
+RetinafaceThreshold RetinafaceMakeThreshold(float prob) {
+  RetinafaceThreshold t;
+  t.prob = prob;
+  t.logit = logf(prob / (1.0f - prob));
+  t.logit_min = t.logit - SCORE_EPSILON / (prob * (1.0f - prob));
+  return t;
+}
+
+size_t RetinafaceGatherScratch() {
+  // kSoftmax: bg/face scores of a chunk. kLogit: bg/face logits of the
+  // survivors of a chunk and their softmax output.
+  return GATHER_CHUNK * RETINAFACE_ANCHORS * 4;
+}
+
+void RetinafaceSoftmax2(int n, const float *a, const float *b, float *out_a,
+                        float *out_b) {
+#if defined(K230_BIGCORE)
+  softmax_2group_vec(n, const_cast<float *>(a), const_cast<float *>(b), out_a,
+                     out_b);
+#else
+  for (int i = 0; i < n; i++) {
+    float m = a[i] > b[i] ? a[i] : b[i];
+    float ea = expf(a[i] - m);
+    float eb = expf(b[i] - m);
+    float sum = ea + eb;
+    out_a[i] = ea / sum;
+    out_b[i] = eb / sum;
+  }
+#endif
+}
+
+// idx[] = every k < n with face[k] - bg[k] >= limit, ascending; returns the
+// count. bg == nullptr tests face[k] >= limit. Subtract and compare are
+// exact in both paths, so they select the same k.
+static int SelectAtLeast(const float *bg, const float *face, int n,
+                         float limit, int *idx) {
+  int count = 0;
+#if defined(GATHER_RVV)
+  for (int i = 0; i < n;) {
+    size_t vl = __riscv_vsetvl_e32m4(n - i);
+    vfloat32m4_t v = __riscv_vle32_v_f32m4(face + i, vl);
+    if (bg) {
+      v = __riscv_vfsub_vv_f32m4(v, __riscv_vle32_v_f32m4(bg + i, vl), vl);
+    }
+    vbool8_t pass = __riscv_vmfge_vf_f32m4_b8(v, limit, vl);
+    vuint32m4_t k = __riscv_vadd_vx_u32m4(__riscv_vid_v_u32m4(vl),
+                                          static_cast<uint32_t>(i), vl);
+    size_t m = __riscv_vcpop_m_b8(pass, vl);
+    __riscv_vse32_v_u32m4(reinterpret_cast<uint32_t *>(idx + count),
+                          __riscv_vcompress_vm_u32m4(k, pass, vl), m);
+    count += static_cast<int>(m);
+    i += static_cast<int>(vl);
+  }
+#else
+  for (int k = 0; k < n; k++) {
+    float v = bg ? face[k] - bg[k] : face[k];
+    if (v >= limit) idx[count++] = k;
+  }
+#endif
+  return count;
+}
+
+// Merges the selected cells of anchor 0 and anchor 1 into anchor order,
+// writing the local anchor index k * RETINAFACE_ANCHORS + hh of each.
+static int MergeAnchors(const int *sel0, int m0, const int *sel1, int m1,
+                        int *local) {
+  int i = 0, j = 0, m = 0;
+  while (i < m0 || j < m1) {
+    if (j == m1 || (i < m0 && sel0[i] <= sel1[j])) {
+      local[m++] = sel0[i++] * RETINAFACE_ANCHORS;
+    } else {
+      local[m++] = sel1[j++] * RETINAFACE_ANCHORS + 1;
+    }
+  }
+  return m;
+}
+
+// Calls copy(head, ww, hh, i) for every candidate i, with the stride
+// holding its anchor and the cell and anchor within that stride.
+template <class Head, class Copy>
+static void ForEachCandidate(const Head *heads, int num_heads,
+                             const RetinafaceCandidates &cands, Copy copy) {
+  int h = 0, anchor_base = 0;
+  for (int i = 0; i < cands.count; i++) {
+    int local = cands.anchor[i] - anchor_base;
+    while (h < num_heads && local >= heads[h].size * RETINAFACE_ANCHORS) {
+      local -= heads[h].size * RETINAFACE_ANCHORS;
+      anchor_base += heads[h].size * RETINAFACE_ANCHORS;
+      h++;
+    }
+    copy(heads[h], local / RETINAFACE_ANCHORS, local % RETINAFACE_ANCHORS, i);
+  }
+}
+
+static void CopyCandidate(const RetinafaceHead &head, int ww, int hh,
+                          int count, RetinafaceCandidates *out) {
+  const int size = head.size;
+  float *loc = out->loc + count * RETINAFACE_LOC_SIZE;
+  for (int cc = 0; cc < RETINAFACE_LOC_SIZE; cc++) {
+    loc[cc] = head.loc[(hh * RETINAFACE_LOC_SIZE + cc) * size + ww];
+  }
+  float *landms = out->landms + count * RETINAFACE_LAND_SIZE;
+  for (int cc = 0; cc < RETINAFACE_LAND_SIZE; cc++) {
+    landms[cc] = head.landms[(hh * RETINAFACE_LAND_SIZE + cc) * size + ww];
+  }
+}
+
+void RetinafaceFetch(const RetinafaceHead *heads, int num_heads,
+                     RetinafaceCandidates *out) {
+  ForEachCandidate(heads, num_heads, *out,
+                   [out](const RetinafaceHead &head, int ww, int hh, int i) {
+                     CopyCandidate(head, ww, hh, i, out);
+                   });
+}
+
+static void SelectHead(const RetinafaceHead &head, int anchor_base,
+                       float threshold, float *scratch,
+                       RetinafaceCandidates *out) {
+  const int size = head.size;
+  const float *conf = head.conf;
+  int count = out->count;
+
+  int sel[RETINAFACE_ANCHORS * GATHER_CHUNK];
+  int local[RETINAFACE_ANCHORS * GATHER_CHUNK];
+  for (int start = 0; start < size; start += GATHER_CHUNK) {
+    int n = size - start < GATHER_CHUNK ? size - start : GATHER_CHUNK;
+    float *p0 = scratch;          // per anchor: bg, face
+    float *p1 = scratch + 2 * n;
+    RetinafaceSoftmax2(n, conf + start, conf + size + start, p0, p0 + n);
+    RetinafaceSoftmax2(n, conf + 2 * size + start, conf + 3 * size + start,
+                       p1, p1 + n);
+
+    int m0 = SelectAtLeast(nullptr, p0 + n, n, threshold, sel);
+    int m1 = SelectAtLeast(nullptr, p1 + n, n, threshold, sel + m0);
+    int m = MergeAnchors(sel, m0, sel + m0, m1, local);
+    for (int i = 0; i < m; i++) {
+      const int ww = local[i] / RETINAFACE_ANCHORS;
+      const int hh = local[i] % RETINAFACE_ANCHORS;
+      out->anchor[count] = anchor_base + start * RETINAFACE_ANCHORS + local[i];
+      out->prob[count++] = (hh == 0 ? p0 : p1)[n + ww];
+    }
+  }
+  out->count = count;
+}
+
+static void SelectHeadLogit(const RetinafaceHead &head, int anchor_base,
+                            const RetinafaceThreshold &threshold,
+                            float *scratch, RetinafaceCandidates *out) {
+  const int size = head.size;
+  const float *conf = head.conf;
+  int count = out->count;
+
+  int sel[RETINAFACE_ANCHORS * GATHER_CHUNK];
+  for (int start = 0; start < size; start += GATHER_CHUNK) {
+    int n = size - start < GATHER_CHUNK ? size - start : GATHER_CHUNK;
+    // Cells whose face minus bg logit can pass, per anchor, then merged
+    // into anchor order. The local index of each survivor is parked in
+    // out->anchor until the softmax below confirms it.
+    int m0 = SelectAtLeast(conf + start, conf + size + start, n,
+                           threshold.logit_min, sel);
+    int m1 = SelectAtLeast(conf + 2 * size + start, conf + 3 * size + start,
+                           n, threshold.logit_min, sel + m0);
+    int m = MergeAnchors(sel, m0, sel + m0, m1, out->anchor + count);
+    if (m == 0) continue;
+
+    float *bg = scratch;
+    float *face = bg + 2 * n;
+    for (int i = 0; i < m; i++) {
+      int local = out->anchor[count + i];
+      const float *pair = conf +
+                          2 * (local % RETINAFACE_ANCHORS) * size + start +
+                          local / RETINAFACE_ANCHORS;
+      bg[i] = pair[0];
+      face[i] = pair[size];
+    }
+
+    // Scores of the survivors are computed exactly as the softmax path does
+    float *p_bg = face + 2 * n;
+    float *p_face = p_bg + 2 * n;
+    RetinafaceSoftmax2(m, bg, face, p_bg, p_face);
+    const int parked = count;
+    for (int i = 0; i < m; i++) {
+      if (p_face[i] < threshold.prob) continue;
+      out->anchor[count] = anchor_base + start * RETINAFACE_ANCHORS +
+                           out->anchor[parked + i];
+      out->prob[count++] = p_face[i];
+    }
+  }
+  out->count = count;
+}
+
+void RetinafaceGather(const RetinafaceHead *heads, int num_heads,
+                      float threshold, float *scratch,
+                      RetinafaceCandidates *out) {
+  out->count = 0;
+  int anchor_base = 0;
+  for (int i = 0; i < num_heads; i++) {
+    SelectHead(heads[i], anchor_base, threshold, scratch, out);
+    anchor_base += heads[i].size * RETINAFACE_ANCHORS;
+  }
+  RetinafaceFetch(heads, num_heads, out);
+}
+
+template <class T>
+static void CopyCandidateQuant(const RetinafaceQuantHead<T> &head, int ww,
+                               int hh, int count, RetinafaceCandidates *out) {
+  const int size = head.size;
+  float *loc = out->loc + count * RETINAFACE_LOC_SIZE;
+  for (int cc = 0; cc < RETINAFACE_LOC_SIZE; cc++) {
+    loc[cc] = Dequantize(head.loc[(hh * RETINAFACE_LOC_SIZE + cc) * size + ww],
+                         head.loc_quant);
+  }
+  float *landms = out->landms + count * RETINAFACE_LAND_SIZE;
+  for (int cc = 0; cc < RETINAFACE_LAND_SIZE; cc++) {
+    landms[cc] = Dequantize(
+        head.landms[(hh * RETINAFACE_LAND_SIZE + cc) * size + ww],
+        head.landms_quant);
+  }
+}
+
+template <class T>
+void RetinafaceFetchQuant(const RetinafaceQuantHead<T> *heads, int num_heads,
+                          RetinafaceCandidates *out) {
+  ForEachCandidate(
+      heads, num_heads, *out,
+      [out](const RetinafaceQuantHead<T> &head, int ww, int hh, int i) {
+        CopyCandidateQuant(head, ww, hh, i, out);
+      });
+}
+
+template <class T>
+static void SelectHeadQuant(const RetinafaceQuantHead<T> &head,
+                            int anchor_base,
+                            const RetinafaceThreshold &threshold,
+                            float *scratch, RetinafaceCandidates *out) {
+  const int size = head.size;
+  const T *conf = head.conf;
+  const OutputQuant &cq = head.conf_quant;
+  int count = out->count;
+
+  // Smallest quantized difference that can pass. Rounding down keeps every
+  // anchor the float path could accept; the softmax below settles the rest.
+  float limit = floorf(threshold.logit_min / cq.scale);
+  limit = limit < -512.0f ? -512.0f : (limit > 512.0f ? 512.0f : limit);
+  const int dmin = static_cast<int>(limit);
+
+  int16_t d[RETINAFACE_ANCHORS * GATHER_CHUNK];
+  for (int start = 0; start < size; start += GATHER_CHUNK) {
+    int n = size - start < GATHER_CHUNK ? size - start : GATHER_CHUNK;
+    int16_t *d0 = d;
+    int16_t *d1 = d + n;
+    for (int k = 0; k < n; k++) {
+      d0[k] = static_cast<int16_t>(conf[size + start + k] - conf[start + k]);
+      d1[k] = static_cast<int16_t>(conf[3 * size + start + k] -
+                                   conf[2 * size + start + k]);
+    }
+
+    float *bg = scratch;
+    float *face = bg + 2 * n;
+    int m = 0;
+    for (int k = 0; k < n; k++) {
+      for (int hh = 0; hh < RETINAFACE_ANCHORS; hh++) {
+        if ((hh == 0 ? d0 : d1)[k] < dmin) continue;
+        const T *pair = conf + 2 * hh * size + start + k;
+        bg[m] = Dequantize(pair[0], cq);
+        face[m] = Dequantize(pair[size], cq);
+        out->anchor[count + m] = (start + k) * RETINAFACE_ANCHORS + hh;
+        m++;
+      }
+    }
+    if (m == 0) continue;
+
+    float *p_bg = face + 2 * n;
+    float *p_face = p_bg + 2 * n;
+    RetinafaceSoftmax2(m, bg, face, p_bg, p_face);
+    const int parked = count;
+    for (int i = 0; i < m; i++) {
+      if (p_face[i] < threshold.prob) continue;
+      out->anchor[count] = anchor_base + out->anchor[parked + i];
+      out->prob[count++] = p_face[i];
+    }
+  }
+  out->count = count;
+}
+
+template <class T>
+void RetinafaceSelectQuant(const RetinafaceQuantHead<T> *heads, int num_heads,
+                           const RetinafaceThreshold &threshold,
+                           float *scratch, RetinafaceCandidates *out) {
+  out->count = 0;
+  int anchor_base = 0;
+  for (int i = 0; i < num_heads; i++) {
+    SelectHeadQuant(heads[i], anchor_base, threshold, scratch, out);
+    anchor_base += heads[i].size * RETINAFACE_ANCHORS;
+  }
+}
+
+template <class T>
+void RetinafaceGatherQuant(const RetinafaceQuantHead<T> *heads, int num_heads,
+                           const RetinafaceThreshold &threshold,
+                           float *scratch, RetinafaceCandidates *out) {
+  RetinafaceSelectQuant(heads, num_heads, threshold, scratch, out);
+  RetinafaceFetchQuant(heads, num_heads, out);
+}
+
+template void RetinafaceSelectQuant<uint8_t>(
+    const RetinafaceQuantHead<uint8_t> *heads, int num_heads,
+    const RetinafaceThreshold &threshold, float *scratch,
+    RetinafaceCandidates *out);
+template void RetinafaceSelectQuant<int8_t>(
+    const RetinafaceQuantHead<int8_t> *heads, int num_heads,
+    const RetinafaceThreshold &threshold, float *scratch,
+    RetinafaceCandidates *out);
+template void RetinafaceFetchQuant<uint8_t>(
+    const RetinafaceQuantHead<uint8_t> *heads, int num_heads,
+    RetinafaceCandidates *out);
+template void RetinafaceFetchQuant<int8_t>(
+    const RetinafaceQuantHead<int8_t> *heads, int num_heads,
+    RetinafaceCandidates *out);
+template void RetinafaceGatherQuant<uint8_t>(
+    const RetinafaceQuantHead<uint8_t> *heads, int num_heads,
+    const RetinafaceThreshold &threshold, float *scratch,
+    RetinafaceCandidates *out);
+template void RetinafaceGatherQuant<int8_t>(
+    const RetinafaceQuantHead<int8_t> *heads, int num_heads,
+    const RetinafaceThreshold &threshold, float *scratch,
+    RetinafaceCandidates *out);
+
+void RetinafaceSelect(const RetinafaceHead *heads, int num_heads,
+                      const RetinafaceThreshold &threshold,
+                      RetinafaceScoreMode mode, float *scratch,
+                      RetinafaceCandidates *out) {
+  out->count = 0;
+  int anchor_base = 0;
+  for (int i = 0; i < num_heads; i++) {
+    if (mode == RetinafaceScoreMode::kSoftmax) {
+      SelectHead(heads[i], anchor_base, threshold.prob, scratch, out);
+    } else {
+      SelectHeadLogit(heads[i], anchor_base, threshold, scratch, out);
+    }
+    anchor_base += heads[i].size * RETINAFACE_ANCHORS;
+  }
+}
+
+void RetinafaceGather(const RetinafaceHead *heads, int num_heads,
+                      const RetinafaceThreshold &threshold,
+                      RetinafaceScoreMode mode, float *scratch,
+                      RetinafaceCandidates *out) {
+  RetinafaceSelect(heads, num_heads, threshold, mode, scratch, out);
+  RetinafaceFetch(heads, num_heads, out);
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "quant_params.h"
+
+#define RETINAFACE_LOC_SIZE 4
+#define RETINAFACE_CONF_SIZE 2
+#define RETINAFACE_LAND_SIZE 10
+#define RETINAFACE_ANCHORS 2  // anchors per feature map cell
+
+// One stride of the RetinaFace heads in the kmodel's NCHW layout:
+// loc [1, 8, H, W], conf [1, 4, H, W], landms [1, 20, H, W].
+struct RetinafaceHead {
+  const float *loc;
+  const float *conf;
+  const float *landms;
+  int size;  // H * W
+};
+
+// Candidates whose face score passed the threshold, in anchor order.
+// Buffers are owned by the caller and sized for every anchor.
+struct RetinafaceCandidates {
+  int *anchor;    // global anchor index
+  float *prob;    // face score
+  float *loc;     // RETINAFACE_LOC_SIZE raw values per candidate
+  float *landms;  // RETINAFACE_LAND_SIZE raw values per candidate
+  int count;
+};
+
+// How RetinafaceGather scores anchors before thresholding.
+enum class RetinafaceScoreMode {
+  kSoftmax,  // softmax over every anchor, then compare probabilities
+  kLogit,    // compare logit differences, softmax only the survivors
+};
+
+// Face score threshold in both domains. For the two-class head
+// p(face) >= prob is the same as (l_face - l_bg) >= logit, so kLogit can
+// reject almost every anchor with a subtract and a compare. Anchors within
+// a guard band below `logit` are still settled by their softmax score, so
+// exp rounding cannot make the two modes pick different candidates.
+struct RetinafaceThreshold {
+  float prob;
+  float logit;      // log(prob / (1 - prob))
+  float logit_min;  // logit minus the guard band; below it, always rejected
+};
+
+RetinafaceThreshold RetinafaceMakeThreshold(float prob);
+
+// Scratch floats needed by RetinafaceGather in either mode.
+size_t RetinafaceGatherScratch();
+
+// Scores and thresholds the conf head of every stride in a single sweep,
+// then gathers loc/landms of the candidates, instead of one pass per head
+// plus an index merge. Scores are computed in chunks with softmax_2group_vec
+// on the K230 and with a scalar softmax elsewhere; the threshold test and
+// compaction of each chunk use RVV on the K230 with a scalar fallback.
+// decode_bench checks the result against the three-pass decoder, on the
+// host for the scalar path and on the board for the RVV path.
+void RetinafaceGather(const RetinafaceHead *heads, int num_heads,
+                      float threshold, float *scratch,
+                      RetinafaceCandidates *out);
+
+// Same candidates, probabilities and order as RetinafaceGather at
+// threshold.prob, for the selected scoring mode.
+void RetinafaceGather(const RetinafaceHead *heads, int num_heads,
+                      const RetinafaceThreshold &threshold,
+                      RetinafaceScoreMode mode, float *scratch,
+                      RetinafaceCandidates *out);
+
+// The two halves of RetinafaceGather. RetinafaceSelect reads only the conf
+// heads and fills anchor and prob; RetinafaceFetch then copies loc/landms
+// of those candidates. In between the caller can invalidate just the
+// loc/landms bytes the fetch reads.
+void RetinafaceSelect(const RetinafaceHead *heads, int num_heads,
+                      const RetinafaceThreshold &threshold,
+                      RetinafaceScoreMode mode, float *scratch,
+                      RetinafaceCandidates *out);
+void RetinafaceFetch(const RetinafaceHead *heads, int num_heads,
+                     RetinafaceCandidates *out);
+
+// One stride of int8/uint8 heads, each tensor with its own quantization.
+template <class T>
+struct RetinafaceQuantHead {
+  const T *loc;
+  const T *conf;
+  const T *landms;
+  int size;  // H * W
+  OutputQuant loc_quant;
+  OutputQuant conf_quant;
+  OutputQuant landms_quant;
+};
+
+// kLogit gather straight from quantized heads. Both conf channels of an
+// anchor share a scale and zero point, so the logit test is an integer
+// subtract and compare; only the survivors are dequantized and scored. The
+// result equals RetinafaceGather on the dequantized heads. T is uint8_t or
+// int8_t.
+template <class T>
+void RetinafaceGatherQuant(const RetinafaceQuantHead<T> *heads, int num_heads,
+                           const RetinafaceThreshold &threshold,
+                           float *scratch, RetinafaceCandidates *out);
+// Its two halves, as RetinafaceSelect and RetinafaceFetch.
+template <class T>
+void RetinafaceSelectQuant(const RetinafaceQuantHead<T> *heads, int num_heads,
+                           const RetinafaceThreshold &threshold,
+                           float *scratch, RetinafaceCandidates *out);
+template <class T>
+void RetinafaceFetchQuant(const RetinafaceQuantHead<T> *heads, int num_heads,
+                          RetinafaceCandidates *out);
+
+// Two-class softmax over matching elements of a and b, as
+// softmax_2group_vec does. Exposed for the scalar reference decoder.
+void RetinafaceSoftmax2(int n, const float *a, const float *b, float *out_a,
+                        float *out_b);
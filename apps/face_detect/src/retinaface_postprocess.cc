@@ -0,0 +1,292 @@
+#include "retinaface_postprocess.h"
+
+#include <math.h>
+#include <stdint.h>
+
+#include <cstdlib>
+#include <iostream>
+
+#include "letterbox.h"
+
+#if defined(K230_BIGCORE)
+#include "k230_math.h"
+#endif
+
+#define LOC_SIZE RETINAFACE_LOC_SIZE
+#define LAND_SIZE RETINAFACE_LAND_SIZE
+#define INITIAL_FACES 64
+// loc/landms ranges closer than this are invalidated as one, so a cluster
+// of anchors costs one call per channel plane rather than one per anchor
+#define INVALIDATE_GAP 256
+
+static inline float Exp(float x) {
+#if defined(K230_BIGCORE)
+  return k230_expf(x);
+#else
+  return expf(x);
+#endif
+}
+
+RetinafacePostprocess::RetinafacePostprocess(int model_h, int model_w,
+                                             const int conf_size[3],
+                                             int frame_h, int frame_w)
+    : frame_h_(frame_h),
+      frame_w_(frame_w),
+      threshold_(RetinafaceMakeThreshold(obj_threshold_)) {
+  objs_num_ = 0;
+  for (int i = 0; i < 3; i++) {
+    conf_size_[i] = conf_size[i];
+    objs_num_ += conf_size_[i] * RETINAFACE_ANCHORS;
+  }
+  if (RetinafaceAnchorCount(model_h, model_w) != objs_num_) {
+    std::cerr << "kmodel heads do not match RetinaFace priors for " << model_h
+              << "x" << model_w << " input" << std::endl;
+    std::abort();
+  }
+  anchors_ = RetinafaceAnchors(model_h, model_w, anchor_storage_);
+
+  Letterbox lb = FitLetterbox(frame_w, frame_h, model_w, model_h);
+  letterbox_ = {-static_cast<int>(lroundf(lb.pad_left * lb.ratio)),
+                -static_cast<int>(lroundf(lb.pad_top * lb.ratio)),
+                model_w * lb.ratio, model_h * lb.ratio};
+  view_ = letterbox_;
+  ws_.s.resize(objs_num_);
+  ws_.s_probs.resize(objs_num_);
+  ws_.tmp.resize(RetinafaceGatherScratch());
+  ws_.boxes.resize(objs_num_ * LOC_SIZE);
+  ws_.landmarks.resize(objs_num_ * LAND_SIZE);
+  ws_.cand_box.resize(objs_num_);
+  ws_.nms.Reserve(objs_num_);
+  ws_.keep.reserve(objs_num_);
+  ws_.pred_box.reserve(INITIAL_FACES);
+  ws_.pred_landmarks.reserve(INITIAL_FACES);
+  result_.boxes.reserve(INITIAL_FACES);
+  result_.landmarks.reserve(INITIAL_FACES);
+}
+
+void RetinafacePostprocess::Run(const float* const outputs[9]) {
+  // out[0..2] loc, out[3..5] conf, out[6..8] landms, largest stride first
+  RetinafaceHead heads[3];
+  for (int i = 0; i < 3; i++) {
+    heads[i] = {outputs[i], outputs[3 + i], outputs[6 + i], conf_size_[i]};
+  }
+  RetinafaceCandidates cands = Candidates();
+  InvalidateConf(sizeof(float));
+  RetinafaceSelect(heads, 3, threshold_, score_mode_, ws_.tmp.data(), &cands);
+  InvalidateCandidates(cands.count, sizeof(float));
+  RetinafaceFetch(heads, 3, &cands);
+  Finish(cands.count);
+}
+
+void RetinafacePostprocess::Run(const void* const outputs[9],
+                                const OutputQuant quant[9]) {
+  for (int i = 1; i < 9; i++) {
+    if (quant[i].type != quant[0].type) {
+      std::cerr << "RetinaFace outputs must share one data type" << std::endl;
+      std::abort();
+    }
+  }
+  switch (quant[0].type) {
+    case OutputType::kFloat32: {
+      const float* out[9];
+      for (int i = 0; i < 9; i++) {
+        out[i] = static_cast<const float*>(outputs[i]);
+      }
+      Run(out);
+      break;
+    }
+    case OutputType::kUint8:
+      RunQuantized<uint8_t>(outputs, quant);
+      break;
+    case OutputType::kInt8:
+      RunQuantized<int8_t>(outputs, quant);
+      break;
+  }
+}
+
+template <class T>
+void RetinafacePostprocess::RunQuantized(const void* const outputs[9],
+                                         const OutputQuant quant[9]) {
+  RetinafaceQuantHead<T> heads[3];
+  for (int i = 0; i < 3; i++) {
+    heads[i] = {static_cast<const T*>(outputs[i]),
+                static_cast<const T*>(outputs[3 + i]),
+                static_cast<const T*>(outputs[6 + i]),
+                conf_size_[i],
+                quant[i],
+                quant[3 + i],
+                quant[6 + i]};
+  }
+  RetinafaceCandidates cands = Candidates();
+  InvalidateConf(sizeof(T));
+  RetinafaceSelectQuant(heads, 3, threshold_, ws_.tmp.data(), &cands);
+  InvalidateCandidates(cands.count, sizeof(T));
+  RetinafaceFetchQuant(heads, 3, &cands);
+  Finish(cands.count);
+}
+
+void RetinafacePostprocess::InvalidateConf(size_t elem_size) {
+  if (!invalidate_) return;
+  for (int h = 0; h < 3; h++) {
+    invalidate_(3 + h, 0,
+                static_cast<size_t>(conf_size_[h]) * RETINAFACE_ANCHORS *
+                    RETINAFACE_CONF_SIZE * elem_size);
+  }
+}
+
+void RetinafacePostprocess::InvalidateCandidates(int count,
+                                                 size_t elem_size) {
+  if (!invalidate_) return;
+  const int* anchor = ws_.s.data();
+  const int channels[2] = {LOC_SIZE, LAND_SIZE};
+  int first = 0, anchor_base = 0;
+  for (int h = 0; h < 3; h++) {
+    const int size = conf_size_[h];
+    const int anchor_end = anchor_base + size * RETINAFACE_ANCHORS;
+    int last = first;
+    while (last < count && anchor[last] < anchor_end) last++;
+
+    // candidates are in anchor order, so each channel plane is visited in
+    // ascending cells and the ranges of an output come out sorted
+    for (int k = 0; first < last && k < 2; k++) {
+      const int output = k == 0 ? h : 6 + h;
+      size_t begin = 0, end = 0;
+      bool open = false;
+      auto add = [&](size_t b, size_t e) {
+        if (open && b <= end + INVALIDATE_GAP) {
+          end = e > end ? e : end;
+          return;
+        }
+        if (open) invalidate_(output, begin, end - begin);
+        begin = b;
+        end = e;
+        open = true;
+      };
+      for (int hh = 0; hh < RETINAFACE_ANCHORS; hh++) {
+        for (int c = 0; c < channels[k]; c++) {
+          const size_t plane =
+              static_cast<size_t>(hh * channels[k] + c) * size * elem_size;
+          for (int i = first; i < last; i++) {
+            const int local = anchor[i] - anchor_base;
+            if (local % RETINAFACE_ANCHORS != hh) continue;
+            const size_t cell = local / RETINAFACE_ANCHORS * elem_size;
+            add(plane + cell, plane + cell + elem_size);
+          }
+        }
+      }
+      if (open) invalidate_(output, begin, end - begin);
+    }
+    first = last;
+    anchor_base = anchor_end;
+  }
+}
+
+void RetinafacePostprocess::SetCrop(int x, int y, int side) {
+  view_ = {x, y, static_cast<float>(side), static_cast<float>(side)};
+}
+
+RetinafaceCandidates RetinafacePostprocess::Candidates() {
+  return {ws_.s.data(), ws_.s_probs.data(), ws_.boxes.data(),
+          ws_.landmarks.data(), 0};
+}
+
+void RetinafacePostprocess::Finish(int real_count) {
+  auto &pred_box = ws_.pred_box;
+  auto &landmarks = ws_.pred_landmarks;
+  pred_box.clear();
+  landmarks.clear();
+  Decode(real_count, pred_box, landmarks);
+
+  const float sx = view_.scale_x, sy = view_.scale_y;
+  const int x0 = view_.x0, y0 = view_.y0;
+
+  auto clamp = [](int v, int hi) { return v < 0 ? 0 : (v > hi ? hi : v); };
+
+  // boxes and their landmarks; a box left empty by clamping it to the frame
+  // lies wholly outside it and is dropped with its landmarks
+  result_.boxes.clear();
+  result_.landmarks.clear();
+  for (size_t i = 0; i < pred_box.size(); i++) {
+    face_coordinate box;
+
+    box.x1 = static_cast<int>(pred_box[i].x * sx - pred_box[i].w * sx / 2) + x0;
+    box.y1 = static_cast<int>(pred_box[i].y * sy - pred_box[i].h * sy / 2) + y0;
+    box.x2 = static_cast<int>(pred_box[i].x * sx + pred_box[i].w * sx / 2) + x0;
+    box.y2 = static_cast<int>(pred_box[i].y * sy + pred_box[i].h * sy / 2) + y0;
+
+    box.x1 = clamp(box.x1, frame_w_);
+    box.y1 = clamp(box.y1, frame_h_);
+    box.x2 = clamp(box.x2, frame_w_);
+    box.y2 = clamp(box.y2, frame_h_);
+    if (box.x2 <= box.x1 || box.y2 <= box.y1) continue;
+
+    result_.boxes.push_back(box);
+
+    auto landmark = landmarks[i];
+    for (uint32_t j = 0; j < 5; j++) {
+      int x = static_cast<int>(landmark.points[2 * j + 0] * sx) + x0;
+      int y = static_cast<int>(landmark.points[2 * j + 1] * sy) + y0;
+
+      landmark.points[2 * j + 0] = x;
+      landmark.points[2 * j + 1] = y;
+    }
+    result_.landmarks.push_back(landmark);
+  }
+}
+
+box_t RetinafacePostprocess::GetBoxOpt(const float* boxes, int obj_index,
+                                       int index_anchors) {
+  const RetinafaceAnchor& anchor = anchors_[index_anchors];
+  const float* loc = boxes + obj_index * LOC_SIZE;
+  box_t box;
+  box.x = anchor.cx + loc[0] * anchor.vw;
+  box.y = anchor.cy + loc[1] * anchor.vh;
+  box.w = anchor.w * Exp(loc[2] * 0.2f);
+  box.h = anchor.h * Exp(loc[3] * 0.2f);
+  return box;
+}
+
+landmarks_t RetinafacePostprocess::GetLandmarkOpt(const float* landmarks,
+                                                  int obj_index,
+                                                  int index_anchors) {
+  const RetinafaceAnchor& anchor = anchors_[index_anchors];
+  const float* landms = landmarks + obj_index * LAND_SIZE;
+  landmarks_t landmark;
+  for (uint32_t ll = 0; ll < 5; ll++) {
+    landmark.points[2 * ll + 0] = anchor.cx + landms[2 * ll + 0] * anchor.vw;
+    landmark.points[2 * ll + 1] = anchor.cy + landms[2 * ll + 1] * anchor.vh;
+  }
+  return landmark;
+}
+
+void RetinafacePostprocess::Decode(int real_count,
+                                   std::vector<box_t>& pred_box,
+                                   std::vector<landmarks_t>& pred_landmarks) {
+  int* s = ws_.s.data();
+  float* s_probs = ws_.s_probs.data();
+  float* boxes = ws_.boxes.data();
+  float* landmarks = ws_.landmarks.data();
+
+  // decode every candidate box once, then suppress in score order
+  Nms& nms = ws_.nms;
+  box_t* cand_box = ws_.cand_box.data();
+  nms.Clear();
+  for (int i = 0; i < real_count; ++i) {
+    box_t box = GetBoxOpt(boxes, i, s[i]);
+    cand_box[i] = box;
+    nms.AddCenter(box.x, box.y, box.w, box.h, s_probs[i]);
+  }
+
+  NmsConfig config;
+  config.iou_threshold = nms_threshold_;
+  {
+    ScopedTiming st(Stage::kNms);
+    nms.Run(config, ws_.keep);
+  }
+
+  for (int obj_index : ws_.keep) {
+    pred_box.push_back(cand_box[obj_index]);
+    pred_landmarks.push_back(
+        GetLandmarkOpt(landmarks, obj_index, s[obj_index]));
+  }
+}
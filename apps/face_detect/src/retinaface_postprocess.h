@@ -0,0 +1,106 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "nms.h"
+#include "quant_params.h"
+#include "retinaface_anchors.h"
+#include "retinaface_decoder.h"
+#include "util.h"
+
+typedef struct {
+  std::vector<face_coordinate> boxes;
+  std::vector<landmarks_t> landmarks;
+} DetectResult;
+
+// Scratch buffers for Decode, sized once from the kmodel output shapes so
+// that steady-state frames do not touch the heap.
+struct DecodeWorkspace {
+  std::vector<int> s;            // anchor index of each candidate
+  std::vector<float> s_probs;    // face score of each candidate
+  std::vector<float> tmp;        // softmax output of one gather chunk
+  std::vector<float> boxes;      // raw loc of each candidate
+  std::vector<float> landmarks;  // raw landms of each candidate
+  std::vector<box_t> cand_box;   // decoded box of each candidate
+  Nms nms;
+  std::vector<int> keep;         // candidates surviving NMS
+  std::vector<box_t> pred_box;
+  std::vector<landmarks_t> pred_landmarks;
+};
+
+// CPU side of MobileRetinaface: turns the nine head outputs into face boxes
+// and landmarks in frame coordinates. It does not depend on the SDK, so
+// recorded outputs can be replayed on a host (apps/host_tools).
+class RetinafacePostprocess {
+ public:
+  // model_h/model_w: kmodel input size. conf_size: H * W of each stride's
+  // conf head. frame_h/frame_w: size of the frame fed to AI2D, which
+  // letterboxes it as FitLetterbox describes.
+  RetinafacePostprocess(int model_h, int model_w, const int conf_size[3],
+                        int frame_h, int frame_w);
+
+  // outputs: loc[0..2], conf[3..5], landms[6..8], largest stride first.
+  void Run(const float *const outputs[9]);
+  // Same for outputs of any OutputType; all nine must share the type.
+  // Quantized heads are always thresholded in the integer logit domain.
+  void Run(const void *const outputs[9], const OutputQuant quant[9]);
+  // kSoftmax (default) or kLogit, which selects the same candidates faster.
+  void SetScoreMode(RetinafaceScoreMode mode) { score_mode_ = mode; }
+  // The next Run maps detections from a square crop of the frame at (x, y)
+  // that AI2D resized to the model input, instead of from the letterboxed
+  // full frame. Cleared by SetFullFrame.
+  void SetCrop(int x, int y, int side);
+  void SetFullFrame() { view_ = letterbox_; }
+  // Makes bytes [offset, offset + bytes) of output `output` visible to the
+  // CPU.
+  using Invalidator =
+      std::function<void(int output, size_t offset, size_t bytes)>;
+  // If set, Run invalidates what it reads just before reading it: the conf
+  // heads in full, then only the loc/landms ranges of the anchors that
+  // passed the threshold, and nothing of a stride without candidates.
+  void SetInvalidator(Invalidator fn) { invalidate_ = std::move(fn); }
+  const DetectResult &Result() const { return result_; }
+
+ private:
+  template <class T>
+  void RunQuantized(const void *const outputs[9], const OutputQuant quant[9]);
+  RetinafaceCandidates Candidates();
+  void InvalidateConf(size_t elem_size);
+  // Invalidates the loc/landms bytes RetinafaceFetch reads for the first
+  // `count` candidates, for heads of elem_size bytes per value.
+  void InvalidateCandidates(int count, size_t elem_size);
+  // Suppresses the gathered candidates and maps the survivors to the frame.
+  void Finish(int real_count);
+  void Decode(int real_count, std::vector<box_t> &pred_box,
+              std::vector<landmarks_t> &pred_landmarks);
+  box_t GetBoxOpt(const float *boxes, int obj_index, int index_anchors);
+  landmarks_t GetLandmarkOpt(const float *landmarks, int obj_index,
+                             int index_anchors);
+
+  // Model input to frame, per axis:
+  // frame = static_cast<int>(normalized * scale) + x0
+  struct View {
+    int x0, y0;
+    float scale_x, scale_y;
+  };
+
+  int frame_h_;
+  int frame_w_;
+  View letterbox_;  // whole frame, letterboxed into the model input
+  View view_;       // view of the next Run
+  float obj_threshold_ = 0.6f;
+  float nms_threshold_ = 0.5f;
+  RetinafaceThreshold threshold_;  // obj_threshold_ in both score domains
+  RetinafaceScoreMode score_mode_ = RetinafaceScoreMode::kSoftmax;
+  int conf_size_[3];  // H * W of each stride
+  int objs_num_;      // total anchors over all strides
+  const RetinafaceAnchor *anchors_;
+  std::vector<RetinafaceAnchor> anchor_storage_;  // for non-tabulated sizes
+  DecodeWorkspace ws_;
+  DetectResult result_;
+  Invalidator invalidate_;
+};
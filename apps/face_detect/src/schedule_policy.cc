@@ -0,0 +1,122 @@
+#include "schedule_policy.h"
+
+#include <algorithm>
+
+static const char *kResourceNames[] = {"ai2d", "kpu"};
+
+int SchedulePolicy::AddClient(const std::string &name, int priority,
+                              double target_fps) {
+  Client c;
+  c.stats.name = name;
+  c.stats.priority = priority;
+  c.stats.target_fps = target_fps;
+  c.period_us = target_fps > 0 ? static_cast<uint64_t>(1e6 / target_fps) : 0;
+  clients_.push_back(c);
+  return static_cast<int>(clients_.size()) - 1;
+}
+
+bool SchedulePolicy::Admit(int id, uint64_t now_us) {
+  Touch(now_us);
+  Client &c = clients_[id];
+  if (c.period_us == 0) {
+    c.stats.admitted++;
+    return true;
+  }
+  // A quarter period of slack absorbs camera jitter, so a 10 fps target on
+  // a 30 fps stream takes every third frame rather than every fourth.
+  uint64_t slack = c.period_us / 4;
+  if (now_us + slack < c.next_due_us) {
+    c.stats.skipped++;
+    return false;
+  }
+  // Do not catch up with a burst after a stall
+  uint64_t base = now_us > slack ? now_us - slack : 0;
+  c.next_due_us = std::max(c.next_due_us, base) + c.period_us;
+  c.stats.admitted++;
+  return true;
+}
+
+void SchedulePolicy::Enqueue(int id, KpuResource res, uint64_t now_us) {
+  Touch(now_us);
+  waiting_[Index(res)].push_back({id, now_us});
+}
+
+int SchedulePolicy::Pick(KpuResource res) const {
+  if (Busy(res)) return -1;
+  const Waiter *best = nullptr;
+  for (const auto &w : waiting_[Index(res)]) {
+    // waiters are in arrival order, so the first of a priority wins ties
+    if (!best || clients_[w.id].stats.priority >
+                     clients_[best->id].stats.priority) {
+      best = &w;
+    }
+  }
+  return best ? best->id : -1;
+}
+
+void SchedulePolicy::Begin(int id, KpuResource res, uint64_t now_us) {
+  Touch(now_us);
+  int r = Index(res);
+  auto &queue = waiting_[r];
+  auto it = std::find_if(queue.begin(), queue.end(),
+                         [&](const Waiter &w) { return w.id == id; });
+  if (it != queue.end()) {
+    uint64_t wait = now_us - it->since_us;
+    auto &s = clients_[id].stats;
+    s.wait_us[r] += wait;
+    s.wait_max_us[r] = std::max(s.wait_max_us[r], wait);
+    queue.erase(it);
+  }
+  owner_[r] = id;
+  begin_us_[r] = now_us;
+}
+
+void SchedulePolicy::End(int id, KpuResource res, uint64_t now_us) {
+  Touch(now_us);
+  int r = Index(res);
+  auto &s = clients_[id].stats;
+  s.runs[r]++;
+  s.busy_us[r] += now_us - begin_us_[r];
+  owner_[r] = -1;
+}
+
+void SchedulePolicy::Report(FILE *fp, uint64_t now_us) const {
+  double elapsed_s =
+      started_ && now_us > start_us_ ? (now_us - start_us_) / 1e6 : 0;
+  fprintf(fp, "%-12s %4s %7s %8s %8s %7s", "model", "prio", "target",
+          "admitted", "skipped", "fps");
+  for (const char *res : kResourceNames) {
+    fprintf(fp, " %5s%% %8s %8s", res, "wait_avg", "wait_max");
+  }
+  fprintf(fp, "\n");
+
+  double total[static_cast<int>(KpuResource::kNumResources)] = {};
+  for (const auto &c : clients_) {
+    const auto &s = c.stats;
+    double fps = elapsed_s > 0 ? s.runs[Index(KpuResource::kKpu)] / elapsed_s
+                               : 0;
+    fprintf(fp, "%-12s %4d %7.1f %8llu %8llu %7.1f", s.name.c_str(),
+            s.priority, s.target_fps,
+            static_cast<unsigned long long>(s.admitted),
+            static_cast<unsigned long long>(s.skipped), fps);
+    for (int r = 0; r < static_cast<int>(KpuResource::kNumResources); r++) {
+      double util = elapsed_s > 0 ? s.busy_us[r] / (elapsed_s * 1e4) : 0;
+      total[r] += util;
+      fprintf(fp, " %6.1f %8llu %8llu", util,
+              static_cast<unsigned long long>(
+                  s.runs[r] ? s.wait_us[r] / s.runs[r] : 0),
+              static_cast<unsigned long long>(s.wait_max_us[r]));
+    }
+    fprintf(fp, "\n");
+  }
+  fprintf(fp, "%-12s %4s %7s %8s %8s %7s", "total", "", "", "", "", "");
+  for (double util : total) fprintf(fp, " %6.1f %8s %8s", util, "", "");
+  fprintf(fp, "\n");
+}
+
+void SchedulePolicy::Touch(uint64_t now_us) {
+  if (!started_) {
+    started_ = true;
+    start_us_ = now_us;
+  }
+}
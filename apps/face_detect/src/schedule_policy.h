@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Hardware units shared by every model in the process.
+enum class KpuResource { kAi2d, kKpu, kNumResources };
+
+struct SchedClientStats {
+  std::string name;
+  int priority = 0;
+  double target_fps = 0;  // 0 = every offered frame
+  uint64_t admitted = 0;  // frames accepted by the rate gate
+  uint64_t skipped = 0;   // frames refused by the rate gate
+  uint64_t runs[static_cast<int>(KpuResource::kNumResources)] = {};
+  uint64_t busy_us[static_cast<int>(KpuResource::kNumResources)] = {};
+  uint64_t wait_us[static_cast<int>(KpuResource::kNumResources)] = {};
+  uint64_t wait_max_us[static_cast<int>(KpuResource::kNumResources)] = {};
+};
+
+// Decides which model gets the AI2D and the KPU next. It keeps no clock of
+// its own and takes no locks: callers pass the current time in
+// microseconds, so the same policy drives KpuScheduler on the board and
+// sched_sim (apps/host_tools) with simulated run times.
+//
+// Each resource is granted to one client at a time. Among the clients
+// waiting for it, the highest priority wins and equal priorities are served
+// in arrival order. A client with a frame-rate target is offered every frame
+// but only admits as many as the target allows.
+class SchedulePolicy {
+ public:
+  // Returns the client id. priority: larger runs first.
+  int AddClient(const std::string &name, int priority, double target_fps);
+  size_t Clients() const { return clients_.size(); }
+  const SchedClientStats &Stats(int id) const { return clients_[id].stats; }
+
+  // Rate gate, called once for every frame offered to the client.
+  bool Admit(int id, uint64_t now_us);
+
+  void Enqueue(int id, KpuResource res, uint64_t now_us);
+  // Client to grant `res` to next, or -1 if it is busy or nobody waits.
+  int Pick(KpuResource res) const;
+  // `id` must be the client returned by Pick.
+  void Begin(int id, KpuResource res, uint64_t now_us);
+  void End(int id, KpuResource res, uint64_t now_us);
+  bool Busy(KpuResource res) const { return owner_[Index(res)] >= 0; }
+
+  // Per-client admission, achieved rate, utilization of each resource and
+  // queueing delay since the first event.
+  void Report(FILE *fp, uint64_t now_us) const;
+
+ private:
+  struct Waiter {
+    int id;
+    uint64_t since_us;
+  };
+  struct Client {
+    SchedClientStats stats;
+    uint64_t period_us = 0;
+    uint64_t next_due_us = 0;
+  };
+  static int Index(KpuResource res) { return static_cast<int>(res); }
+  void Touch(uint64_t now_us);
+
+  std::vector<Client> clients_;
+  std::vector<Waiter> waiting_[static_cast<int>(KpuResource::kNumResources)];
+  int owner_[static_cast<int>(KpuResource::kNumResources)] = {-1, -1};
+  uint64_t begin_us_[static_cast<int>(KpuResource::kNumResources)] = {};
+  bool started_ = false;
+  uint64_t start_us_ = 0;
+};
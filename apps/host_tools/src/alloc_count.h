@@ -0,0 +1,43 @@
+#pragma once
+
+// Counts every heap allocation of the program by replacing the global
+// operator new, plain and over-aligned, so a host tool can check that a code path does not touch
+// the heap. The replacements are not inline: include this header in exactly
+// one translation unit of the executable.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <new>
+
+inline std::atomic<uint64_t> g_heap_allocs{0};
+
+// Allocations since the program started, on any thread.
+inline uint64_t HeapAllocs() {
+  return g_heap_allocs.load(std::memory_order_relaxed);
+}
+
+void *operator new(size_t size) {
+  g_heap_allocs.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = malloc(size ? size : 1)) return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { free(p); }
+
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+void *operator new(size_t size, std::align_val_t align) {
+  g_heap_allocs.fetch_add(1, std::memory_order_relaxed);
+  void *p = nullptr;
+  size_t a = static_cast<size_t>(align);
+  if (a < sizeof(void *)) a = sizeof(void *);
+  if (posix_memalign(&p, a, size ? size : 1) == 0) return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p, std::align_val_t) noexcept { free(p); }
+
+void operator delete(void *p, size_t, std::align_val_t) noexcept { free(p); }
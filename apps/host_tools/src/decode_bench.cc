@@ -0,0 +1,338 @@
+// Checks that the fused RetinafaceGather selects and gathers exactly what the
+// previous three-pass decoder (DealConfOpt / DealLocOpt / DealLandmsOpt)
+// produced, in both score modes, and times all three. Heads come from a
+// step4 dump directory (kmodel_result_<idx>_*.npy, loc/conf/landms order as
+// in the kmodel) or are synthesized for a 320x320 input.
+//
+// A second table puts every anchor's logit difference within a few ulps of
+// the logit threshold, where the logit mode has to fall back on softmax
+// scores to agree with the softmax mode. A third quantizes the heads to
+// uint8 and int8 and checks RetinafaceGatherQuant against the softmax mode
+// on the dequantized heads.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "npy.h"
+#include "retinaface_decoder.h"
+
+namespace {
+
+const int kSizes[3] = {40 * 40, 20 * 20, 10 * 10};
+
+struct Heads {
+  std::vector<float> out[9];
+  int size[3];
+};
+
+bool LoadDump(const char *dir, Heads &heads) {
+  std::vector<NpyArray> outputs;
+  if (LoadKmodelDump(dir, outputs) != 9) {
+    fprintf(stderr, "cannot load 9 outputs from %s\n", dir);
+    return false;
+  }
+  for (int i = 0; i < 9; i++) {
+    if (outputs[i].shape.size() != 4) {
+      fprintf(stderr, "output %d of %s is not NCHW\n", i, dir);
+      return false;
+    }
+    heads.out[i] = std::move(outputs[i].data);
+    if (i >= 3 && i < 6) {
+      heads.size[i - 3] = outputs[i].shape[2] * outputs[i].shape[3];
+    }
+  }
+  return true;
+}
+
+void Synthesize(Heads &heads, std::mt19937 &rng) {
+  std::normal_distribution<float> value(0.0f, 1.0f);
+  std::normal_distribution<float> logit(-4.0f, 2.5f);
+  for (int i = 0; i < 3; i++) {
+    int size = kSizes[i];
+    heads.size[i] = size;
+    heads.out[i].resize(8 * size);
+    heads.out[3 + i].resize(4 * size);
+    heads.out[6 + i].resize(20 * size);
+    for (float &v : heads.out[i]) v = value(rng);
+    for (float &v : heads.out[6 + i]) v = value(rng);
+    // channel pairs are (bg, face) per anchor
+    for (int a = 0; a < 2; a++) {
+      for (int k = 0; k < size; k++) {
+        heads.out[3 + i][(2 * a) * size + k] = 0.0f;
+        heads.out[3 + i][(2 * a + 1) * size + k] = logit(rng);
+      }
+    }
+  }
+}
+
+// Moves every face logit next to the logit threshold: exactly on it, or a
+// few ulps either side.
+void PlantAtThreshold(Heads &heads, const RetinafaceThreshold &threshold,
+                      std::mt19937 &rng) {
+  std::uniform_real_distribution<float> bg(-3.0f, 3.0f);
+  std::uniform_int_distribution<int> ulps(-4, 4);
+  for (int i = 0; i < 3; i++) {
+    int size = heads.size[i];
+    for (int a = 0; a < 2; a++) {
+      for (int k = 0; k < size; k++) {
+        float b = bg(rng);
+        float f = b + threshold.logit;
+        for (int u = ulps(rng); u != 0; u += u > 0 ? -1 : 1) {
+          f = nextafterf(f, u > 0 ? INFINITY : -INFINITY);
+        }
+        heads.out[3 + i][(2 * a) * size + k] = b;
+        heads.out[3 + i][(2 * a + 1) * size + k] = f;
+      }
+    }
+  }
+}
+
+// The previous decoder: softmax over the whole map, threshold into an index
+// list, then two more passes matching anchors against that list.
+int ThreePass(const Heads &heads, float threshold, std::vector<float> &tmp,
+              RetinafaceCandidates *out) {
+  int obj_cnt = 0;
+  int real_count = 0;
+  for (int h = 0; h < 3; h++) {
+    int size = heads.size[h];
+    const float *conf = heads.out[3 + h].data();
+    RetinafaceSoftmax2(size, conf, conf + size, tmp.data(),
+                       tmp.data() + size);
+    RetinafaceSoftmax2(size, conf + 2 * size, conf + 3 * size,
+                       tmp.data() + 2 * size, tmp.data() + 3 * size);
+    for (int i = 0; i < size; ++i) {
+      float p = tmp[size + i];
+      if (p >= threshold) {
+        out->anchor[real_count] = obj_cnt;
+        out->prob[real_count++] = p;
+      }
+      obj_cnt++;
+      p = tmp[size * 3 + i];
+      if (p >= threshold) {
+        out->anchor[real_count] = obj_cnt;
+        out->prob[real_count++] = p;
+      }
+      obj_cnt++;
+    }
+  }
+  out->anchor[real_count] = -1;
+
+  const int widths[2] = {RETINAFACE_LOC_SIZE, RETINAFACE_LAND_SIZE};
+  float *dst[2] = {out->loc, out->landms};
+  for (int pass = 0; pass < 2; pass++) {
+    int cnt = 0;
+    int index_s = 0;
+    for (int h = 0; h < 3; h++) {
+      int size = heads.size[h];
+      const float *src = heads.out[(pass == 0 ? 0 : 6) + h].data();
+      for (int ww = 0; ww < size; ww++) {
+        for (int hh = 0; hh < 2; hh++) {
+          if (cnt == out->anchor[index_s]) {
+            for (int cc = 0; cc < widths[pass]; cc++) {
+              dst[pass][index_s * widths[pass] + cc] =
+                  src[(hh * widths[pass] + cc) * size + ww];
+            }
+            index_s++;
+          }
+          cnt++;
+        }
+      }
+    }
+  }
+  out->count = real_count;
+  return real_count;
+}
+
+struct Buffers {
+  std::vector<int> anchor;
+  std::vector<float> prob, loc, landms;
+  RetinafaceCandidates cands;
+
+  explicit Buffers(int n)
+      : anchor(n + 1), prob(n), loc(n * 4), landms(n * 10) {
+    cands = {anchor.data(), prob.data(), loc.data(), landms.data(), 0};
+  }
+};
+
+bool Same(const Buffers &a, const Buffers &b) {
+  int n = a.cands.count;
+  return n == b.cands.count &&
+         memcmp(a.anchor.data(), b.anchor.data(), n * sizeof(int)) == 0 &&
+         memcmp(a.prob.data(), b.prob.data(), n * sizeof(float)) == 0 &&
+         memcmp(a.loc.data(), b.loc.data(), n * 4 * sizeof(float)) == 0 &&
+         memcmp(a.landms.data(), b.landms.data(), n * 10 * sizeof(float)) == 0;
+}
+
+template <class F>
+double TimeUs(int iterations, F &&fn) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) fn();
+  auto stop = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::micro>(stop - start).count() /
+         iterations;
+}
+
+// Per-tensor affine quantization of every head, plus the dequantized copy
+// the float path is checked on.
+template <class T>
+struct QuantHeads {
+  std::vector<T> out[9];
+  OutputQuant quant[9];
+  Heads dequant;
+};
+
+template <class T>
+void Quantize(const Heads &heads, OutputType type, QuantHeads<T> &q) {
+  const int qmin = std::numeric_limits<T>::min();
+  const int qmax = std::numeric_limits<T>::max();
+  for (int i = 0; i < 9; i++) {
+    const auto &src = heads.out[i];
+    float lo = std::min(0.0f, *std::min_element(src.begin(), src.end()));
+    float hi = std::max(0.0f, *std::max_element(src.begin(), src.end()));
+    OutputQuant &quant = q.quant[i];
+    quant.type = type;
+    quant.scale = hi > lo ? (hi - lo) / (qmax - qmin) : 1.0f;
+    quant.zero_point = qmin - static_cast<int>(std::lround(lo / quant.scale));
+    q.out[i].resize(src.size());
+    q.dequant.out[i].resize(src.size());
+    for (size_t k = 0; k < src.size(); k++) {
+      long v = std::lround(src[k] / quant.scale) + quant.zero_point;
+      v = std::min<long>(qmax, std::max<long>(qmin, v));
+      q.out[i][k] = static_cast<T>(v);
+      q.dequant.out[i][k] = Dequantize(q.out[i][k], quant);
+    }
+  }
+  for (int i = 0; i < 3; i++) q.dequant.size[i] = heads.size[i];
+}
+
+template <class T>
+bool CheckQuantized(const Heads &heads, OutputType type, const char *name,
+                    const float *thresholds, int count, int iterations,
+                    std::vector<float> &scratch, Buffers &ref, Buffers &quant) {
+  QuantHeads<T> q;
+  Quantize(heads, type, q);
+  RetinafaceHead views[3];
+  RetinafaceQuantHead<T> qviews[3];
+  for (int i = 0; i < 3; i++) {
+    views[i] = {q.dequant.out[i].data(), q.dequant.out[3 + i].data(),
+                q.dequant.out[6 + i].data(), heads.size[i]};
+    qviews[i] = {q.out[i].data(),     q.out[3 + i].data(),
+                 q.out[6 + i].data(), heads.size[i],
+                 q.quant[i],          q.quant[3 + i],
+                 q.quant[6 + i]};
+  }
+
+  bool all_same = true;
+  for (int t = 0; t < count; t++) {
+    RetinafaceThreshold threshold = RetinafaceMakeThreshold(thresholds[t]);
+    double tl = TimeUs(iterations, [&] {
+      RetinafaceGather(views, 3, threshold, RetinafaceScoreMode::kLogit,
+                       scratch.data(), &ref.cands);
+    });
+    double tq = TimeUs(iterations, [&] {
+      RetinafaceGatherQuant(qviews, 3, threshold, scratch.data(),
+                            &quant.cands);
+    });
+    RetinafaceGather(views, 3, threshold, RetinafaceScoreMode::kSoftmax,
+                     scratch.data(), &ref.cands);
+    bool same = Same(ref, quant);
+    all_same = all_same && same;
+    printf("%6s %9.2f %10d %12.1f %12.1f %6s\n", name, thresholds[t],
+           quant.cands.count, tl, tq, same ? "yes" : "NO");
+  }
+  return all_same;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  const char *dump_dir = argc > 1 ? argv[1] : nullptr;
+  int iterations = argc > 2 ? atoi(argv[2]) : 200;
+
+  Heads heads;
+  std::mt19937 rng(230);
+  if (dump_dir) {
+    if (!LoadDump(dump_dir, heads)) return 1;
+  } else {
+    Synthesize(heads, rng);
+  }
+
+  RetinafaceHead views[3];
+  int anchors = 0;
+  for (int i = 0; i < 3; i++) {
+    views[i] = {heads.out[i].data(), heads.out[3 + i].data(),
+                heads.out[6 + i].data(), heads.size[i]};
+    anchors += heads.size[i] * RETINAFACE_ANCHORS;
+  }
+
+  Buffers legacy(anchors), fused(anchors), logit(anchors);
+  std::vector<float> tmp(heads.size[0] * 4);
+  std::vector<float> scratch(RetinafaceGatherScratch());
+  const float kThresholds[] = {0.5f, 0.6f, 0.8f, 0.95f};
+
+  bool all_same = true;
+  printf("%9s %10s %12s %12s %12s %6s\n", "threshold", "candidates",
+         "3pass_us", "softmax_us", "logit_us", "exact");
+  for (float prob : kThresholds) {
+    RetinafaceThreshold threshold = RetinafaceMakeThreshold(prob);
+    double t3 = TimeUs(iterations, [&] {
+      ThreePass(heads, prob, tmp, &legacy.cands);
+    });
+    double ts = TimeUs(iterations, [&] {
+      RetinafaceGather(views, 3, threshold, RetinafaceScoreMode::kSoftmax,
+                       scratch.data(), &fused.cands);
+    });
+    double tl = TimeUs(iterations, [&] {
+      RetinafaceGather(views, 3, threshold, RetinafaceScoreMode::kLogit,
+                       scratch.data(), &logit.cands);
+    });
+    bool same = Same(legacy, fused) && Same(legacy, logit);
+    all_same = all_same && same;
+    printf("%9.2f %10d %12.1f %12.1f %12.1f %6s\n", prob, fused.cands.count,
+           t3, ts, tl, same ? "yes" : "NO");
+  }
+
+  printf("\n%9s %10s %10s %6s\n", "boundary", "softmax", "logit", "exact");
+  for (float prob : kThresholds) {
+    RetinafaceThreshold threshold = RetinafaceMakeThreshold(prob);
+    Heads edge = heads;
+    PlantAtThreshold(edge, threshold, rng);
+    RetinafaceHead edge_views[3];
+    for (int i = 0; i < 3; i++) {
+      edge_views[i] = {edge.out[i].data(), edge.out[3 + i].data(),
+                       edge.out[6 + i].data(), edge.size[i]};
+    }
+    RetinafaceGather(edge_views, 3, threshold, RetinafaceScoreMode::kSoftmax,
+                     scratch.data(), &fused.cands);
+    RetinafaceGather(edge_views, 3, threshold, RetinafaceScoreMode::kLogit,
+                     scratch.data(), &logit.cands);
+    bool same = Same(fused, logit);
+    all_same = all_same && same;
+    printf("%9.2f %10d %10d %6s\n", prob, fused.cands.count,
+           logit.cands.count, same ? "yes" : "NO");
+  }
+
+  printf("\n%6s %9s %10s %12s %12s %6s\n", "type", "threshold",
+         "candidates", "f32_logit_us", "quant_us", "exact");
+  const int kCount = sizeof(kThresholds) / sizeof(kThresholds[0]);
+  all_same = CheckQuantized<uint8_t>(heads, OutputType::kUint8, "uint8",
+                                     kThresholds, kCount, iterations, scratch,
+                                     fused, logit) &&
+             all_same;
+  all_same = CheckQuantized<int8_t>(heads, OutputType::kInt8, "int8",
+                                    kThresholds, kCount, iterations, scratch,
+                                    fused, logit) &&
+             all_same;
+  return all_same ? 0 : 1;
+}
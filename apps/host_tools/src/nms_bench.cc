@@ -0,0 +1,174 @@
+// Compares the Nms engine against the previous qsort + O(n^2) loop that
+// re-decoded both boxes of every pair, on synthetic crowded scenes.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "nms.h"
+
+namespace {
+
+struct Candidate {
+  float loc[4];     // raw loc head output
+  float anchor[4];  // cx, cy, w, h
+  float score;
+};
+
+struct Box {
+  float x, y, w, h;
+};
+
+// Same math as MobileRetinaface::GetBoxOpt.
+Box DecodeBox(const Candidate &c) {
+  Box b;
+  b.x = c.anchor[0] + c.loc[0] * 0.1f * c.anchor[2];
+  b.y = c.anchor[1] + c.loc[1] * 0.1f * c.anchor[3];
+  b.w = c.anchor[2] * expf(c.loc[2] * 0.2f);
+  b.h = c.anchor[3] * expf(c.loc[3] * 0.2f);
+  return b;
+}
+
+float Overlap(float x1, float w1, float x2, float w2) {
+  float l1 = x1 - w1 / 2;
+  float l2 = x2 - w2 / 2;
+  float left = l1 > l2 ? l1 : l2;
+  float r1 = x1 + w1 / 2;
+  float r2 = x2 + w2 / 2;
+  float right = r1 < r2 ? r1 : r2;
+  return right - left;
+}
+
+float BoxIou(Box a, Box b) {
+  float w = Overlap(a.x, a.w, b.x, b.w);
+  float h = Overlap(a.y, a.h, b.y, b.h);
+  float i = (w < 0 || h < 0) ? 0 : w * h;
+  return i / (a.w * a.h + b.w * b.h - i);
+}
+
+const float *g_prob;
+int Compare(const void *pa, const void *pb) {
+  int a = *static_cast<const int *>(pa);
+  int b = *static_cast<const int *>(pb);
+  if (g_prob[a] < g_prob[b]) return 1;
+  if (g_prob[a] > g_prob[b]) return -1;
+  return 0;
+}
+
+size_t LegacyNms(const std::vector<Candidate> &cands, float threshold) {
+  int n = static_cast<int>(cands.size());
+  std::vector<float> probs(n);
+  std::vector<int> order(n);
+  for (int i = 0; i < n; i++) {
+    probs[i] = cands[i].score;
+    order[i] = i;
+  }
+  g_prob = probs.data();
+  qsort(order.data(), n, sizeof(int), Compare);
+
+  size_t kept = 0;
+  for (int i = 0; i < n; i++) {
+    int ai = order[i];
+    if (probs[ai] <= 0) continue;
+    Box a = DecodeBox(cands[ai]);
+    kept++;
+    for (int j = i + 1; j < n; j++) {
+      int bi = order[j];
+      if (probs[bi] <= 0) continue;
+      Box b = DecodeBox(cands[bi]);
+      if (BoxIou(a, b) >= threshold) probs[bi] = 0;
+    }
+  }
+  return kept;
+}
+
+size_t EngineNms(Nms &nms, const std::vector<Candidate> &cands,
+                 const NmsConfig &config, std::vector<int> &keep) {
+  nms.Clear();
+  for (const auto &c : cands) {
+    Box b = DecodeBox(c);
+    nms.AddCenter(b.x, b.y, b.w, b.h, c.score);
+  }
+  nms.Run(config, keep);
+  return keep.size();
+}
+
+// Candidates cluster around a few faces like a crowded RetinaFace output:
+// many anchors fire on each face with small offsets.
+std::vector<Candidate> MakeScene(size_t count, std::mt19937 &rng) {
+  size_t faces = count / 40 + 1;
+  std::uniform_real_distribution<float> pos(0.05f, 0.95f);
+  std::uniform_real_distribution<float> size(0.03f, 0.2f);
+  std::normal_distribution<float> jitter(0.0f, 0.5f);
+  std::uniform_real_distribution<float> score(0.6f, 1.0f);
+
+  std::vector<Box> centers(faces);
+  for (auto &c : centers) {
+    c = {pos(rng), pos(rng), size(rng), size(rng)};
+  }
+
+  std::vector<Candidate> cands(count);
+  for (size_t i = 0; i < count; i++) {
+    const Box &f = centers[i % faces];
+    Candidate &c = cands[i];
+    c.anchor[0] = f.x;
+    c.anchor[1] = f.y;
+    c.anchor[2] = f.w;
+    c.anchor[3] = f.h;
+    for (float &v : c.loc) v = jitter(rng);
+    c.score = score(rng);
+  }
+  return cands;
+}
+
+template <class F>
+double TimeUs(int iterations, F &&fn) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) fn();
+  auto stop = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::micro>(stop - start).count() /
+         iterations;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 20;
+  const size_t counts[] = {10, 50, 100, 250, 500, 1000, 2000, 4000};
+
+  std::mt19937 rng(230);
+  Nms nms;
+  nms.Reserve(4200);
+  std::vector<int> keep;
+  keep.reserve(4200);
+
+  NmsConfig hard;
+  NmsConfig soft;
+  soft.mode = NmsMode::kSoftGaussian;
+  soft.score_threshold = 0.3f;
+  NmsConfig topk = hard;
+  topk.top_k = 200;
+
+  printf("%6s %12s %12s %12s %12s %6s %6s\n", "boxes", "legacy_us",
+         "hard_us", "top200_us", "soft_us", "kept", "legacy");
+  for (size_t count : counts) {
+    auto cands = MakeScene(count, rng);
+    size_t legacy_kept = 0;
+    size_t kept = 0;
+    double legacy =
+        TimeUs(iterations, [&] { legacy_kept = LegacyNms(cands, 0.5f); });
+    double engine =
+        TimeUs(iterations, [&] { kept = EngineNms(nms, cands, hard, keep); });
+    double top =
+        TimeUs(iterations, [&] { EngineNms(nms, cands, topk, keep); });
+    double soft_us =
+        TimeUs(iterations, [&] { EngineNms(nms, cands, soft, keep); });
+    printf("%6zu %12.1f %12.1f %12.1f %12.1f %6zu %6zu\n", count, legacy,
+           engine, top, soft_us, kept, legacy_kept);
+  }
+  return 0;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+// Minimal reader for the little-endian float32 C-order .npy files written by
+// the step4/evaluate scripts. Returns false on any other format.
+inline bool LoadNpyFloat(const std::string &path, std::vector<float> &data,
+                         std::vector<size_t> &shape) {
+  FILE *fp = fopen(path.c_str(), "rb");
+  if (!fp) return false;
+
+  char magic[8];
+  bool ok = fread(magic, 1, 8, fp) == 8 && memcmp(magic, "\x93NUMPY", 6) == 0;
+  size_t header_len = 0;
+  if (ok && magic[6] == 1) {
+    unsigned char len[2];
+    ok = fread(len, 1, 2, fp) == 2;
+    header_len = len[0] | (len[1] << 8);
+  } else if (ok) {
+    unsigned char len[4];
+    ok = fread(len, 1, 4, fp) == 4;
+    header_len = len[0] | (len[1] << 8) | (len[2] << 16) |
+                 (static_cast<size_t>(len[3]) << 24);
+  }
+
+  std::string header(header_len, '\0');
+  ok = ok && fread(&header[0], 1, header_len, fp) == header_len;
+  ok = ok && header.find("'<f4'") != std::string::npos &&
+       header.find("'fortran_order': False") != std::string::npos;
+
+  shape.clear();
+  size_t count = 1;
+  if (ok) {
+    size_t pos = header.find('(');
+    size_t end = header.find(')', pos);
+    std::string dims = header.substr(pos + 1, end - pos - 1);
+    for (size_t i = 0; i < dims.size();) {
+      size_t next = dims.find(',', i);
+      if (next == std::string::npos) next = dims.size();
+      std::string item = dims.substr(i, next - i);
+      if (item.find_first_of("0123456789") != std::string::npos) {
+        shape.push_back(std::stoul(item));
+        count *= shape.back();
+      }
+      i = next + 1;
+    }
+  }
+
+  if (ok) {
+    data.resize(count);
+    ok = fread(data.data(), sizeof(float), count, fp) == count;
+  }
+  fclose(fp);
+  return ok;
+}
+
+struct NpyArray {
+  std::vector<float> data;
+  std::vector<size_t> shape;
+};
+
+// Loads the kmodel_result_<idx>_<name>.npy files of a step4 dump directory
+// into outputs[idx]. Returns the number of outputs, or -1 if the indices are
+// not contiguous from 0 or a file cannot be read.
+inline int LoadKmodelDump(const std::string &dir,
+                          std::vector<NpyArray> &outputs) {
+  DIR *dp = opendir(dir.c_str());
+  if (!dp) return -1;
+  std::vector<std::string> names;
+  while (dirent *ent = readdir(dp)) {
+    int idx;
+    if (sscanf(ent->d_name, "kmodel_result_%d_", &idx) == 1 && idx >= 0 &&
+        idx < 256) {
+      if (names.size() <= static_cast<size_t>(idx)) names.resize(idx + 1);
+      names[idx] = dir + "/" + ent->d_name;
+    }
+  }
+  closedir(dp);
+
+  outputs.resize(names.size());
+  for (size_t i = 0; i < names.size(); i++) {
+    if (names[i].empty() ||
+        !LoadNpyFloat(names[i], outputs[i].data, outputs[i].shape)) {
+      return -1;
+    }
+  }
+  return static_cast<int>(names.size());
+}
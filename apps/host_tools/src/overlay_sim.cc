@@ -0,0 +1,189 @@
+// Replays recorded face boxes through face_detect's BoxOverlay with a fake
+// VO driver that records every call, to check the incremental overlay on a
+// host: the screen the recorded calls produce must show every box of every
+// frame within the tolerance and nothing else. Also counts the driver calls
+// against the previous redraw-everything loop.
+//
+// The input is a replay -o result file of a retinaface recording (one
+// "<name> <count> x1,y1,x2,y2;<landmarks> ..." line per frame, in frame
+// order).
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "box_overlay.h"
+
+namespace {
+
+struct RecordedFrame {
+  std::string name;
+  std::vector<OverlayBox> boxes;
+};
+
+bool LoadBoxes(const char *path, std::vector<RecordedFrame> &frames) {
+  std::ifstream ifs(path);
+  if (!ifs) return false;
+  std::string line;
+  while (std::getline(ifs, line)) {
+    std::istringstream iss(line);
+    RecordedFrame frame;
+    size_t count;
+    if (!(iss >> frame.name >> count)) continue;
+    std::string tok;
+    while (iss >> tok) {
+      OverlayBox b;
+      if (sscanf(tok.c_str(), "%d,%d,%d,%d", &b.x1, &b.y1, &b.x2, &b.y2) !=
+          4) {
+        return false;
+      }
+      frame.boxes.push_back(b);
+    }
+    if (frame.boxes.size() != count) return false;
+    frames.push_back(std::move(frame));
+  }
+  return !frames.empty();
+}
+
+// Records the calls and keeps the screen they produce: slot -> box.
+class RecordingDriver : public OverlayDriver {
+ public:
+  void Commit(const std::vector<OverlayOp> &ops) override {
+    commits++;
+    for (const auto &op : ops) {
+      calls++;
+      if (op.draw) {
+        screen[op.slot] = op.box;
+      } else if (!screen.erase(op.slot)) {
+        bad_erases++;
+      }
+    }
+  }
+
+  std::map<int, OverlayBox> screen;
+  size_t commits = 0;
+  size_t calls = 0;
+  size_t bad_erases = 0;  // erase of a slot that shows nothing
+};
+
+// True if the screen shows exactly one box within `tolerance` per box.
+bool ScreenMatches(const std::map<int, OverlayBox> &screen,
+                   const std::vector<OverlayBox> &boxes, int tolerance) {
+  if (screen.size() != boxes.size()) return false;
+  std::vector<char> used(boxes.size(), 0);
+  for (const auto &s : screen) {
+    const OverlayBox &a = s.second;
+    bool found = false;
+    for (size_t i = 0; i < boxes.size() && !found; i++) {
+      const OverlayBox &b = boxes[i];
+      if (used[i] || abs(a.x1 - b.x1) > tolerance ||
+          abs(a.y1 - b.y1) > tolerance || abs(a.x2 - b.x2) > tolerance ||
+          abs(a.y2 - b.y2) > tolerance) {
+        continue;
+      }
+      used[i] = 1;
+      found = true;
+    }
+    if (!found) return false;
+  }
+  return true;
+}
+
+void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [-t tolerance] [-s WxH] [-D WxH] <boxes>\n"
+          "  boxes: replay -o result file of a retinaface recording\n"
+          "  -t tolerance: display pixels a box may be off before it is\n"
+          "     redrawn (default 4)\n"
+          "  -s WxH: frame size of the boxes (default 1280x720)\n"
+          "  -D WxH: display size (default 1920x1080)\n",
+          prog);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  int tolerance = 4;
+  int frame_w = 1280, frame_h = 720;
+  int display_w = 1920, display_h = 1080;
+  int opt;
+  while ((opt = getopt(argc, argv, "t:s:D:")) != -1) {
+    switch (opt) {
+      case 't':
+        tolerance = atoi(optarg);
+        break;
+      case 's':
+        if (sscanf(optarg, "%dx%d", &frame_w, &frame_h) != 2) {
+          usage(argv[0]);
+          return 2;
+        }
+        break;
+      case 'D':
+        if (sscanf(optarg, "%dx%d", &display_w, &display_h) != 2) {
+          usage(argv[0]);
+          return 2;
+        }
+        break;
+      default:
+        usage(argv[0]);
+        return 2;
+    }
+  }
+  if (optind != argc - 1 || frame_w <= 0 || frame_h <= 0) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  std::vector<RecordedFrame> frames;
+  if (!LoadBoxes(argv[optind], frames)) {
+    fprintf(stderr, "cannot read boxes from %s\n", argv[optind]);
+    return 2;
+  }
+
+  RecordingDriver driver;
+  BoxOverlay overlay(driver, tolerance);
+  size_t mismatches = 0, redraw_calls = 0, drawn = 0;
+  for (auto &frame : frames) {
+    for (auto &b : frame.boxes) {
+      b.x1 = b.x1 * display_w / frame_w;
+      b.y1 = b.y1 * display_h / frame_h;
+      b.x2 = b.x2 * display_w / frame_w;
+      b.y2 = b.y2 * display_h / frame_h;
+    }
+    overlay.Update(frame.boxes);
+    if (!ScreenMatches(driver.screen, frame.boxes, tolerance)) {
+      if (mismatches++ == 0) {
+        fprintf(stderr, "%s: screen does not match the boxes\n",
+                frame.name.c_str());
+      }
+    }
+    // The redraw loop drew every box and erased the slots past them
+    redraw_calls += frame.boxes.size() +
+                    (drawn > frame.boxes.size() ? drawn - frame.boxes.size()
+                                                : 0);
+    drawn = frame.boxes.size();
+  }
+  size_t commits = driver.commits, calls = driver.calls;
+  overlay.Clear();
+  bool cleared = driver.screen.empty();
+
+  printf("%zu frames, tolerance %d px\n", frames.size(), tolerance);
+  printf("driver calls  %zu (redraw every frame: %zu)\n", calls,
+         redraw_calls);
+  printf("commits       %zu, %zu frames without a call\n", commits,
+         frames.size() - commits);
+  printf("draws         %llu, erases %llu, kept %llu\n",
+         static_cast<unsigned long long>(overlay.Draws()),
+         static_cast<unsigned long long>(overlay.Erases()),
+         static_cast<unsigned long long>(overlay.Kept()));
+  printf("mismatches    %zu frames, %zu bad erases, %s after Clear\n",
+         mismatches, driver.bad_erases, cleared ? "empty" : "NOT empty");
+  return mismatches || driver.bad_erases || !cleared ? 1 : 0;
+}
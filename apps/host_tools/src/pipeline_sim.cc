@@ -0,0 +1,199 @@
+// Drives face_detect's Pipeline with mock stages that sleep for a given time,
+// to check the queueing on a host: every stage must see every frame in source
+// order, no more than `depth` frames may be in flight, the stages must drain
+// what is in flight when the source ends, and the per-stage counters must
+// add up. Runs each depth from 0 (serial) to the given maximum.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "pipeline.h"
+
+namespace {
+
+struct Item {
+  uint64_t seq = 0;
+  std::vector<int> boxes;  // stands in for Frame's result vectors
+};
+
+struct RunResult {
+  size_t errors = 0;
+  size_t in_flight_max = 0;
+  size_t items = 0;  // distinct items the stages were handed
+  size_t regrows = 0;  // box vector capacity changes after the first frames
+};
+
+void Sleep(double ms) {
+  if (ms > 0) {
+    std::this_thread::sleep_for(std::chrono::microseconds(
+        static_cast<int64_t>(ms * 1000)));
+  }
+}
+
+RunResult RunDepth(size_t depth, uint64_t frames,
+                   const std::vector<double> &stage_ms) {
+  RunResult r;
+  Pipeline<Item> pipeline(depth);
+  std::atomic<size_t> in_flight{0};
+  std::atomic<size_t> in_flight_max{0};
+  std::mutex mutex;
+  std::set<const Item *> items;
+  uint64_t produced = 0;
+
+  pipeline.SetSource("source", [&](Item &item) {
+    if (produced == frames) return false;
+    size_t n = ++in_flight;
+    size_t prev = in_flight_max.load();
+    while (n > prev && !in_flight_max.compare_exchange_weak(prev, n)) {
+    }
+    item.seq = produced++;
+    item.boxes.clear();
+    return true;
+  });
+
+  // next sequence number each stage expects
+  std::vector<uint64_t> expected(stage_ms.size(), 0);
+  for (size_t s = 0; s < stage_ms.size(); s++) {
+    bool last = s + 1 == stage_ms.size();
+    pipeline.AddStage("stage" + std::to_string(s), [&, s, last](Item &item) {
+      if (item.seq != expected[s]) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (r.errors++ == 0) {
+          fprintf(stderr, "depth %zu stage%zu: frame %llu, expected %llu\n",
+                  depth, s, static_cast<unsigned long long>(item.seq),
+                  static_cast<unsigned long long>(expected[s]));
+        }
+      }
+      expected[s] = item.seq + 1;
+      Sleep(stage_ms[s]);
+      if (s == 0) {
+        size_t cap = item.boxes.capacity();
+        item.boxes.assign(8, static_cast<int>(item.seq));
+        std::lock_guard<std::mutex> lock(mutex);
+        items.insert(&item);
+        // every pooled item has grown once after its first frame
+        if (item.seq >= std::max<size_t>(depth, 1) &&
+            item.boxes.capacity() != cap) {
+          r.regrows++;
+        }
+      }
+      if (last) in_flight--;
+    });
+  }
+
+  pipeline.Run();
+  r.in_flight_max = in_flight_max.load();
+  r.items = items.size();
+
+  auto fail = [&](const char *what) {
+    if (r.errors++ == 0) fprintf(stderr, "depth %zu: %s\n", depth, what);
+  };
+  size_t cap = std::max<size_t>(depth, 1);
+  if (r.in_flight_max > cap) fail("more frames in flight than the depth");
+  if (r.items > cap) fail("more items than the depth");
+  if (r.regrows) fail("pooled item vectors were reallocated");
+  for (size_t s = 0; s < stage_ms.size(); s++) {
+    if (expected[s] != frames) fail("a stage did not drain every frame");
+  }
+  if (in_flight.load() != 0) fail("frames left in flight after Run");
+
+  auto stats = pipeline.Stats();
+  for (size_t i = 0; i < stats.size(); i++) {
+    const StageStats &st = stats[i];
+    if (st.frames != frames) fail("stage frame counter does not match");
+    if (st.queue_max > depth) fail("queue deeper than the depth");
+    if (st.queue_sum > st.queue_max * st.frames) {
+      fail("queue sum exceeds frames * max queue");
+    }
+    // one microsecond of slack per frame for the truncated timings
+    uint64_t sleep_us =
+        i > 0 ? static_cast<uint64_t>(stage_ms[i - 1] * 1000) : 0;
+    if (st.busy_us + st.frames < sleep_us * st.frames) {
+      fail("stage busy time below its sleep time");
+    }
+    if (depth == 0 && (st.queue_max || st.starved_us || st.blocked_us)) {
+      fail("serial run reports queueing");
+    }
+  }
+  if (stats[0].queue_max) fail("source reports an input queue");
+
+  printf("depth %zu: in flight max %zu, %zu items\n", depth, r.in_flight_max,
+         r.items);
+  pipeline.PrintStats();
+  return r;
+}
+
+bool ParseStages(const char *arg, std::vector<double> &stage_ms) {
+  stage_ms.clear();
+  std::string s(arg);
+  size_t pos = 0;
+  while (pos <= s.size()) {
+    size_t end = s.find(',', pos);
+    if (end == std::string::npos) end = s.size();
+    char *tail;
+    double ms = strtod(s.c_str() + pos, &tail);
+    if (tail != s.c_str() + end || ms < 0) return false;
+    stage_ms.push_back(ms);
+    pos = end + 1;
+  }
+  return !stage_ms.empty();
+}
+
+void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [-p depth] [-n frames] [-t ms,ms,...]\n"
+          "  -p depth: largest pipeline depth to run (default 4)\n"
+          "  -n frames: frames per run (default 60)\n"
+          "  -t ms,...: sleep of each stage after the source\n"
+          "     (default 1,3,0.5,2)\n",
+          prog);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  size_t max_depth = 4;
+  uint64_t frames = 60;
+  std::vector<double> stage_ms = {1, 3, 0.5, 2};
+  int opt;
+  while ((opt = getopt(argc, argv, "p:n:t:")) != -1) {
+    switch (opt) {
+      case 'p':
+        max_depth = strtoul(optarg, nullptr, 10);
+        break;
+      case 'n':
+        frames = strtoull(optarg, nullptr, 10);
+        break;
+      case 't':
+        if (!ParseStages(optarg, stage_ms)) {
+          usage(argv[0]);
+          return 2;
+        }
+        break;
+      default:
+        usage(argv[0]);
+        return 2;
+    }
+  }
+  if (optind != argc) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  size_t errors = 0;
+  for (size_t depth = 0; depth <= max_depth; depth++) {
+    errors += RunDepth(depth, frames, stage_ms).errors;
+  }
+  printf("%s\n", errors ? "FAILED" : "ok");
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,204 @@
+// Drives face_detect's FrameRegistry with a fake mapper that counts and
+// tracks every map and unmap, to check the cache on a host: repeated frames
+// must hit without mapping again, the least recently used block must be
+// evicted past capacity and unmapped, every mapping must be unmapped when
+// the registry is destroyed, and a block's payload must be built once and
+// handed back on every hit.
+//
+// A scripted sequence checks each of these; a second run cycles VICAP-like
+// buffers through the registry and prints the counters.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "frame_registry.h"
+
+namespace {
+
+// Hands out distinct fake addresses and remembers what is mapped.
+class CountingMapper : public FrameMapper {
+ public:
+  void *Map(uint64_t paddr, size_t size) override {
+    maps++;
+    void *vaddr = reinterpret_cast<void *>(next_++ * 0x1000);
+    live[vaddr] = paddr;
+    sizes[vaddr] = size;
+    return vaddr;
+  }
+
+  void Unmap(void *vaddr, size_t size) override {
+    unmaps++;
+    auto it = live.find(vaddr);
+    if (it == live.end() || sizes[vaddr] != size) {
+      bad_unmaps++;
+      return;
+    }
+    unmapped.push_back(it->second);
+    live.erase(it);
+  }
+
+  size_t maps = 0;
+  size_t unmaps = 0;
+  size_t bad_unmaps = 0;  // unmap of an address that is not mapped
+  std::map<void *, uint64_t> live;
+  std::map<void *, size_t> sizes;
+  std::vector<uint64_t> unmapped;  // paddr of each unmap, in order
+
+ private:
+  uintptr_t next_ = 1;
+};
+
+struct Payload {
+  int id;
+  uint64_t paddr;
+};
+
+const size_t kFrameSize = 1280 * 720 * 3 / 2;
+
+class Checker {
+ public:
+  void Expect(bool ok, const char *what) {
+    checks_++;
+    if (!ok) {
+      failures_++;
+      fprintf(stderr, "FAILED: %s\n", what);
+    }
+  }
+  size_t Checks() const { return checks_; }
+  size_t Failures() const { return failures_; }
+
+ private:
+  size_t checks_ = 0;
+  size_t failures_ = 0;
+};
+
+void RunScript(Checker &c) {
+  CountingMapper mapper;
+  int payloads = 0;
+  {
+    FrameRegistry<Payload> reg(mapper, kFrameSize, 3,
+                               [&](void *, uint64_t paddr) {
+                                 return Payload{payloads++, paddr};
+                               });
+
+    // misses map and build a payload once per block
+    auto &a = reg.Acquire(0xa000);
+    int a_id = a.payload.id;
+    void *a_vaddr = a.vaddr;
+    reg.Acquire(0xb000);
+    reg.Acquire(0xc000);
+    c.Expect(reg.Misses() == 3 && reg.Hits() == 0, "three cold misses");
+    c.Expect(mapper.maps == 3 && payloads == 3, "one map and payload per miss");
+    c.Expect(mapper.sizes[a_vaddr] == kFrameSize, "maps the frame size");
+
+    // hits return the same mapping and payload without mapping again
+    auto &a2 = reg.Acquire(0xa000);
+    c.Expect(reg.Hits() == 1 && mapper.maps == 3, "hit does not map");
+    c.Expect(a2.vaddr == a_vaddr && a2.payload.id == a_id &&
+                 a2.payload.paddr == 0xa000,
+             "hit reuses the mapping and payload of its paddr");
+    c.Expect(payloads == 3, "hit does not build a payload");
+
+    // 0xb000 is now least recently used: a fourth block evicts it
+    reg.Acquire(0xd000);
+    c.Expect(reg.Evictions() == 1 && reg.Size() == 3, "evicts past capacity");
+    c.Expect(mapper.unmaps == 1 && mapper.unmapped.back() == 0xb000,
+             "unmaps the least recently used block");
+
+    // the evicted block misses again and gets a fresh payload
+    auto &b = reg.Acquire(0xb000);
+    c.Expect(reg.Misses() == 5 && payloads == 5, "evicted block misses");
+    c.Expect(b.payload.paddr == 0xb000 && b.payload.id == 4,
+             "evicted block gets a new payload");
+    c.Expect(mapper.unmapped.back() == 0xc000, "then evicts the next LRU");
+
+    auto &a3 = reg.Acquire(0xa000);
+    c.Expect(a3.payload.id == a_id, "payload survives other evictions");
+    c.Expect(mapper.live.size() == 3, "never more mappings than capacity");
+  }
+  c.Expect(mapper.live.empty() && mapper.unmaps == mapper.maps,
+           "destruction unmaps every block");
+  c.Expect(mapper.bad_unmaps == 0, "unmaps only mapped addresses");
+}
+
+void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [-b buffers] [-c capacity] [-n frames]\n"
+          "  -b buffers: VB blocks VICAP cycles through (default 4)\n"
+          "  -c capacity: registry capacity (default 8)\n"
+          "  -n frames: frames of the cycling run (default 1000)\n",
+          prog);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  size_t buffers = 4, capacity = 8, frames = 1000;
+  int opt;
+  while ((opt = getopt(argc, argv, "b:c:n:")) != -1) {
+    switch (opt) {
+      case 'b':
+        buffers = strtoul(optarg, nullptr, 10);
+        break;
+      case 'c':
+        capacity = strtoul(optarg, nullptr, 10);
+        break;
+      case 'n':
+        frames = strtoul(optarg, nullptr, 10);
+        break;
+      default:
+        usage(argv[0]);
+        return 2;
+    }
+  }
+  if (optind != argc || buffers == 0) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  Checker c;
+  RunScript(c);
+
+  // VICAP hands the blocks out round-robin
+  CountingMapper mapper;
+  uint64_t hits, misses, evictions;
+  size_t payloads = 0;
+  {
+    FrameRegistry<Payload> reg(mapper, kFrameSize, capacity,
+                               [&](void *, uint64_t paddr) {
+                                 return Payload{static_cast<int>(payloads++),
+                                                paddr};
+                               });
+    for (size_t i = 0; i < frames; i++) {
+      uint64_t paddr = 0x10000000 + (i % buffers) * 0x200000;
+      auto &e = reg.Acquire(paddr);
+      c.Expect(e.payload.paddr == paddr && mapper.live[e.vaddr] == paddr,
+               "cycling: entry belongs to its paddr");
+    }
+    hits = reg.Hits();
+    misses = reg.Misses();
+    evictions = reg.Evictions();
+  }
+  size_t expect_misses = buffers <= capacity ? buffers : frames;
+  c.Expect(misses == expect_misses,
+           buffers <= capacity ? "cycling: one miss per block"
+                               : "cycling: LRU misses every frame");
+  c.Expect(mapper.live.empty() && mapper.bad_unmaps == 0,
+           "cycling: every block unmapped once");
+
+  printf("%zu frames over %zu blocks, capacity %zu\n", frames, buffers,
+         capacity);
+  printf("hits %llu, misses %llu, evictions %llu\n",
+         static_cast<unsigned long long>(hits),
+         static_cast<unsigned long long>(misses),
+         static_cast<unsigned long long>(evictions));
+  printf("maps %zu, unmaps %zu, payloads %zu\n", mapper.maps, mapper.unmaps,
+         payloads);
+  printf("%zu checks, %zu failed\n", c.Checks(), c.Failures());
+  return c.Failures() ? 1 : 0;
+}
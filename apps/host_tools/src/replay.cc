@@ -0,0 +1,384 @@
+// Replays recorded KPU outputs through the CPU-side postprocessing of the
+// AI apps (RetinafacePostprocess for face_detect, ClassifierPostprocess for
+// veg_classify) and reports throughput, per-frame latency and, against a
+// previous run, result diffs. Heap allocations are counted separately for
+// the first run, which sizes the buffers, the first run of each later frame,
+// which may grow them for a frame with more results, and the repeat runs of
+// a frame, which must not allocate at all; the tool exits non-zero if they
+// do.
+//
+// RetinafacePostprocess is also run once per frame on stale copies of the
+// outputs where only the bytes its invalidator asks for are refreshed, as
+// the device refreshes them from memory; the result must not change.
+//
+// A recording is a step4 dump directory (kmodel_result_<idx>_*.npy) holding
+// one frame, or a directory of such directories replayed in name order.
+
+#include <dirent.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "alloc_count.h"
+#include "classifier_postprocess.h"
+#include "detect_crop.h"
+#include "npy.h"
+#include "retinaface_postprocess.h"
+#include "util.h"
+
+namespace {
+
+struct Recording {
+  std::string name;
+  std::vector<NpyArray> outputs;
+};
+
+bool IsDump(const std::string &dir) {
+  DIR *dp = opendir(dir.c_str());
+  if (!dp) return false;
+  bool found = false;
+  while (dirent *ent = readdir(dp)) {
+    if (strncmp(ent->d_name, "kmodel_result_", 14) == 0) found = true;
+  }
+  closedir(dp);
+  return found;
+}
+
+bool LoadRecordings(const std::string &root, std::vector<Recording> &frames) {
+  std::vector<std::string> dirs;
+  if (IsDump(root)) {
+    dirs.push_back(root);
+  } else {
+    DIR *dp = opendir(root.c_str());
+    if (!dp) return false;
+    while (dirent *ent = readdir(dp)) {
+      std::string path = root + "/" + ent->d_name;
+      if (ent->d_name[0] != '.' && IsDump(path)) dirs.push_back(path);
+    }
+    closedir(dp);
+    std::sort(dirs.begin(), dirs.end());
+  }
+
+  for (const auto &dir : dirs) {
+    Recording rec;
+    rec.name = dir.substr(dir.find_last_of('/') + 1);
+    if (LoadKmodelDump(dir, rec.outputs) < 0) {
+      fprintf(stderr, "cannot load %s\n", dir.c_str());
+      return false;
+    }
+    frames.push_back(std::move(rec));
+  }
+  return !frames.empty();
+}
+
+// One result line per frame: "<name> <fields...>".
+std::map<std::string, std::string> LoadResults(const char *path) {
+  std::map<std::string, std::string> results;
+  std::ifstream ifs(path);
+  std::string line;
+  while (std::getline(ifs, line)) {
+    size_t sp = line.find(' ');
+    if (sp != std::string::npos) results[line.substr(0, sp)] = line;
+  }
+  return results;
+}
+
+std::string FormatDetect(const std::string &name, const DetectResult &r) {
+  std::string line = name + " " + std::to_string(r.boxes.size());
+  char buf[64];
+  for (size_t i = 0; i < r.boxes.size(); i++) {
+    const auto &b = r.boxes[i];
+    snprintf(buf, sizeof(buf), " %d,%d,%d,%d", b.x1, b.y1, b.x2, b.y2);
+    line += buf;
+    for (int j = 0; j < 10; j++) {
+      snprintf(buf, sizeof(buf), "%c%d", j ? ',' : ';',
+               static_cast<int>(r.landmarks[i].points[j]));
+      line += buf;
+    }
+  }
+  return line;
+}
+
+std::string FormatClassify(const std::string &name, const ClassifyResult &r) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), " %d %.4f ", r.class_id, r.confidence);
+  return name + buf + r.label;
+}
+
+std::vector<std::string> LoadLabels(const char *path) {
+  std::vector<std::string> labels;
+  std::ifstream ifs(path);
+  std::string line;
+  while (std::getline(ifs, line)) {
+    while (!line.empty() && (line.back() == '\r' || line.back() == ' ')) {
+      line.pop_back();
+    }
+    if (!line.empty()) labels.push_back(line);
+  }
+  return labels;
+}
+
+void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s retinaface|classifier [-n runs] [-s WxH] [-d score]\n"
+          "       [-c x,y,side] [-l labels] [-o results] [-e expected]\n"
+          "       <recording>\n"
+          "  -n runs: postprocess runs per frame (default 100)\n"
+          "  -s WxH: frame size fed to AI2D (retinaface, default 1280x720)\n"
+          "  -d score: softmax (default) or logit face scores (retinaface)\n"
+          "  -c x,y,side: the recording was detected on this square crop of\n"
+          "     the frame (face_detect -r) (retinaface)\n"
+          "  -l labels: label file (classifier)\n"
+          "  -o results: write one result line per frame\n"
+          "  -e expected: diff results against a previous -o file\n",
+          prog);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  const char *prog = argv[0];
+  if (argc < 2) {
+    usage(prog);
+    return 2;
+  }
+  std::string mode = argv[1];
+  if (mode != "retinaface" && mode != "classifier") {
+    usage(prog);
+    return 2;
+  }
+
+  int runs = 100;
+  int frame_w = 1280, frame_h = 720;
+  RetinafaceScoreMode score_mode = RetinafaceScoreMode::kSoftmax;
+  DetectCrop crop;
+  const char *labels_file = nullptr;
+  const char *out_file = nullptr;
+  const char *expect_file = nullptr;
+  optind = 2;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:s:d:c:l:o:e:")) != -1) {
+    switch (opt) {
+      case 'n':
+        runs = atoi(optarg);
+        break;
+      case 's':
+        if (sscanf(optarg, "%dx%d", &frame_w, &frame_h) != 2) {
+          usage(prog);
+          return 2;
+        }
+        break;
+      case 'd':
+        if (strcmp(optarg, "logit") == 0) {
+          score_mode = RetinafaceScoreMode::kLogit;
+        } else if (strcmp(optarg, "softmax") == 0) {
+          score_mode = RetinafaceScoreMode::kSoftmax;
+        } else {
+          usage(prog);
+          return 2;
+        }
+        break;
+      case 'c':
+        if (sscanf(optarg, "%d,%d,%d", &crop.x, &crop.y, &crop.side) != 3 ||
+            crop.side <= 0) {
+          usage(prog);
+          return 2;
+        }
+        crop.enabled = true;
+        break;
+      case 'l':
+        labels_file = optarg;
+        break;
+      case 'o':
+        out_file = optarg;
+        break;
+      case 'e':
+        expect_file = optarg;
+        break;
+      default:
+        usage(prog);
+        return 2;
+    }
+  }
+  if (optind != argc - 1 || runs <= 0) {
+    usage(prog);
+    return 2;
+  }
+
+  std::vector<Recording> frames;
+  if (!LoadRecordings(argv[optind], frames)) {
+    fprintf(stderr, "no recordings in %s\n", argv[optind]);
+    return 2;
+  }
+
+  std::vector<std::string> lines;
+  LatencyHistogram latency;
+  double total_us = 0;
+  auto timed = [&](auto &&fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    auto us = std::chrono::duration<double, std::micro>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+    latency.Record(static_cast<uint64_t>(us));
+    total_us += us;
+  };
+
+  // allocations of the first run, of the first run of each later frame and
+  // of the repeat runs of a frame
+  uint64_t warmup_allocs = 0;
+  uint64_t frame_allocs = 0;
+  uint64_t steady_allocs = 0;
+  uint64_t steady_runs = 0;
+  auto counted = [&](bool warmup, int run, auto &&fn) {
+    uint64_t before = HeapAllocs();
+    fn();
+    uint64_t allocs = HeapAllocs() - before;
+    if (warmup) {
+      warmup_allocs += allocs;
+    } else if (run == 0) {
+      frame_allocs += allocs;
+    } else {
+      steady_allocs += allocs;
+      steady_runs++;
+    }
+  };
+
+  if (mode == "retinaface") {
+    const auto &first = frames[0].outputs;
+    if (first.size() != 9) {
+      fprintf(stderr, "retinaface recordings need 9 outputs\n");
+      return 2;
+    }
+    // conf heads are [1, 4, H, W] with strides 8/16/32
+    int conf_size[3];
+    for (int i = 0; i < 3; i++) {
+      conf_size[i] = first[3 + i].shape[2] * first[3 + i].shape[3];
+    }
+    int model_h = first[3].shape[2] * 8;
+    int model_w = first[3].shape[3] * 8;
+    RetinafacePostprocess post(model_h, model_w, conf_size, frame_h, frame_w);
+    post.SetScoreMode(score_mode);
+    if (crop.enabled) post.SetCrop(crop.x, crop.y, crop.side);
+
+    // face_detect copies each result into its pooled Frame
+    DetectResult result;
+    bool warmup = true;
+    for (const auto &frame : frames) {
+      const float *out[9];
+      for (int i = 0; i < 9; i++) out[i] = frame.outputs[i].data.data();
+      for (int r = 0; r < runs; r++) {
+        counted(warmup, r, [&] {
+          timed([&] {
+            post.Run(out);
+            result = post.Result();
+          });
+        });
+        warmup = false;
+      }
+      lines.push_back(FormatDetect(frame.name, result));
+    }
+
+    // stale-cache run: a value off by a few units moves any box it reaches
+    size_t output_bytes = 0, invalidated = 0, ranges = 0, stale_diffs = 0;
+    for (size_t f = 0; f < frames.size(); f++) {
+      const Recording &frame = frames[f];
+      std::vector<std::vector<float>> stale(9);
+      const float *out[9];
+      for (int i = 0; i < 9; i++) {
+        stale[i].assign(frame.outputs[i].data.size(), 3.0f);
+        out[i] = stale[i].data();
+        output_bytes += stale[i].size() * sizeof(float);
+      }
+      post.SetInvalidator([&](int output, size_t offset, size_t bytes) {
+        const auto &src = frame.outputs[output].data;
+        size_t end = std::min(offset + bytes, src.size() * sizeof(float));
+        memcpy(reinterpret_cast<char *>(stale[output].data()) + offset,
+               reinterpret_cast<const char *>(src.data()) + offset,
+               end - offset);
+        invalidated += end - offset;
+        ranges++;
+      });
+      post.Run(out);
+      post.SetInvalidator(nullptr);
+      std::string line = FormatDetect(frame.name, post.Result());
+      if (line != lines[f] && stale_diffs++ == 0) {
+        fprintf(stderr, "stale outputs change %s\n  to %s\n",
+                lines[f].c_str(), line.c_str());
+      }
+    }
+    printf("invalidate: %.1f%% of %zu output bytes in %.1f ranges per frame, "
+           "%zu stale-output diffs\n",
+           output_bytes ? 100.0 * invalidated / output_bytes : 0.0,
+           output_bytes / frames.size(),
+           static_cast<double>(ranges) / frames.size(), stale_diffs);
+    if (stale_diffs) return 1;
+  } else {
+    std::vector<std::string> labels;
+    if (labels_file) labels = LoadLabels(labels_file);
+    ClassifyResult result;
+    bool warmup = true;
+    for (const auto &frame : frames) {
+      const auto &out = frame.outputs[0];
+      for (int r = 0; r < runs; r++) {
+        counted(warmup, r, [&] {
+          timed([&] {
+            ClassifierPostprocess(out.data.data(),
+                                  static_cast<int>(out.shape.back()), labels,
+                                  &result);
+          });
+        });
+        warmup = false;
+      }
+      lines.push_back(FormatClassify(frame.name, result));
+    }
+  }
+
+  uint64_t calls = latency.Count();
+  printf("%s: %zu frames x %d runs\n", mode.c_str(), frames.size(), runs);
+  printf("throughput %.0f frames/s, latency p50 %llu us, p99 %llu us, "
+         "max %llu us\n",
+         calls * 1e6 / total_us,
+         static_cast<unsigned long long>(latency.Percentile(50)),
+         static_cast<unsigned long long>(latency.Percentile(99)),
+         static_cast<unsigned long long>(latency.Max()));
+  printf("heap allocations: %llu in the first run, %llu in the first runs of "
+         "%zu later frames, %llu in %llu repeat runs\n",
+         static_cast<unsigned long long>(warmup_allocs),
+         static_cast<unsigned long long>(frame_allocs), frames.size() - 1,
+         static_cast<unsigned long long>(steady_allocs),
+         static_cast<unsigned long long>(steady_runs));
+  if (steady_allocs) fprintf(stderr, "repeat runs of a frame allocated\n");
+
+  if (out_file) {
+    std::ofstream ofs(out_file);
+    for (const auto &line : lines) ofs << line << "\n";
+  }
+
+  int diffs = 0;
+  if (expect_file) {
+    auto expected = LoadResults(expect_file);
+    for (const auto &line : lines) {
+      std::string name = line.substr(0, line.find(' '));
+      auto it = expected.find(name);
+      if (it == expected.end()) {
+        printf("new   %s\n", line.c_str());
+        diffs++;
+      } else if (it->second != line) {
+        printf("diff  %s\n  was %s\n", line.c_str(), it->second.c_str());
+        diffs++;
+      }
+    }
+    printf("%d of %zu frames differ from %s\n", diffs, lines.size(),
+           expect_file);
+  }
+  return diffs || steady_allocs ? 1 : 0;
+}
@@ -0,0 +1,204 @@
+// Replays recorded face boxes through the AE ROI path of face_detect and
+// sample_face_ae to tune AeRoiFilter on a host: how many ISP updates the
+// filter sends instead of one per frame, why the others were skipped, and
+// how much the metered windows still move from frame to frame.
+//
+// The input is a replay -o result file of a retinaface recording (one
+// "<name> <count> x1,y1,x2,y2;<landmarks> ..." line per frame, in frame
+// order).
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "ae_roi_filter.h"
+
+namespace {
+
+struct RecordedFrame {
+  std::string name;
+  std::vector<face_coordinate> boxes;
+};
+
+bool LoadBoxes(const char *path, std::vector<RecordedFrame> &frames) {
+  std::ifstream ifs(path);
+  if (!ifs) return false;
+  std::string line;
+  while (std::getline(ifs, line)) {
+    std::istringstream iss(line);
+    RecordedFrame frame;
+    size_t count;
+    if (!(iss >> frame.name >> count)) continue;
+    std::string tok;
+    while (iss >> tok) {
+      face_coordinate b;
+      if (sscanf(tok.c_str(), "%d,%d,%d,%d", &b.x1, &b.y1, &b.x2, &b.y2) !=
+          4) {
+        return false;
+      }
+      frame.boxes.push_back(b);
+    }
+    if (frame.boxes.size() != count) return false;
+    frames.push_back(std::move(frame));
+  }
+  return !frames.empty();
+}
+
+// Mean largest edge movement of the metered windows between consecutive
+// frames, in sensor pixels, over the frames whose window count is unchanged;
+// plus how often the count changed.
+class EdgeMotion {
+ public:
+  void Add(const std::vector<AeRoiWindow> &windows) {
+    if (has_prev_) {
+      if (windows.size() != prev_.size()) {
+        set_changes_++;
+      } else {
+        for (size_t i = 0; i < windows.size(); i++) {
+          const AeRoiWindow &a = windows[i], &b = prev_[i];
+          int moved = std::max(std::max(abs(a.x - b.x), abs(a.y - b.y)),
+                               std::max(abs(a.x + a.w - b.x - b.w),
+                                        abs(a.y + a.h - b.y - b.h)));
+          sum_ += moved;
+          count_++;
+        }
+      }
+    }
+    prev_ = windows;
+    has_prev_ = true;
+  }
+  float Mean() const { return count_ ? static_cast<float>(sum_ / count_) : 0; }
+  size_t SetChanges() const { return set_changes_; }
+
+ private:
+  std::vector<AeRoiWindow> prev_;
+  bool has_prev_ = false;
+  double sum_ = 0;
+  size_t count_ = 0;
+  size_t set_changes_ = 0;
+};
+
+void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [-s WxH] [-S WxH] [-a alpha] [-e frames] [-H frames] "
+          "[-c pixels] [-i frames] [-o updates] <boxes>\n"
+          "  boxes: replay -o result file of a retinaface recording\n"
+          "  -s WxH: frame size (default 1280x720)\n"
+          "  -S WxH: sensor size (default 1920x1080)\n"
+          "  -a alpha: EMA weight of a new measurement (default 0.3)\n"
+          "  -e frames: frames before a new face is metered (default 3)\n"
+          "  -H frames: frames a lost face keeps its window (default 10)\n"
+          "  -c pixels: edge movement that updates the ISP (default 32)\n"
+          "  -i frames: min frames between ISP updates (default 5)\n"
+          "  -o updates: write \"<name> <count> x,y,w,h ...\" per ISP "
+          "update\n",
+          prog);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  AeRoiFilterConfig config;
+  int frame_w = 1280, frame_h = 720;
+  int sensor_w = 1920, sensor_h = 1080;
+  const char *out_file = nullptr;
+  int opt;
+  while ((opt = getopt(argc, argv, "s:S:a:e:H:c:i:o:")) != -1) {
+    switch (opt) {
+      case 's':
+        if (sscanf(optarg, "%dx%d", &frame_w, &frame_h) != 2) {
+          usage(argv[0]);
+          return 2;
+        }
+        break;
+      case 'S':
+        if (sscanf(optarg, "%dx%d", &sensor_w, &sensor_h) != 2) {
+          usage(argv[0]);
+          return 2;
+        }
+        break;
+      case 'a':
+        config.alpha = static_cast<float>(atof(optarg));
+        break;
+      case 'e':
+        config.enter_frames = atoi(optarg);
+        break;
+      case 'H':
+        config.hold_frames = atoi(optarg);
+        break;
+      case 'c':
+        config.min_change = atoi(optarg);
+        break;
+      case 'i':
+        config.min_interval = atoi(optarg);
+        break;
+      case 'o':
+        out_file = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return 2;
+    }
+  }
+  if (optind != argc - 1 || frame_w <= 0 || frame_h <= 0) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  std::vector<RecordedFrame> frames;
+  if (!LoadBoxes(argv[optind], frames)) {
+    fprintf(stderr, "cannot read boxes from %s\n", argv[optind]);
+    return 2;
+  }
+
+  AeRoiFilter filter(config);
+  EdgeMotion raw_motion, metered_motion;
+  std::vector<std::string> lines;
+  for (const auto &frame : frames) {
+    auto windows = FacesToSensorWindows(frame.boxes, frame_w, frame_h,
+                                        sensor_w, sensor_h);
+    raw_motion.Add(windows);
+    if (filter.Update(windows) && out_file) {
+      std::string line = frame.name + " " +
+                         std::to_string(filter.Windows().size());
+      char buf[64];
+      for (const auto &w : filter.Windows()) {
+        snprintf(buf, sizeof(buf), " %d,%d,%d,%d", w.x, w.y, w.w, w.h);
+        line += buf;
+      }
+      lines.push_back(line);
+    }
+    // What the ISP meters on this frame
+    metered_motion.Add(filter.Windows());
+  }
+
+  printf("%zu frames, %dx%d frame, %dx%d sensor\n", frames.size(), frame_w,
+         frame_h, sensor_w, sensor_h);
+  printf("isp updates   %llu (%.1f%% of frames; unfiltered: every frame)\n",
+         static_cast<unsigned long long>(filter.Applied()),
+         100.0 * filter.Applied() / frames.size());
+  printf("skipped       %llu below min_change, %llu rate limited\n",
+         static_cast<unsigned long long>(filter.SkippedSmall()),
+         static_cast<unsigned long long>(filter.SkippedRate()));
+  printf("edge motion   %.1f px metered, %.1f px raw per frame\n",
+         metered_motion.Mean(), raw_motion.Mean());
+  printf("set changes   %zu metered, %zu raw\n", metered_motion.SetChanges(),
+         raw_motion.SetChanges());
+
+  if (out_file) {
+    FILE *fp = fopen(out_file, "w");
+    if (!fp) {
+      fprintf(stderr, "cannot write %s\n", out_file);
+      return 2;
+    }
+    for (const auto &line : lines) fprintf(fp, "%s\n", line.c_str());
+    fclose(fp);
+  }
+  return 0;
+}
@@ -0,0 +1,187 @@
+// Drives SchedulePolicy (the policy behind face_detect's KpuScheduler) with
+// simulated AI2D and KPU run times, to check priorities, frame-rate targets
+// and utilization for a model mix before running it on the board.
+//
+// Each model keeps at most one frame in flight, like a pipeline stage: a
+// frame that arrives while its previous one is still queued or running is
+// dropped before the rate gate sees it.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "schedule_policy.h"
+
+namespace {
+
+struct ModelSpec {
+  std::string name;
+  int priority;
+  double target_fps;
+  uint64_t ai2d_us;
+  uint64_t kpu_us;
+};
+
+enum class JobState { kIdle, kWaitAi2d, kAi2d, kWaitKpu, kKpu };
+
+struct SimModel {
+  ModelSpec spec;
+  int id;
+  JobState state = JobState::kIdle;
+  uint64_t frame_us = 0;  // arrival of the frame in flight
+  uint64_t dropped = 0;
+  uint64_t done = 0;
+  uint64_t latency_sum_us = 0;
+  uint64_t latency_max_us = 0;
+};
+
+bool ParseSpec(const char *arg, ModelSpec &spec) {
+  char name[64];
+  double ai2d_ms, kpu_ms;
+  if (sscanf(arg, "%63[^:]:%d:%lf:%lf:%lf", name, &spec.priority,
+             &spec.target_fps, &ai2d_ms, &kpu_ms) != 5) {
+    return false;
+  }
+  spec.name = name;
+  spec.ai2d_us = static_cast<uint64_t>(ai2d_ms * 1000);
+  spec.kpu_us = static_cast<uint64_t>(kpu_ms * 1000);
+  return true;
+}
+
+void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [-t secs] [-c camera_fps] [name:prio:fps:ai2d_ms:kpu_ms "
+          "...]\n"
+          "  -t secs: simulated duration (default 10)\n"
+          "  -c camera_fps: frame arrival rate (default 30)\n"
+          "  fps 0 admits every frame; larger prio wins the AI2D/KPU.\n"
+          "  Default mix: detect:1:0:3:14 classify:0:5:2:9\n",
+          prog);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  double secs = 10;
+  double camera_fps = 30;
+  int opt;
+  while ((opt = getopt(argc, argv, "t:c:")) != -1) {
+    switch (opt) {
+      case 't':
+        secs = atof(optarg);
+        break;
+      case 'c':
+        camera_fps = atof(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return 2;
+    }
+  }
+  if (secs <= 0 || camera_fps <= 0) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  std::vector<ModelSpec> specs;
+  for (int i = optind; i < argc; i++) {
+    ModelSpec spec;
+    if (!ParseSpec(argv[i], spec)) {
+      usage(argv[0]);
+      return 2;
+    }
+    specs.push_back(spec);
+  }
+  if (specs.empty()) {
+    specs.push_back({"detect", 1, 0, 3000, 14000});
+    specs.push_back({"classify", 0, 5, 2000, 9000});
+  }
+
+  SchedulePolicy policy;
+  std::vector<SimModel> models;
+  for (const auto &spec : specs) {
+    SimModel m;
+    m.spec = spec;
+    m.id = policy.AddClient(spec.name, spec.priority, spec.target_fps);
+    models.push_back(m);
+  }
+
+  const KpuResource kResources[] = {KpuResource::kAi2d, KpuResource::kKpu};
+  const uint64_t frame_period = static_cast<uint64_t>(1e6 / camera_fps);
+  const uint64_t end_us = static_cast<uint64_t>(secs * 1e6);
+  int owner[2] = {-1, -1};
+  uint64_t busy_until[2] = {0, 0};
+  uint64_t next_frame = 0;
+  uint64_t now = 0;
+
+  while (now < end_us) {
+    now = next_frame;
+    for (int r = 0; r < 2; r++) {
+      if (owner[r] >= 0) now = std::min(now, busy_until[r]);
+    }
+
+    // Completions first so a freed unit can be granted at the same instant
+    for (int r = 0; r < 2; r++) {
+      if (owner[r] < 0 || busy_until[r] != now) continue;
+      SimModel &m = models[owner[r]];
+      policy.End(m.id, kResources[r], now);
+      owner[r] = -1;
+      if (m.state == JobState::kAi2d) {
+        m.state = JobState::kWaitKpu;
+        policy.Enqueue(m.id, KpuResource::kKpu, now);
+      } else {
+        uint64_t latency = now - m.frame_us;
+        m.latency_sum_us += latency;
+        m.latency_max_us = std::max(m.latency_max_us, latency);
+        m.done++;
+        m.state = JobState::kIdle;
+      }
+    }
+
+    if (now == next_frame) {
+      for (auto &m : models) {
+        if (m.state != JobState::kIdle) {
+          m.dropped++;
+        } else if (policy.Admit(m.id, now)) {
+          m.state = JobState::kWaitAi2d;
+          m.frame_us = now;
+          policy.Enqueue(m.id, KpuResource::kAi2d, now);
+        }
+      }
+      next_frame += frame_period;
+    }
+
+    for (int r = 0; r < 2; r++) {
+      int id = policy.Pick(kResources[r]);
+      if (id < 0) continue;
+      SimModel &m = models[id];
+      policy.Begin(id, kResources[r], now);
+      owner[r] = id;
+      if (r == 0) {
+        m.state = JobState::kAi2d;
+        busy_until[r] = now + m.spec.ai2d_us;
+      } else {
+        m.state = JobState::kKpu;
+        busy_until[r] = now + m.spec.kpu_us;
+      }
+    }
+  }
+
+  printf("%.0f s at %.0f fps camera\n", secs, camera_fps);
+  policy.Report(stdout, now);
+  printf("\n%-12s %8s %8s %12s %12s\n", "model", "done", "dropped",
+         "latency_avg", "latency_max");
+  for (const auto &m : models) {
+    printf("%-12s %8llu %8llu %10llu us %10llu us\n", m.spec.name.c_str(),
+           static_cast<unsigned long long>(m.done),
+           static_cast<unsigned long long>(m.dropped),
+           static_cast<unsigned long long>(
+               m.done ? m.latency_sum_us / m.done : 0),
+           static_cast<unsigned long long>(m.latency_max_us));
+  }
+  return 0;
+}
@@ -0,0 +1,267 @@
+// Replays recorded face boxes through face_detect's FaceTracker to check the
+// detect-every-N tracking mode on a host: how many frames still need the
+// KPU, how closely the tracked boxes follow a detector run on every frame,
+// how often a face changes ID and how smooth the boxes are.
+//
+// The input is a replay -o result file of a retinaface recording (one
+// "<name> <count> x1,y1,x2,y2;<landmarks> ..." line per frame, in frame
+// order). The tracker only sees the detections of the frames it asks for.
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "face_tracker.h"
+
+namespace {
+
+struct RecordedFrame {
+  std::string name;
+  std::vector<face_coordinate> boxes;
+};
+
+bool LoadBoxes(const char *path, std::vector<RecordedFrame> &frames) {
+  std::ifstream ifs(path);
+  if (!ifs) return false;
+  std::string line;
+  while (std::getline(ifs, line)) {
+    std::istringstream iss(line);
+    RecordedFrame frame;
+    size_t count;
+    if (!(iss >> frame.name >> count)) continue;
+    std::string tok;
+    while (iss >> tok) {
+      face_coordinate b;
+      if (sscanf(tok.c_str(), "%d,%d,%d,%d", &b.x1, &b.y1, &b.x2, &b.y2) !=
+          4) {
+        return false;
+      }
+      frame.boxes.push_back(b);
+    }
+    if (frame.boxes.size() != count) return false;
+    frames.push_back(std::move(frame));
+  }
+  return !frames.empty();
+}
+
+float Iou(const face_coordinate &a, const face_coordinate &b) {
+  int ix = std::min(a.x2, b.x2) - std::max(a.x1, b.x1);
+  int iy = std::min(a.y2, b.y2) - std::max(a.y1, b.y1);
+  if (ix <= 0 || iy <= 0) return 0;
+  float inter = static_cast<float>(ix) * iy;
+  float area_a = static_cast<float>(a.x2 - a.x1) * (a.y2 - a.y1);
+  float area_b = static_cast<float>(b.x2 - b.x1) * (b.y2 - b.y1);
+  return inter / (area_a + area_b - inter);
+}
+
+// For each recorded box, the index of the best tracked face with IoU >= 0.5
+// (greedy, best first), or -1.
+std::vector<int> Match(const std::vector<face_coordinate> &boxes,
+                       const std::vector<TrackedFace> &faces,
+                       std::vector<float> &ious) {
+  struct Pair {
+    float iou;
+    int box, face;
+  };
+  std::vector<Pair> pairs;
+  for (size_t i = 0; i < boxes.size(); i++) {
+    for (size_t j = 0; j < faces.size(); j++) {
+      float iou = Iou(boxes[i], faces[j].box);
+      if (iou >= 0.5f) {
+        pairs.push_back({iou, static_cast<int>(i), static_cast<int>(j)});
+      }
+    }
+  }
+  std::sort(pairs.begin(), pairs.end(),
+            [](const Pair &a, const Pair &b) { return a.iou > b.iou; });
+  std::vector<int> match(boxes.size(), -1);
+  std::vector<char> used(faces.size(), 0);
+  ious.assign(boxes.size(), 0);
+  for (const auto &p : pairs) {
+    if (match[p.box] >= 0 || used[p.face]) continue;
+    match[p.box] = p.face;
+    used[p.face] = 1;
+    ious[p.box] = p.iou;
+  }
+  return match;
+}
+
+// Mean second difference of box centers per ID, in pixels: 0 for faces
+// moving at constant velocity, large for boxes that jitter.
+class Jitter {
+ public:
+  void Add(int id, const face_coordinate &b) {
+    float cx = (b.x1 + b.x2) / 2.0f, cy = (b.y1 + b.y2) / 2.0f;
+    auto &h = history_[id];
+    if (h.n >= 2) {
+      sum_ += hypotf(cx - 2 * h.x[1] + h.x[0], cy - 2 * h.y[1] + h.y[0]);
+      count_++;
+    }
+    h.x[0] = h.x[1];
+    h.y[0] = h.y[1];
+    h.x[1] = cx;
+    h.y[1] = cy;
+    h.n++;
+  }
+  float Mean() const { return count_ ? static_cast<float>(sum_ / count_) : 0; }
+
+ private:
+  struct History {
+    float x[2], y[2];
+    int n = 0;
+  };
+  std::map<int, History> history_;
+  double sum_ = 0;
+  size_t count_ = 0;
+};
+
+void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [-n max_interval] [-s WxH] [-m min_iou] [-o tracks] "
+          "<boxes>\n"
+          "  boxes: replay -o result file of a retinaface recording\n"
+          "  -n max_interval: detect at least every N frames (default 8)\n"
+          "  -s WxH: frame size (default 1280x720)\n"
+          "  -m min_iou: exit 1 if the mean IoU against every-frame\n"
+          "     detection falls below this\n"
+          "  -o tracks: write \"<name> <count> id:x1,y1,x2,y2 ...\" per "
+          "frame\n",
+          prog);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  TrackerConfig config;
+  int frame_w = 1280, frame_h = 720;
+  float min_iou = 0;
+  const char *out_file = nullptr;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:s:m:o:")) != -1) {
+    switch (opt) {
+      case 'n':
+        config.max_interval = atoi(optarg);
+        break;
+      case 's':
+        if (sscanf(optarg, "%dx%d", &frame_w, &frame_h) != 2) {
+          usage(argv[0]);
+          return 2;
+        }
+        break;
+      case 'm':
+        min_iou = static_cast<float>(atof(optarg));
+        break;
+      case 'o':
+        out_file = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return 2;
+    }
+  }
+  if (optind != argc - 1 || config.max_interval < 1) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  std::vector<RecordedFrame> frames;
+  if (!LoadBoxes(argv[optind], frames)) {
+    fprintf(stderr, "cannot read boxes from %s\n", argv[optind]);
+    return 2;
+  }
+
+  // The reference tracker sees every detection; its IDs tell which recorded
+  // boxes are the same face, so ID switches of the tracking mode can be
+  // counted against them.
+  TrackerConfig every_frame = config;
+  every_frame.max_interval = 1;
+  FaceTracker reference(frame_w, frame_h, every_frame);
+  FaceTracker tracker(frame_w, frame_h, config);
+
+  std::map<int, int> id_of;  // reference ID -> tracker ID
+  size_t boxes = 0, missed = 0, extra = 0, switches = 0;
+  double iou_sum = 0;
+  Jitter raw_jitter, tracked_jitter;
+  std::vector<float> ious, ref_ious;
+  std::vector<std::string> lines;
+
+  for (const auto &frame : frames) {
+    reference.DetectNext();
+    reference.Update(frame.boxes);
+    if (tracker.DetectNext()) {
+      tracker.Update(frame.boxes);
+    } else {
+      tracker.Predict();
+    }
+
+    const auto &faces = tracker.Faces();
+    auto ref_match = Match(frame.boxes, reference.Faces(), ref_ious);
+    auto match = Match(frame.boxes, faces, ious);
+    size_t matched = 0;
+    for (size_t i = 0; i < frame.boxes.size(); i++) {
+      boxes++;
+      iou_sum += ious[i];
+      int ref_id = ref_match[i] < 0 ? -1 : reference.Faces()[ref_match[i]].id;
+      if (ref_id >= 0) raw_jitter.Add(ref_id, frame.boxes[i]);
+      if (match[i] < 0) {
+        missed++;
+        continue;
+      }
+      matched++;
+      if (ref_id < 0) continue;
+      int id = faces[match[i]].id;
+      auto it = id_of.find(ref_id);
+      if (it == id_of.end()) {
+        id_of[ref_id] = id;
+      } else if (it->second != id) {
+        switches++;
+        it->second = id;
+      }
+    }
+    extra += faces.size() - matched;
+    for (const auto &f : faces) tracked_jitter.Add(f.id, f.box);
+
+    if (out_file) {
+      std::string line = frame.name + " " + std::to_string(faces.size());
+      char buf[64];
+      for (const auto &f : faces) {
+        snprintf(buf, sizeof(buf), " %d:%d,%d,%d,%d", f.id, f.box.x1,
+                 f.box.y1, f.box.x2, f.box.y2);
+        line += buf;
+      }
+      lines.push_back(line);
+    }
+  }
+
+  float mean_iou = boxes ? static_cast<float>(iou_sum / boxes) : 1.0f;
+  printf("%zu frames, max interval %d\n", frames.size(), config.max_interval);
+  printf("detections    %llu (%.1f%% of frames)\n",
+         static_cast<unsigned long long>(tracker.Detections()),
+         100.0 * tracker.Detections() / frames.size());
+  printf("mean IoU      %.3f against every-frame detection\n", mean_iou);
+  printf("missed boxes  %zu of %zu (IoU < 0.5)\n", missed, boxes);
+  printf("extra tracks  %zu\n", extra);
+  printf("ID switches   %zu (tracks started: %d, every-frame: %d)\n", switches,
+         tracker.TracksStarted(), reference.TracksStarted());
+  printf("jitter        %.2f px tracked, %.2f px raw detections\n",
+         tracked_jitter.Mean(), raw_jitter.Mean());
+
+  if (out_file) {
+    FILE *fp = fopen(out_file, "w");
+    if (!fp) {
+      fprintf(stderr, "cannot write %s\n", out_file);
+      return 2;
+    }
+    for (const auto &line : lines) fprintf(fp, "%s\n", line.c_str());
+    fclose(fp);
+  }
+  return mean_iou < min_iou ? 1 : 0;
+}
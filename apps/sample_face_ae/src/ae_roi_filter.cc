@@ -0,0 +1,133 @@
+#include "ae_roi_filter.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <algorithm>
+
+std::vector<AeRoiWindow> FacesToSensorWindows(
+    const std::vector<face_coordinate> &boxes, int model_w, int model_h,
+    int sensor_w, int sensor_h) {
+  std::vector<AeRoiWindow> windows;
+  for (const auto &b : boxes) {
+    if (windows.size() >= AE_ROI_MAX_WINDOWS) break;
+    int x1 = std::max(b.x1, 0), y1 = std::max(b.y1, 0);
+    int x2 = std::min(b.x2, model_w), y2 = std::min(b.y2, model_h);
+    if (x2 <= x1 || y2 <= y1) continue;
+    AeRoiWindow w;
+    w.x = x1 * sensor_w / model_w;
+    w.y = y1 * sensor_h / model_h;
+    w.w = std::min((x2 - x1) * sensor_w / model_w, sensor_w - w.x);
+    w.h = std::min((y2 - y1) * sensor_h / model_h, sensor_h - w.y);
+    windows.push_back(w);
+  }
+  return windows;
+}
+
+AeRoiFilter::AeRoiFilter(const AeRoiFilterConfig &config) : config_(config) {
+  config_.alpha = std::min(std::max(config_.alpha, 0.01f), 1.0f);
+  if (config_.enter_frames < 1) config_.enter_frames = 1;
+  if (config_.hold_frames < 0) config_.hold_frames = 0;
+  if (config_.min_interval < 1) config_.min_interval = 1;
+}
+
+float AeRoiFilter::Iou(const Track &t, const AeRoiWindow &w) {
+  float ix = std::min(t.x + t.w, static_cast<float>(w.x + w.w)) -
+             std::max(t.x, static_cast<float>(w.x));
+  float iy = std::min(t.y + t.h, static_cast<float>(w.y + w.h)) -
+             std::max(t.y, static_cast<float>(w.y));
+  if (ix <= 0 || iy <= 0) return 0;
+  float inter = ix * iy;
+  return inter / (t.w * t.h + static_cast<float>(w.w) * w.h - inter);
+}
+
+bool AeRoiFilter::Update(const std::vector<AeRoiWindow> &raw) {
+  frames_++;
+  since_apply_++;
+
+  // Greedy IoU matching, best pairs first
+  pairs_.clear();
+  for (size_t t = 0; t < tracks_.size(); t++) {
+    for (size_t r = 0; r < raw.size(); r++) {
+      float iou = Iou(tracks_[t], raw[r]);
+      if (iou >= config_.match_iou) {
+        pairs_.push_back({iou, static_cast<int>(t), static_cast<int>(r)});
+      }
+    }
+  }
+  std::sort(pairs_.begin(), pairs_.end(),
+            [](const Pair &a, const Pair &b) { return a.iou > b.iou; });
+  track_used_.assign(tracks_.size(), 0);
+  raw_used_.assign(raw.size(), 0);
+  const float a = config_.alpha;
+  for (const auto &p : pairs_) {
+    if (track_used_[p.track] || raw_used_[p.raw]) continue;
+    track_used_[p.track] = raw_used_[p.raw] = 1;
+    Track &t = tracks_[p.track];
+    const AeRoiWindow &w = raw[p.raw];
+    t.x += a * (w.x - t.x);
+    t.y += a * (w.y - t.y);
+    t.w += a * (w.w - t.w);
+    t.h += a * (w.h - t.h);
+    t.seen++;
+    t.misses = 0;
+  }
+
+  // Age out lost faces; a face never metered is dropped on its first miss
+  size_t kept = 0;
+  for (size_t i = 0; i < tracks_.size(); i++) {
+    Track &t = tracks_[i];
+    if (!track_used_[i]) {
+      t.misses++;
+      bool metered = t.seen >= config_.enter_frames;
+      if (!metered || t.misses > config_.hold_frames) continue;
+    }
+    tracks_[kept++] = t;
+  }
+  tracks_.resize(kept);
+  for (size_t r = 0; r < raw.size(); r++) {
+    if (raw_used_[r]) continue;
+    tracks_.push_back({static_cast<float>(raw[r].x),
+                       static_cast<float>(raw[r].y),
+                       static_cast<float>(raw[r].w),
+                       static_cast<float>(raw[r].h), 1, 0});
+  }
+
+  metered_.clear();
+  for (const auto &t : tracks_) {
+    if (t.seen < config_.enter_frames) continue;
+    if (metered_.size() >= AE_ROI_MAX_WINDOWS) break;
+    AeRoiWindow w;
+    w.x = static_cast<int>(lroundf(t.x));
+    w.y = static_cast<int>(lroundf(t.y));
+    w.w = static_cast<int>(lroundf(t.w));
+    w.h = static_cast<int>(lroundf(t.h));
+    metered_.push_back(w);
+  }
+
+  if (has_applied_ && !Changed()) {
+    skipped_small_++;
+    return false;
+  }
+  if (has_applied_ && since_apply_ < config_.min_interval) {
+    skipped_rate_++;
+    return false;
+  }
+  applied_ = metered_;
+  has_applied_ = true;
+  since_apply_ = 0;
+  applied_count_++;
+  return true;
+}
+
+bool AeRoiFilter::Changed() const {
+  if (metered_.size() != applied_.size()) return true;
+  for (size_t i = 0; i < metered_.size(); i++) {
+    const AeRoiWindow &m = metered_[i], &p = applied_[i];
+    int moved = std::max(std::max(abs(m.x - p.x), abs(m.y - p.y)),
+                         std::max(abs(m.x + m.w - p.x - p.w),
+                                  abs(m.y + m.h - p.y - p.h)));
+    if (moved >= config_.min_change) return true;
+  }
+  return false;
+}
@@ -1,6 +1,7 @@
 #include "face_ae_roi.h"
 
 #include <algorithm>
+#include <cstdio>
 #include <cstring>
 
 FaceAeRoi::FaceAeRoi(k_isp_dev dev, k_u32 model_w, k_u32 model_h,
@@ -11,51 +12,106 @@ FaceAeRoi::FaceAeRoi(k_isp_dev dev, k_u32 model_w, k_u32 model_h,
       sensor_w_(sensor_w),
       sensor_h_(sensor_h) {}
 
+FaceAeRoi::~FaceAeRoi() {
+  if (!worker_.joinable()) return;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  posted_.notify_one();
+  worker_.join();
+}
+
 void FaceAeRoi::SetEnable(bool enable) {
   kd_mpi_isp_ae_roi_set_enable(dev_, enable ? K_TRUE : K_FALSE);
 }
 
-void FaceAeRoi::Update(const std::vector<face_coordinate>& boxes) {
-  k_isp_ae_roi ae_roi;
-  memset(&ae_roi, 0, sizeof(ae_roi));
+void FaceAeRoi::SetFilter(const AeRoiFilterConfig& config) {
+  filter_.reset(new AeRoiFilter(config));
+}
 
-  auto box_count = std::min<int>(boxes.size(), 8);
-  if (box_count == 0) {
-    ae_roi.roiNum = 0;
-    kd_mpi_isp_ae_set_roi(dev_, ae_roi);
-    return;
-  }
+void FaceAeRoi::StartWorker() {
+  if (worker_.joinable()) return;
+  worker_ = std::thread([this] { WorkerLoop(); });
+}
 
-  ae_roi.roiNum = box_count;
-  k_u32 area[8] = {0};
+void FaceAeRoi::Update(const std::vector<face_coordinate>& boxes) {
+  auto windows = FacesToSensorWindows(boxes, model_w_, model_h_, sensor_w_,
+                                      sensor_h_);
+  if (!filter_) {
+    Apply(windows);
+  } else if (filter_->Update(windows)) {
+    Apply(filter_->Windows());
+  }
+}
 
-  for (int i = 0; i < box_count; i++) {
-    k_u32 x1 = std::max(boxes[i].x1, 0);
-    k_u32 y1 = std::max(boxes[i].y1, 0);
+uint64_t FaceAeRoi::IspUpdates() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return isp_updates_;
+}
 
-    k_u32 h_offset = x1 * sensor_w_ / model_w_;
-    k_u32 v_offset = y1 * sensor_h_ / model_h_;
-    k_u32 w = (static_cast<k_u32>(boxes[i].x2) - x1) * sensor_w_ / model_w_;
-    k_u32 h = (static_cast<k_u32>(boxes[i].y2) - y1) * sensor_h_ / model_h_;
+uint64_t FaceAeRoi::Superseded() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return superseded_;
+}
 
-    w = std::min(w, sensor_w_ - h_offset);
-    h = std::min(h, sensor_h_ - v_offset);
+void FaceAeRoi::PrintStats() const {
+  printf("ae roi: %llu isp updates, %llu superseded\n",
+         static_cast<unsigned long long>(IspUpdates()),
+         static_cast<unsigned long long>(Superseded()));
+  if (filter_) {
+    printf("ae roi filter: %llu of %llu frames applied, %llu below "
+           "min_change, %llu rate limited\n",
+           static_cast<unsigned long long>(filter_->Applied()),
+           static_cast<unsigned long long>(filter_->Frames()),
+           static_cast<unsigned long long>(filter_->SkippedSmall()),
+           static_cast<unsigned long long>(filter_->SkippedRate()));
+  }
+}
 
-    ae_roi.roiWindow[i].window.hOffset = h_offset;
-    ae_roi.roiWindow[i].window.vOffset = v_offset;
-    ae_roi.roiWindow[i].window.width = w;
-    ae_roi.roiWindow[i].window.height = h;
+void FaceAeRoi::Apply(const std::vector<AeRoiWindow>& windows) {
+  k_isp_ae_roi ae_roi;
+  memset(&ae_roi, 0, sizeof(ae_roi));
+  ae_roi.roiNum = windows.size();
 
-    area[i] = w * h;
+  k_u32 sum = 0;
+  for (const auto& w : windows) {
+    sum += w.w * w.h;
+  }
+  for (size_t i = 0; i < windows.size(); i++) {
+    ae_roi.roiWindow[i].window.hOffset = windows[i].x;
+    ae_roi.roiWindow[i].window.vOffset = windows[i].y;
+    ae_roi.roiWindow[i].window.width = windows[i].w;
+    ae_roi.roiWindow[i].window.height = windows[i].h;
+    ae_roi.roiWindow[i].weight =
+        sum ? static_cast<float>(windows[i].w * windows[i].h) / sum : 0.0f;
   }
 
-  k_u32 sum = 0;
-  for (int i = 0; i < box_count; i++) {
-    sum += area[i];
+  if (!worker_.joinable()) {
+    kd_mpi_isp_ae_set_roi(dev_, ae_roi);
+    std::lock_guard<std::mutex> lock(mutex_);
+    isp_updates_++;
+    return;
   }
-  for (int i = 0; i < box_count; i++) {
-    ae_roi.roiWindow[i].weight = static_cast<float>(area[i]) / sum;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (has_pending_) superseded_++;
+    pending_ = ae_roi;
+    has_pending_ = true;
   }
+  posted_.notify_one();
+}
 
-  kd_mpi_isp_ae_set_roi(dev_, ae_roi);
+void FaceAeRoi::WorkerLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    posted_.wait(lock, [this] { return has_pending_ || stop_; });
+    if (!has_pending_) return;
+    k_isp_ae_roi ae_roi = pending_;
+    has_pending_ = false;
+    lock.unlock();
+    kd_mpi_isp_ae_set_roi(dev_, ae_roi);
+    lock.lock();
+    isp_updates_++;
+  }
 }
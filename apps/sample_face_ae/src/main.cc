@@ -4,10 +4,13 @@
 #include <chrono>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <thread>
 
 #include "face_ae_roi.h"
+#include "frame_registry.h"
 #include "mobile_retinaface.h"
+#include "motion_gate.h"
 #include "mpi_sys_api.h"
 
 using namespace nncase;
@@ -49,6 +52,10 @@ using namespace nncase::runtime::detail;
 #define ISP_CHN1_WIDTH (1280)
 #define ISP_CHN0_WIDTH (1920)
 #define ISP_CHN0_HEIGHT (1080)
+// The AI2D input pool; NOCACHE lets the registry skip the per-frame sync
+#define CHN1_POOL_MODE VB_REMAP_MODE_NOCACHE
+// Mapped chn1 buffers kept by the frame registry (the pool has 5 blocks)
+#define FRAME_REGISTRY_CAPACITY 8
 
 #define ISP_INPUT_WIDTH (1920)
 #define ISP_INPUT_HEIGHT (1080)
@@ -212,6 +219,20 @@ int sample_sys_bind_init(void) {
   return ret;
 }
 
+// Maps VB blocks for the frame registry. The chn1 pool is NOCACHE and
+// kd_mpi_sys_mmap returns an uncached mapping, so frames never need a cache
+// write-back before AI2D reads them.
+class VbFrameMapper : public FrameMapper {
+ public:
+  void *Map(uint64_t paddr, size_t size) override {
+    ScopedTiming st(Stage::kMmap);
+    return kd_mpi_sys_mmap(paddr, size);
+  }
+  void Unmap(void *vaddr, size_t size) override {
+    kd_mpi_sys_munmap(vaddr, size);
+  }
+};
+
 int sample_vb_init(void) {
   k_s32 ret;
   k_vb_config config;
@@ -225,7 +246,7 @@ int sample_vb_init(void) {
 
   // VB for RGB888 output
   config.comm_pool[1].blk_cnt = 5;
-  config.comm_pool[1].mode = VB_REMAP_MODE_NOCACHE;
+  config.comm_pool[1].mode = CHN1_POOL_MODE;
   config.comm_pool[1].blk_size =
       VICAP_ALIGN_UP((ISP_CHN1_HEIGHT * ISP_CHN1_WIDTH * 3), VICAP_ALIGN_1K);
 
@@ -364,10 +385,17 @@ int main(int argc, char *argv[]) {
   k_u32 display_ms = 1000 / 33;
   int face_count = 1;
   int ret;
-  if (argc != 3) {
-    std::cerr << "Usage: " << argv[0] << " <kmodel> <roi_enable>" << std::endl;
+  if (argc != 3 && argc != 4) {
+    std::cerr << "Usage: " << argv[0] << " <kmodel> <roi_enable> [still_frames]"
+              << std::endl;
+    std::cerr << "  roi_enable: 0=disable, 1=enable, 2=enable with smoothed,"
+              << " rate-limited updates from a worker thread" << std::endl;
+    std::cerr << "  still_frames: reuse the last result while the scene is"
+              << " static, for at most this many frames (default 0 = off)"
+              << std::endl;
     return -1;
   }
+  int motion_stale = argc == 4 ? atoi(argv[3]) : 0;
   /****fixed operation for ctrl+c****/
   struct sigaction sa;
   memset(&sa, 0, sizeof(sa));
@@ -375,6 +403,9 @@ int main(int argc, char *argv[]) {
   sigfillset(&sa.sa_mask);
   sigaction(SIGINT, &sa, nullptr);
 
+  // SIGUSR1 prints per-stage latency, SIGUSR2 toggles recording
+  StageProfiler::Get().StartReporter(0);
+
   pthread_t vo_thread_handle;
   pthread_t exit_thread_handle;
   pthread_create(&exit_thread_handle, nullptr, exit_app, nullptr);
@@ -383,6 +414,7 @@ int main(int argc, char *argv[]) {
   ;
 
   MobileRetinaface model(argv[1], CHANNEL, ISP_CHN1_HEIGHT, ISP_CHN1_WIDTH);
+  model.PrintStartup();
   DetectResult box_result;
   std::vector<face_coordinate> boxes;
 
@@ -402,57 +434,111 @@ int main(int argc, char *argv[]) {
     FaceAeRoi face_ae_roi(static_cast<k_isp_dev>(vicap_dev), ISP_CHN1_WIDTH,
                           ISP_CHN1_HEIGHT, sensor_info.width,
                           sensor_info.height);
-    face_ae_roi.SetEnable(atoi(argv[2]) == 1);
+    const int ae_roi_mode = atoi(argv[2]);
+    face_ae_roi.SetEnable(ae_roi_mode >= 1);
+    if (ae_roi_mode == 2) {
+      face_ae_roi.SetFilter(AeRoiFilterConfig());
+      face_ae_roi.StartWorker();
+    }
+
+    VbFrameMapper mapper;
+    FrameRegistry<nr::runtime_tensor> frames(
+        mapper, size, FRAME_REGISTRY_CAPACITY,
+        [&](void *vaddr, uint64_t paddr) {
+          return model.WrapInput(reinterpret_cast<uintptr_t>(vaddr), paddr);
+        });
+    const bool sync_input = CHN1_POOL_MODE != VB_REMAP_MODE_NOCACHE;
+
+    std::unique_ptr<MotionGate> motion_gate;
+    if (motion_stale > 0) {
+      MotionGateConfig config;
+      config.max_stale = motion_stale;
+      motion_gate.reset(
+          new MotionGate(ISP_CHN1_WIDTH, ISP_CHN1_HEIGHT, config));
+    }
 
     while (app_run) {
       memset(&dump_info, 0, sizeof(k_video_frame_info));
-      ret = kd_mpi_vicap_dump_frame(vicap_dev, VICAP_CHN_ID_1, VICAP_DUMP_YUV,
-                                    &dump_info, 1000);
+      {
+        ScopedTiming st(Stage::kDumpFrame);
+        ret = kd_mpi_vicap_dump_frame(vicap_dev, VICAP_CHN_ID_1,
+                                      VICAP_DUMP_YUV, &dump_info, 1000);
+      }
       if (ret) {
+        StageProfiler::Get().Count(Counter::kDumpErrors);
         quit.store(false);
         printf("sample_vicap...kd_mpi_vicap_dump_frame failed.\n");
         break;
       }
 
-      auto vbvaddr = kd_mpi_sys_mmap(dump_info.v_frame.phys_addr[0], size);
-      boxes.clear();
-      // run kpu
-      model.Run(reinterpret_cast<uintptr_t>(vbvaddr),
-                reinterpret_cast<uintptr_t>(dump_info.v_frame.phys_addr[0]));
-      kd_mpi_sys_munmap(vbvaddr, size);
-      // get face boxes
-      box_result = model.GetResult();
-      boxes = box_result.boxes;
-
-      if (boxes.size() < face_count) {
-        for (size_t i = boxes.size(); i < face_count; i++) {
-          vo_frame.draw_en = 0;
-          vo_frame.frame_num = i + 1;
-          kd_mpi_vo_draw_frame(&vo_frame);
-        }
+      auto &buf = frames.Acquire(dump_info.v_frame.phys_addr[0]);
+      bool still = false;
+      if (motion_gate) {
+        ScopedTiming st(Stage::kMotion);
+        still = !motion_gate->Check(static_cast<const uint8_t *>(buf.vaddr));
       }
+      if (!still) {
+        boxes.clear();
+        // run kpu
+        model.Run(buf.payload, sync_input);
+        // get face boxes
+        box_result = model.GetResult();
+        boxes = box_result.boxes;
+      }
+
+      StageProfiler::Get().Count(Counter::kFrames);
+      StageProfiler::Get().Count(Counter::kDetections, boxes.size());
+
+      {
+        ScopedTiming st(Stage::kVoDraw);
+        if (boxes.size() < face_count) {
+          for (size_t i = boxes.size(); i < face_count; i++) {
+            vo_frame.draw_en = 0;
+            vo_frame.frame_num = i + 1;
+            kd_mpi_vo_draw_frame(&vo_frame);
+          }
+        }
 
-      for (size_t i = 0, j = 0; i < boxes.size(); i += 1) {
-        vo_frame.draw_en = 1;
-        vo_frame.line_x_start = static_cast<uint32_t>(boxes[i].x1) *
+        for (size_t i = 0, j = 0; i < boxes.size(); i += 1) {
+          vo_frame.draw_en = 1;
+          vo_frame.line_x_start = static_cast<uint32_t>(boxes[i].x1) *
+                                  ISP_CHN0_WIDTH / ISP_CHN1_WIDTH;
+          vo_frame.line_y_start = static_cast<uint32_t>(boxes[i].y1) *
+                                  ISP_CHN0_HEIGHT / ISP_CHN1_HEIGHT;
+          vo_frame.line_x_end = static_cast<uint32_t>(boxes[i].x2) *
                                 ISP_CHN0_WIDTH / ISP_CHN1_WIDTH;
-        vo_frame.line_y_start = static_cast<uint32_t>(boxes[i].y1) *
+          vo_frame.line_y_end = static_cast<uint32_t>(boxes[i].y2) *
                                 ISP_CHN0_HEIGHT / ISP_CHN1_HEIGHT;
-        vo_frame.line_x_end = static_cast<uint32_t>(boxes[i].x2) *
-                              ISP_CHN0_WIDTH / ISP_CHN1_WIDTH;
-        vo_frame.line_y_end = static_cast<uint32_t>(boxes[i].y2) *
-                              ISP_CHN0_HEIGHT / ISP_CHN1_HEIGHT;
-        vo_frame.frame_num = ++j;
-        kd_mpi_vo_draw_frame(&vo_frame);
+          vo_frame.frame_num = ++j;
+          kd_mpi_vo_draw_frame(&vo_frame);
+        }
       }
       face_count = boxes.size();
 
-      face_ae_roi.Update(boxes);
+      {
+        ScopedTiming st(Stage::kAeRoi);
+        face_ae_roi.Update(boxes);
+      }
       ret = kd_mpi_vicap_dump_release(vicap_dev, VICAP_CHN_ID_1, &dump_info);
       if (ret) {
         printf("sample_vicap...kd_mpi_vicap_dump_release failed.\n");
       }
     }
+    if (motion_gate) {
+      printf("motion gate: inferred %llu of %llu frames\n",
+             static_cast<unsigned long long>(motion_gate->Inferred()),
+             static_cast<unsigned long long>(motion_gate->Frames()));
+    }
+    if (ae_roi_mode == 2) {
+      face_ae_roi.PrintStats();
+    }
+    printf("frame registry: %zu buffers, %llu hits, %llu misses\n",
+           frames.Size(), static_cast<unsigned long long>(frames.Hits()),
+           static_cast<unsigned long long>(frames.Misses()));
+    StageProfiler::Get().StopReporter();
+    if (StageProfiler::Get().Enabled()) {
+      StageProfiler::Get().Dump(stdout);
+    }
   }
 
 app_exit:
@@ -1,6 +1,7 @@
 #include "mobile_retinaface.h"
 
 #include <chrono>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
 
@@ -15,8 +16,10 @@ using namespace nncase::F::k230;
 #define LOC_SIZE 4
 #define CONF_SIZE 2
 #define LAND_SIZE 10
+// loc/landms ranges closer than this are invalidated as one, so a cluster
+// of anchors costs one call per channel plane rather than one per anchor
+#define INVALIDATE_GAP 256
 
-extern float anchors320[4200][4];
 typedef int (*__compar_fn_t)(__const void*, __const void*);
 static float umeyama_args[] = {76.5892,  103.3926, 147.0636, 103.0028,
                                112.0504, 143.4732, 83.0986,  184.731,
@@ -32,7 +35,7 @@ MobileRetinaface::MobileRetinaface(const char* kmodel_file, size_t channel,
   ai2d_out_tensor_ = InputTensor(0);
 
   // ai2d config
-  dims_t in_shape{1, ai2d_input_c_, ai2d_input_h_, ai2d_input_w_};
+  ai2d_in_shape_ = {1, ai2d_input_c_, ai2d_input_h_, ai2d_input_w_};
   auto out_shape = InputShape(0);
 
   ai2d_datatype_t ai2d_dtype{ai2d_format::NCHW_FMT, ai2d_format::NCHW_FMT,
@@ -50,45 +53,44 @@ MobileRetinaface::MobileRetinaface(const char* kmodel_file, size_t channel,
   int w_pad_after = w_pad - w_pad_before;
 
   ai2d_pad_param_t pad_param{true,
-                             {{0, 0}, {0, 0}, {70, 70}, {0, 0}},
+                             {{0, 0},
+                              {0, 0},
+                              {h_pad_before, h_pad_after},
+                              {w_pad_before, w_pad_after}},
                              ai2d_pad_mode::constant,
                              {0, 0, 0}};
   ai2d_resize_param_t resize_param{true, ai2d_interp_method::tf_bilinear,
                                    ai2d_interp_mode::half_pixel};
   ai2d_affine_param_t affine_param{false};
-  ai2d_builder_.reset(new ai2d_builder(in_shape, out_shape, ai2d_dtype,
+  ai2d_builder_.reset(new ai2d_builder(ai2d_in_shape_, out_shape, ai2d_dtype,
                                        crop_param, shift_param, pad_param,
                                        resize_param, affine_param));
-  ai2d_builder_->build_schedule();
+  BuildAi2dSchedule();
+
+  // Decode is sized for the heads of a 320x320 input (MIN_SIZE)
+  int model_h = static_cast<int>(out_shape[2]);
+  int model_w = static_cast<int>(out_shape[3]);
+  if (RetinafaceAnchorCount(model_h, model_w) != MIN_SIZE * (1 + 4 + 16)) {
+    std::cerr << "kmodel input " << model_h << "x" << model_w
+              << " does not match the RetinaFace heads Decode expects"
+              << std::endl;
+    std::abort();
+  }
+  anchors_ = RetinafaceAnchors(model_h, model_w, anchor_storage_);
 }
 
 MobileRetinaface::~MobileRetinaface() {}
 
-void MobileRetinaface::Preprocess(uintptr_t vaddr, uintptr_t paddr) {
-#if ENABLE_PROFILING
-  ScopedTiming st(ModelName() + " " + __FUNCTION__);
-#endif
-
-  // ai2d input tensor
-  dims_t in_shape{1, ai2d_input_c_, ai2d_input_h_, ai2d_input_w_};
-  auto ai2d_in_tensor =
-      host_runtime_tensor::create(
-          typecode_t::dt_uint8, in_shape,
-          {reinterpret_cast<gsl::byte*>(vaddr), compute_size(in_shape)}, false,
-          hrt::pool_shared, paddr)
-          .expect("cannot create input tensor");
-  hrt::sync(ai2d_in_tensor, sync_op_t::sync_write_back, true)
-      .expect("sync write_back failed");
+void MobileRetinaface::Preprocess(runtime_tensor &input) {
+  ScopedTiming st(Stage::kAi2d);
 
   // run ai2d
-  ai2d_builder_->invoke(ai2d_in_tensor, ai2d_out_tensor_)
+  ai2d_builder_->invoke(input, ai2d_out_tensor_)
       .expect("error occurred in ai2d running");
 }
 
 void MobileRetinaface::Postprocess() {
-#if ENABLE_PROFILING
-  ScopedTiming st(ModelName() + " " + __FUNCTION__);
-#endif
+  ScopedTiming st(Stage::kDecode);
 
   std::vector<box_t> pred_box;
   pred_box.reserve(16);
@@ -191,11 +193,13 @@ float MobileRetinaface::BoxIou(box_t a, box_t b) {
   return BoxIntersection(a, b) / BoxUnion(a, b);
 }
 
-void MobileRetinaface::DealConfOpt(float* conf, float* s_probs, int* s,
+void MobileRetinaface::DealConfOpt(const float* conf, float* s_probs, int* s,
                                    int size, int* obj_cnt, int* real_count,
                                    float* tmp) {
-  softmax_2group_vec(size, conf, conf + size, tmp, tmp + size);  //
-  softmax_2group_vec(size, conf + 2 * size, conf + 3 * size, tmp + 2 * size,
+  // conf is the mapped KPU output; softmax_2group_vec only reads it
+  float* in = const_cast<float*>(conf);
+  softmax_2group_vec(size, in, in + size, tmp, tmp + size);  //
+  softmax_2group_vec(size, in + 2 * size, in + 3 * size, tmp + 2 * size,
                      tmp + 3 * size);
   register int cnt = *obj_cnt;
   register int index_s = *real_count;
@@ -221,7 +225,7 @@ void MobileRetinaface::DealConfOpt(float* conf, float* s_probs, int* s,
   *real_count = index_s;
 }
 
-void MobileRetinaface::DealLocOpt(float* loc, float* boxes, int size,
+void MobileRetinaface::DealLocOpt(const float* loc, float* boxes, int size,
                                   int* obj_cnt, int* s, int* real_count) {
   register int cnt = *obj_cnt;
   register int index_s = *real_count;
@@ -241,8 +245,9 @@ void MobileRetinaface::DealLocOpt(float* loc, float* boxes, int size,
   *real_count = index_s;
 }
 
-void MobileRetinaface::DealLandmsOpt(float* landms, float* landmarks, int size,
-                                     int* obj_cnt, int* s, int* real_count) {
+void MobileRetinaface::DealLandmsOpt(const float* landms, float* landmarks,
+                                     int size, int* obj_cnt, int* s,
+                                     int* real_count) {
   register int cnt = *obj_cnt;
   register int index_s = *real_count;
   for (uint32_t ww = 0; ww < size; ww++) {
@@ -261,37 +266,72 @@ void MobileRetinaface::DealLandmsOpt(float* landms, float* landmarks, int size,
   *real_count = index_s;
 }
 
+// Invalidates the loc/landms values DealLocOpt and DealLandmsOpt read for
+// the `count` candidates in s, which are in anchor order. Strides without
+// a candidate are not touched.
+void MobileRetinaface::InvalidateCandidates(const int* s, int count) {
+  const int sizes[3] = {16 * MIN_SIZE / 2, 4 * MIN_SIZE / 2, 1 * MIN_SIZE / 2};
+  const int channels[2] = {LOC_SIZE, LAND_SIZE};
+  int first = 0, anchor_base = 0;
+  for (int h = 0; h < 3; h++) {
+    const int size = sizes[h];
+    const int anchor_end = anchor_base + size * 2;
+    int last = first;
+    while (last < count && s[last] < anchor_end) last++;
+
+    for (int k = 0; first < last && k < 2; k++) {
+      const int output = k == 0 ? h : 6 + h;
+      size_t begin = 0, end = 0;
+      bool open = false;
+      auto add = [&](size_t b, size_t e) {
+        if (open && b <= end + INVALIDATE_GAP) {
+          end = e > end ? e : end;
+          return;
+        }
+        if (open) InvalidateOutput(output, begin, end - begin);
+        begin = b;
+        end = e;
+        open = true;
+      };
+      for (int hh = 0; hh < 2; hh++) {
+        for (int c = 0; c < channels[k]; c++) {
+          const size_t plane =
+              static_cast<size_t>(hh * channels[k] + c) * size * sizeof(float);
+          for (int i = first; i < last; i++) {
+            const int local = s[i] - anchor_base;
+            if (local % 2 != hh) continue;
+            const size_t cell = local / 2 * sizeof(float);
+            add(plane + cell, plane + cell + sizeof(float));
+          }
+        }
+      }
+      if (open) InvalidateOutput(output, begin, end - begin);
+    }
+    first = last;
+    anchor_base = anchor_end;
+  }
+}
+
 box_t MobileRetinaface::GetBoxOpt(float* boxes, int obj_index,
                                   int index_anchors) {
-  float x, y, w, h;
-  x = boxes[obj_index * LOC_SIZE + 0];
-  y = boxes[obj_index * LOC_SIZE + 1];
-  w = boxes[obj_index * LOC_SIZE + 2];
-  h = boxes[obj_index * LOC_SIZE + 3];
-  x = anchors320[index_anchors][0] + x * 0.1 * anchors320[index_anchors][2];
-  y = anchors320[index_anchors][1] + y * 0.1 * anchors320[index_anchors][3];
-  w = anchors320[index_anchors][2] * k230_expf(w * 0.2);
-  h = anchors320[index_anchors][3] * k230_expf(h * 0.2);
+  const RetinafaceAnchor& anchor = anchors_[index_anchors];
+  const float* loc = boxes + obj_index * LOC_SIZE;
   box_t box;
-  box.x = x;
-  box.y = y;
-  box.w = w;
-  box.h = h;
+  box.x = anchor.cx + loc[0] * anchor.vw;
+  box.y = anchor.cy + loc[1] * anchor.vh;
+  box.w = anchor.w * k230_expf(loc[2] * 0.2f);
+  box.h = anchor.h * k230_expf(loc[3] * 0.2f);
   return box;
 }
 
 landmarks_t MobileRetinaface::GetLandmarkOpt(float* landmarks, int obj_index,
                                              int index_anchors) {
+  const RetinafaceAnchor& anchor = anchors_[index_anchors];
+  const float* landms = landmarks + obj_index * LAND_SIZE;
   landmarks_t landmark;
   for (uint32_t ll = 0; ll < 5; ll++) {
-    landmark.points[2 * ll + 0] =
-        anchors320[index_anchors][0] +
-        landmarks[obj_index * LAND_SIZE + 2 * ll + 0] * 0.1 *
-            anchors320[index_anchors][2];
-    landmark.points[2 * ll + 1] =
-        anchors320[index_anchors][1] +
-        landmarks[obj_index * LAND_SIZE + 2 * ll + 1] * 0.1 *
-            anchors320[index_anchors][3];
+    landmark.points[2 * ll + 0] = anchor.cx + landms[2 * ll + 0] * anchor.vw;
+    landmark.points[2 * ll + 1] = anchor.cy + landms[2 * ll + 1] * anchor.vh;
   }
   return landmark;
 }
@@ -312,30 +352,22 @@ int nms_comparator2(void* pa, void* pb) {
 void MobileRetinaface::Decode(std::vector<box_t>& pred_box,
                               std::vector<landmarks_t>& pred_landmarks) {
   const size_t size = 9;
-  float* out[size];
+  const float* out[size];
+  // conf is read in full, loc/landms only at the candidates below
+  for (size_t i = 3; i < 6; i++) InvalidateOutput(i, 0, OutputBytes(i));
   for (size_t i = 0; i < size; i++) {
-    auto tensor = OutputTensor(i);
-    auto buf = tensor.impl()
-                   ->to_host()
-                   .unwrap()
-                   ->buffer()
-                   .as_host()
-                   .unwrap()
-                   .map(map_access_::map_read)
-                   .unwrap()
-                   .buffer();
-    out[i] = reinterpret_cast<float*>(buf.data());
+    out[i] = static_cast<const float*>(OutputData(i));
   }
 
-  float* loc0 = out[0];
-  float* loc1 = out[1];
-  float* loc2 = out[2];
-  float* conf0 = out[3];
-  float* conf1 = out[4];
-  float* conf2 = out[5];
-  float* landms0 = out[6];
-  float* landms1 = out[7];
-  float* landms2 = out[8];
+  const float* loc0 = out[0];
+  const float* loc1 = out[1];
+  const float* loc2 = out[2];
+  const float* conf0 = out[3];
+  const float* conf1 = out[4];
+  const float* conf2 = out[5];
+  const float* landms0 = out[6];
+  const float* landms1 = out[7];
+  const float* landms2 = out[8];
 
   int objs_num = MIN_SIZE * (1 + 4 + 16);
   int* s = static_cast<int*>(malloc(objs_num * sizeof(int)));
@@ -350,6 +382,7 @@ void MobileRetinaface::Decode(std::vector<box_t>& pred_box,
   DealConfOpt(conf0, s_probs, s, 16 * MIN_SIZE / 2, &obj_cnt, &real_count, tmp);
   DealConfOpt(conf1, s_probs, s, 4 * MIN_SIZE / 2, &obj_cnt, &real_count, tmp);
   DealConfOpt(conf2, s_probs, s, 1 * MIN_SIZE / 2, &obj_cnt, &real_count, tmp);
+  InvalidateCandidates(s, real_count);
 
   float* boxes =
       static_cast<float*>(malloc(objs_num * LOC_SIZE * sizeof(float)));
@@ -376,22 +409,25 @@ void MobileRetinaface::Decode(std::vector<box_t>& pred_box,
   for (int i = 0; i < objs_num; ++i) {
     s_int[i] = i;
   }
-  qsort(s_int, objs_num, sizeof(int),
-        reinterpret_cast<__compar_fn_t>(nms_comparator2));
+  {
+    ScopedTiming st(Stage::kNms);
+    qsort(s_int, objs_num, sizeof(int),
+          reinterpret_cast<__compar_fn_t>(nms_comparator2));
 
-  for (int i = 0; i < objs_num; ++i) {
-    int obj_index = s_int[i];
-    if (s_probs[obj_index] < obj_threshold_) continue;
-    box_t a = GetBoxOpt(boxes, obj_index, s[obj_index]);
-    pred_box.push_back(a);
-
-    landmarks_t l = GetLandmarkOpt(landmarks, obj_index, s[obj_index]);
-    pred_landmarks.push_back(l);
-    for (int j = i + 1; j < objs_num; ++j) {
-      obj_index = s_int[j];
+    for (int i = 0; i < objs_num; ++i) {
+      int obj_index = s_int[i];
       if (s_probs[obj_index] < obj_threshold_) continue;
-      box_t b = GetBoxOpt(boxes, obj_index, s[obj_index]);
-      if (BoxIou(a, b) >= nms_threshold_) s_probs[obj_index] = 0;
+      box_t a = GetBoxOpt(boxes, obj_index, s[obj_index]);
+      pred_box.push_back(a);
+
+      landmarks_t l = GetLandmarkOpt(landmarks, obj_index, s[obj_index]);
+      pred_landmarks.push_back(l);
+      for (int j = i + 1; j < objs_num; ++j) {
+        obj_index = s_int[j];
+        if (s_probs[obj_index] < obj_threshold_) continue;
+        box_t b = GetBoxOpt(boxes, obj_index, s[obj_index]);
+        if (BoxIou(a, b) >= nms_threshold_) s_probs[obj_index] = 0;
+      }
     }
   }
 
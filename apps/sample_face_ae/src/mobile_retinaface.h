@@ -2,6 +2,7 @@
 #define _MOBILE_RETINAFACE_H
 #include "k230_math.h"
 #include "model.h"
+#include "retinaface_anchors.h"
 #include "rvv_math.h"
 #include "util.h"
 
@@ -18,7 +19,7 @@ class MobileRetinaface : public Model {
   DetectResult GetResult() const { return result_; }
 
  protected:
-  void Preprocess(uintptr_t vaddr, uintptr_t paddr);
+  void Preprocess(nr::runtime_tensor &input);
   void Postprocess();
 
  private:
@@ -28,12 +29,13 @@ class MobileRetinaface : public Model {
   float BoxIntersection(box_t a, box_t b);
   float BoxUnion(box_t a, box_t b);
   float BoxIou(box_t a, box_t b);
-  void DealConfOpt(float *conf, float *s_probs, int *s, int size, int *obj_cnt,
-                   int *real_count, float *tmp);
-  void DealLocOpt(float *loc, float *boxes, int size, int *obj_cnt, int *s,
-                  int *real_count);
-  void DealLandmsOpt(float *landms, float *landmarks, int size, int *obj_cnt,
-                     int *s, int *real_count);
+  void DealConfOpt(const float *conf, float *s_probs, int *s, int size,
+                   int *obj_cnt, int *real_count, float *tmp);
+  void DealLocOpt(const float *loc, float *boxes, int size, int *obj_cnt,
+                  int *s, int *real_count);
+  void DealLandmsOpt(const float *landms, float *landmarks, int size,
+                     int *obj_cnt, int *s, int *real_count);
+  void InvalidateCandidates(const int *s, int count);
   box_t GetBoxOpt(float *boxes, int obj_index, int index_anchors);
   landmarks_t GetLandmarkOpt(float *landmarks, int obj_index,
                              int index_anchors);
@@ -44,6 +46,8 @@ class MobileRetinaface : public Model {
   size_t ai2d_input_w_;
   float obj_threshold_ = 0.6f;
   float nms_threshold_ = 0.5f;
+  const RetinafaceAnchor *anchors_;
+  std::vector<RetinafaceAnchor> anchor_storage_;  // for non-tabulated sizes
   DetectResult result_;
 };
 
@@ -10,31 +10,108 @@
 namespace nr = nncase::runtime;
 namespace nfk = nncase::F::k230;
 
+// Time spent in each startup step of a Model, in microseconds.
+struct ModelStartup {
+  uint64_t load_us = 0;     // kmodel mapped or read, and parsed
+  uint64_t tensors_us = 0;  // tensors of every slot created and mapped
+  uint64_t ai2d_us = 0;     // AI2D schedules built by the subclass
+  size_t kmodel_bytes = 0;
+  bool mapped = false;  // false if the kmodel was read into a buffer
+};
+
 class Model {
  public:
-  Model(const char *model_name, const char *kmodel_file);
+  Model(const char *model_name, const char *kmodel_file, size_t slots = 1);
   ~Model();
   void Run(uintptr_t vaddr, uintptr_t paddr);
+  void Run(nr::runtime_tensor &input, bool sync);
   std::string ModelName() const;
+  const ModelStartup &Startup() const { return startup_; }
+  void PrintStartup() const;
+
+  // Stage-level API over a ring of input/output tensor sets. Slot k can be
+  // preprocessed while slot k-1 is on the KPU and slot k-2 is being
+  // postprocessed; each stage must be driven from a single thread.
+  size_t Slots() const { return slots_.size(); }
+  void RunPreprocess(size_t slot, uintptr_t vaddr, uintptr_t paddr);
+  // Same as above for an input wrapped once with WrapInput and reused for
+  // every frame in that buffer. `sync` writes back the CPU cache first; it
+  // can be skipped for buffers mapped from a NOCACHE VB pool.
+  void RunPreprocess(size_t slot, nr::runtime_tensor &input, bool sync);
+  // Wraps a frame buffer as an AI2D input tensor without copying it.
+  nr::runtime_tensor WrapInput(uintptr_t vaddr, uintptr_t paddr) const;
+  void RunKpu(size_t slot);
+  void RunPostprocess(size_t slot);
 
  protected:
-  virtual void Preprocess(uintptr_t vaddr, uintptr_t paddr) = 0;
+  virtual void Preprocess(nr::runtime_tensor &input) = 0;
   void KpuRun();
   virtual void Postprocess() = 0;
   nr::runtime_tensor InputTensor(size_t idx);
   void InputTensor(size_t idx, nr::runtime_tensor &tensor);
   nr::runtime_tensor OutputTensor(size_t idx);
+  // The output buffers of every slot are mapped once at load. Before
+  // reading OutputData, Postprocess invalidates what it reads so the CPU
+  // sees what the KPU wrote: bytes [offset, offset + bytes) of output idx,
+  // widened to whole cache lines, or every output in full. The time of all
+  // calls of a frame is recorded as one kMapOutputs sample.
+  void InvalidateOutput(size_t idx, size_t offset, size_t bytes);
+  void InvalidateOutputs();
+  const void *OutputData(size_t idx) const;
+  size_t OutputBytes(size_t idx) const;
+  // Builds ai2d_builder_'s schedule and adds the time to Startup().
+  void BuildAi2dSchedule();
   nncase::dims_t InputShape(size_t idx);
   nncase::dims_t OutputShape(size_t idx);
 
  protected:
   std::unique_ptr<nfk::ai2d_builder> ai2d_builder_;
-  nr::runtime_tensor ai2d_in_tensor_;
+  nncase::dims_t ai2d_in_shape_;  // set by the subclass constructor
   nr::runtime_tensor ai2d_out_tensor_;
 
  private:
+  struct OutputView {
+    nr::mapped_buffer map;  // unmapped when the model is destroyed
+    void *data;
+    size_t bytes;
+    uintptr_t paddr;  // 0 if the buffer has no physical address
+    bool synced;      // without paddr: synced in full for this frame
+  };
+  // The kmodel file, mapped read-only, or read into a page-aligned buffer
+  // where the file system cannot map it. The interpreter keeps pointers
+  // into it instead of a copy, so it must outlive interp_.
+  class KmodelImage {
+   public:
+    KmodelImage() = default;
+    KmodelImage(const KmodelImage &) = delete;
+    KmodelImage &operator=(const KmodelImage &) = delete;
+    ~KmodelImage();
+    bool Load(const char *path);
+    const uint8_t *Data() const { return data_; }
+    size_t Size() const { return size_; }
+    bool Mapped() const { return map_ != nullptr; }
+
+   private:
+    const uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+    void *map_ = nullptr;
+    void *buffer_ = nullptr;
+  };
+  struct TensorSlot {
+    std::vector<nr::runtime_tensor> inputs;
+    std::vector<nr::runtime_tensor> outputs;
+    std::vector<OutputView> views;  // one per output
+  };
+  void BindSlot(size_t slot);
+  void MapOutputs(TensorSlot &slot);
+
+  KmodelImage kmodel_;  // declared before interp_, destroyed after it
   nr::interpreter interp_;
   std::string model_name_;
-  std::vector<uint8_t> kmodel_;
+  ModelStartup startup_;
+  std::vector<TensorSlot> slots_;
+  size_t bound_slot_ = static_cast<size_t>(-1);
+  size_t post_slot_ = 0;
+  uint64_t invalidate_us_ = 0;  // InvalidateOutput time of this frame
 };
 #endif
@@ -0,0 +1,107 @@
+#include "motion_gate.h"
+
+#include <algorithm>
+
+#if defined(__riscv_v_intrinsic) && __riscv_v_intrinsic >= 12000
+#include <riscv_vector.h>
+#define MOTION_GATE_RVV 1
+#endif
+
+// Samples per thumbnail pixel along each axis
+#define SAMPLES 4
+
+// acc[i] += src[i * stride] for i < n
+static void AccumulateStrided(const uint8_t *src, ptrdiff_t stride, int n,
+                              uint16_t *acc) {
+#if defined(MOTION_GATE_RVV)
+  for (int i = 0; i < n;) {
+    size_t vl = __riscv_vsetvl_e8m1(n - i);
+    vuint8m1_t v = __riscv_vlse8_v_u8m1(src + i * stride, stride, vl);
+    vuint16m2_t a = __riscv_vle16_v_u16m2(acc + i, vl);
+    __riscv_vse16_v_u16m2(acc + i, __riscv_vwaddu_wv_u16m2(a, v, vl), vl);
+    i += static_cast<int>(vl);
+  }
+#else
+  for (int i = 0; i < n; i++) acc[i] += src[i * stride];
+#endif
+}
+
+// Number of i < n with |a[i] - b[i]| > threshold
+static int CountChanged(const uint8_t *a, const uint8_t *b, int n,
+                        int threshold) {
+#if defined(MOTION_GATE_RVV)
+  int count = 0;
+  for (int i = 0; i < n;) {
+    size_t vl = __riscv_vsetvl_e8m4(n - i);
+    vuint8m4_t va = __riscv_vle8_v_u8m4(a + i, vl);
+    vuint8m4_t vb = __riscv_vle8_v_u8m4(b + i, vl);
+    vuint8m4_t d = __riscv_vsub_vv_u8m4(__riscv_vmaxu_vv_u8m4(va, vb, vl),
+                                        __riscv_vminu_vv_u8m4(va, vb, vl), vl);
+    vbool2_t moved =
+        __riscv_vmsgtu_vx_u8m4_b2(d, static_cast<uint8_t>(threshold), vl);
+    count += static_cast<int>(__riscv_vcpop_m_b2(moved, vl));
+    i += static_cast<int>(vl);
+  }
+  return count;
+#else
+  int count = 0;
+  for (int i = 0; i < n; i++) {
+    int d = a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+    count += d > threshold;
+  }
+  return count;
+#endif
+}
+
+MotionGate::MotionGate(int frame_w, int frame_h,
+                       const MotionGateConfig &config)
+    : frame_w_(frame_w), frame_h_(frame_h), config_(config) {
+  if (config_.cell < SAMPLES) config_.cell = SAMPLES;
+  if (config_.max_stale < 1) config_.max_stale = 1;
+  thumb_w_ = std::max(frame_w_ / config_.cell, 1);
+  thumb_h_ = std::max(frame_h_ / config_.cell, 1);
+  current_.resize(thumb_w_ * thumb_h_);
+  reference_.resize(thumb_w_ * thumb_h_);
+  acc_.resize(thumb_w_);
+}
+
+void MotionGate::MakeThumbnail(const uint8_t *frame, uint8_t *thumb) {
+  // green plane; SAMPLES x SAMPLES points spread evenly over each cell
+  const uint8_t *g = frame + static_cast<size_t>(frame_w_) * frame_h_;
+  const int step = config_.cell / SAMPLES;
+  const int first = step / 2;
+  for (int ty = 0; ty < thumb_h_; ty++) {
+    std::fill(acc_.begin(), acc_.end(), 0);
+    for (int sy = 0; sy < SAMPLES; sy++) {
+      int y = ty * config_.cell + first + sy * step;
+      const uint8_t *row = g + static_cast<size_t>(y) * frame_w_;
+      for (int sx = 0; sx < SAMPLES; sx++) {
+        AccumulateStrided(row + first + sx * step, config_.cell, thumb_w_,
+                          acc_.data());
+      }
+    }
+    for (int tx = 0; tx < thumb_w_; tx++) {
+      thumb[ty * thumb_w_ + tx] =
+          static_cast<uint8_t>(acc_[tx] / (SAMPLES * SAMPLES));
+    }
+  }
+}
+
+bool MotionGate::Check(const uint8_t *frame) {
+  frames_++;
+  MakeThumbnail(frame, current_.data());
+  bool infer = !has_reference_ || ++since_infer_ >= config_.max_stale;
+  changed_ = 0;
+  if (has_reference_) {
+    changed_ = CountChanged(current_.data(), reference_.data(),
+                            thumb_w_ * thumb_h_, config_.cell_threshold);
+    infer = infer || changed_ >= config_.min_changed;
+  }
+  if (infer) {
+    current_.swap(reference_);
+    has_reference_ = true;
+    since_infer_ = 0;
+    inferred_++;
+  }
+  return infer;
+}
@@ -0,0 +1,22 @@
+#include "retinaface_anchors.h"
+
+static constexpr auto kAnchors256 = MakeRetinafaceAnchors<256, 256>();
+static constexpr auto kAnchors320 = MakeRetinafaceAnchors<320, 320>();
+static constexpr auto kAnchors640 = MakeRetinafaceAnchors<640, 640>();
+
+const RetinafaceAnchor *RetinafaceAnchors(
+    int height, int width, std::vector<RetinafaceAnchor> &storage) {
+  if (height == width) {
+    switch (height) {
+      case 256:
+        return kAnchors256.data();
+      case 320:
+        return kAnchors320.data();
+      case 640:
+        return kAnchors640.data();
+    }
+  }
+  storage.resize(RetinafaceAnchorCount(height, width));
+  GenerateRetinafaceAnchors(height, width, storage.data());
+  return storage.data();
+}
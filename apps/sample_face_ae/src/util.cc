@@ -1,7 +1,10 @@
 #include "util.h"
 
 #include <math.h>
+#include <signal.h>
+#include <string.h>
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 
@@ -17,3 +20,126 @@ void read_binary_file(const char *file_name, char *buffer, size_t size) {
   ifs.read(buffer, len);
   ifs.close();
 }
+
+static const char *kStageNames[] = {
+    "dump_frame", "mmap", "ai2d",    "kpu",    "map_out",
+    "decode",     "nms",  "vo_draw", "ae_roi", "motion"};
+static const char *kCounterNames[] = {"frames", "dump_errors", "detections"};
+static_assert(sizeof(kStageNames) / sizeof(kStageNames[0]) ==
+              static_cast<size_t>(Stage::kNumStages));
+static_assert(sizeof(kCounterNames) / sizeof(kCounterNames[0]) ==
+              static_cast<size_t>(Counter::kNumCounters));
+
+int LatencyHistogram::BucketIndex(uint64_t us) {
+  if (us < kSubBuckets) return static_cast<int>(us);
+  if (us >> kMaxBits) us = (1ull << kMaxBits) - 1;
+  int msb = 63 - __builtin_clzll(us);
+  int shift = msb - kSubBits;
+  return (shift + 1) * kSubBuckets +
+         static_cast<int>((us >> shift) - kSubBuckets);
+}
+
+uint64_t LatencyHistogram::BucketUpper(int idx) {
+  if (idx < kSubBuckets) return idx;
+  int shift = idx / kSubBuckets - 1;
+  uint64_t mantissa = idx % kSubBuckets + kSubBuckets;
+  return ((mantissa + 1) << shift) - 1;
+}
+
+void LatencyHistogram::Record(uint64_t us) {
+  buckets_[BucketIndex(us)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  uint64_t prev = max_.load(std::memory_order_relaxed);
+  while (us > prev &&
+         !max_.compare_exchange_weak(prev, us, std::memory_order_relaxed)) {
+  }
+}
+
+uint64_t LatencyHistogram::Percentile(double p) const {
+  uint64_t count = Count();
+  if (count == 0) return 0;
+  uint64_t target = static_cast<uint64_t>(ceil(p / 100.0 * count));
+  if (target == 0) target = 1;
+  uint64_t seen = 0;
+  for (int i = 0; i < kBuckets; i++) {
+    seen += buckets_[i].load(std::memory_order_relaxed);
+    if (seen >= target) return std::min(BucketUpper(i), Max());
+  }
+  return Max();
+}
+
+void LatencyHistogram::Reset() {
+  for (auto &b : buckets_) b.store(0, std::memory_order_relaxed);
+  count_.store(0, std::memory_order_relaxed);
+  max_.store(0, std::memory_order_relaxed);
+}
+
+StageProfiler &StageProfiler::Get() {
+  static StageProfiler profiler;
+  return profiler;
+}
+
+void StageProfiler::Dump(FILE *out) const {
+  fprintf(out, "%-12s %10s %10s %10s %10s\n", "stage", "count", "p50(us)",
+          "p99(us)", "max(us)");
+  for (int i = 0; i < static_cast<int>(Stage::kNumStages); i++) {
+    const auto &h = hist_[i];
+    if (h.Count() == 0) continue;
+    fprintf(out, "%-12s %10llu %10llu %10llu %10llu\n", kStageNames[i],
+            static_cast<unsigned long long>(h.Count()),
+            static_cast<unsigned long long>(h.Percentile(50)),
+            static_cast<unsigned long long>(h.Percentile(99)),
+            static_cast<unsigned long long>(h.Max()));
+  }
+  for (int i = 0; i < static_cast<int>(Counter::kNumCounters); i++) {
+    fprintf(out, "%s%s=%llu", i ? " " : "", kCounterNames[i],
+            static_cast<unsigned long long>(
+                counters_[i].load(std::memory_order_relaxed)));
+  }
+  fprintf(out, "\n");
+  fflush(out);
+}
+
+void StageProfiler::Reset() {
+  for (auto &h : hist_) h.Reset();
+  for (auto &c : counters_) c.store(0, std::memory_order_relaxed);
+}
+
+void StageProfiler::OnSignal(int sig) {
+  auto &profiler = Get();
+  if (sig == SIGUSR1) {
+    profiler.dump_requested_.store(true);
+  } else if (sig == SIGUSR2) {
+    profiler.enabled_.store(!profiler.enabled_.load());
+  }
+}
+
+void StageProfiler::StartReporter(unsigned interval_s) {
+  if (running_.exchange(true)) return;
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = OnSignal;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGUSR1, &sa, nullptr);
+  sigaction(SIGUSR2, &sa, nullptr);
+
+  reporter_ = std::thread([this, interval_s] {
+    auto last = std::chrono::steady_clock::now();
+    while (running_.load()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      auto now = std::chrono::steady_clock::now();
+      bool due = interval_s > 0 && Enabled() &&
+                 now - last >= std::chrono::seconds(interval_s);
+      if (dump_requested_.exchange(false) || due) {
+        Dump(stdout);
+        last = now;
+      }
+    }
+  });
+}
+
+void StageProfiler::StopReporter() {
+  if (!running_.exchange(false)) return;
+  reporter_.join();
+}
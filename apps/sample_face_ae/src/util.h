@@ -1,10 +1,13 @@
 #ifndef _UTIL_H
 #define _UTIL_H
 #include <stdint.h>
+#include <stdio.h>
 
+#include <atomic>
 #include <chrono>
 #include <fstream>
 #include <iostream>
+#include <thread>
 #include <vector>
 
 #define ENABLE_PROFILING 0
@@ -40,22 +43,110 @@ std::vector<T> read_binary_file(const char *file_name) {
   return std::move(vec);
 }
 
+// Stages timed by ScopedTiming. Keep in sync with kStageNames in util.cc.
+enum class Stage {
+  kDumpFrame,
+  kMmap,
+  kAi2d,
+  kKpu,
+  kMapOutputs,  // output cache invalidate, part of kDecode
+  kDecode,  // whole postprocess, including NMS
+  kNms,
+  kVoDraw,
+  kAeRoi,
+  kMotion,  // motion gate thumbnail and compare
+  kNumStages
+};
+
+enum class Counter { kFrames, kDumpErrors, kDetections, kNumCounters };
+
+// Fixed-size latency histogram with HDR-style log-linear buckets: 32 linear
+// sub-buckets per power of two, i.e. about 3% relative error, for values up
+// to 2^32 us. Record is a few relaxed atomic operations, so any thread can
+// record without locking while another one reads percentiles.
+class LatencyHistogram {
+ public:
+  void Record(uint64_t us);
+  uint64_t Count() const { return count_.load(std::memory_order_relaxed); }
+  uint64_t Max() const { return max_.load(std::memory_order_relaxed); }
+  // Upper bound of the bucket holding the p-th percentile, 0 < p <= 100.
+  uint64_t Percentile(double p) const;
+  void Reset();
+
+ private:
+  static constexpr int kSubBits = 5;
+  static constexpr int kSubBuckets = 1 << kSubBits;
+  static constexpr int kMaxBits = 32;
+  static constexpr int kBuckets = (kMaxBits - kSubBits + 1) * kSubBuckets;
+  static int BucketIndex(uint64_t us);
+  static uint64_t BucketUpper(int idx);
+
+  std::atomic<uint64_t> buckets_[kBuckets] = {};
+  std::atomic<uint64_t> count_{0};
+  std::atomic<uint64_t> max_{0};
+};
+
+// Process-wide per-stage histograms and counters. Recording is off unless
+// enabled at startup (ENABLE_PROFILING) or at runtime; while it is off a
+// ScopedTiming costs one relaxed load.
+class StageProfiler {
+ public:
+  static StageProfiler &Get();
+
+  bool Enabled() const { return enabled_.load(std::memory_order_relaxed); }
+  void SetEnabled(bool enable) { enabled_.store(enable); }
+  void Record(Stage stage, uint64_t us) {
+    hist_[static_cast<int>(stage)].Record(us);
+  }
+  void Count(Counter counter, uint64_t n = 1) {
+    if (Enabled()) {
+      counters_[static_cast<int>(counter)].fetch_add(
+          n, std::memory_order_relaxed);
+    }
+  }
+  void Dump(FILE *out) const;
+  void Reset();
+
+  // Starts a reporter thread: SIGUSR1 dumps the tables, SIGUSR2 toggles
+  // recording, and with interval_s > 0 the tables are also dumped every
+  // interval_s seconds while recording is on.
+  void StartReporter(unsigned interval_s);
+  void StopReporter();
+
+ private:
+  StageProfiler() = default;
+  ~StageProfiler() { StopReporter(); }
+  static void OnSignal(int sig);
+
+  LatencyHistogram hist_[static_cast<int>(Stage::kNumStages)];
+  std::atomic<uint64_t> counters_[static_cast<int>(Counter::kNumCounters)] =
+      {};
+  std::atomic<bool> enabled_{ENABLE_PROFILING != 0};
+  std::atomic<bool> dump_requested_{false};
+  std::atomic<bool> running_{false};
+  std::thread reporter_;
+};
+
 class ScopedTiming {
  public:
-  ScopedTiming(std::string info = "ScopedTiming") : m_info(info) {
-    m_start = std::chrono::steady_clock::now();
+  explicit ScopedTiming(Stage stage)
+      : m_stage(stage), m_active(StageProfiler::Get().Enabled()) {
+    if (m_active) {
+      m_start = std::chrono::steady_clock::now();
+    }
   }
 
   ~ScopedTiming() {
-    m_stop = std::chrono::steady_clock::now();
-    double elapsed_ms =
-        std::chrono::duration<double, std::milli>(m_stop - m_start).count();
-    std::cout << m_info << " took " << elapsed_ms << " ms" << std::endl;
+    if (m_active) {
+      auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - m_start);
+      StageProfiler::Get().Record(m_stage, elapsed.count());
+    }
   }
 
  private:
-  std::string m_info;
+  Stage m_stage;
+  bool m_active;
   std::chrono::steady_clock::time_point m_start;
-  std::chrono::steady_clock::time_point m_stop;
 };
 #endif
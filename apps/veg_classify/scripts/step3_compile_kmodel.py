@@ -7,11 +7,23 @@ simplified.onnx を nncase で K230 向け kmodel にコンパイルする。
   - input_type=uint8: カメラからの生データをそのまま入力可能
   - mean/std: ImageNet 標準値
   - input_range=[0, 1]: torchvision の ToTensor() に合わせた [0,1] 正規化
+
+--batch N を指定するとバッチ N の kmodel (veg_classify_bN.kmodel) を生成する。
+face_detect -b のカスケード分類で N 個のクロップを 1 回の KPU 実行で分類する
+ためのもの。step4/step5 はバッチ 1 の kmodel をそのまま使う。
+
+出力の量子化:
+  - デフォルト: ロジットを float32 で出力
+  - --quant-outputs uint8|int8: 出力に QuantizeLinear を付けてコンパイルし、
+    ロジットを 8bit のまま CPU に渡す (KPU の逆量子化なし)
+  - いずれの場合も <kmodel>.quant に出力ごとの型・scale・zero_point を書き出す
+    (nncase の出力ディスクリプタは型しか持たないため、アプリはこのファイルを読む)
 """
 
 import argparse
 import glob
 import os
+import struct
 import numpy as np
 from PIL import Image
 import nncase
@@ -29,33 +41,177 @@ MEAN = [0.485, 0.456, 0.406]
 STD = [0.229, 0.224, 0.225]
 
 
-def load_calib_images_uint8(image_dir, input_h, input_w):
-    extensions = ("*.jpg", "*.jpeg", "*.png", "*.bmp")
+KCAP_MAGIC = b"K230CAP\x00"
+KCAP_HEADER = "<8s6IQQ"  # burst_capture.h の BurstFileHeader (48 バイト)
+
+
+def load_kcap_frames(path):
+    """-k バーストキャプチャ (.kcap) を (N, C, H, W) uint8 の memmap で返す"""
+    with open(path, "rb") as f:
+        header = f.read(struct.calcsize(KCAP_HEADER))
+    (magic, version, count, channels, height, width, data_offset,
+     first_frame, trigger_frame) = struct.unpack(KCAP_HEADER, header)
+    if magic != KCAP_MAGIC or version != 1:
+        raise ValueError(f"{path}: kcap ではありません")
+    print(f"    {os.path.basename(path):25s} {count} frames {width}x{height}"
+          f" (frame {first_frame}-, trigger {trigger_frame})")
+    return np.memmap(path, dtype=np.uint8, mode="r", offset=data_offset,
+                     shape=(count, channels, height, width))
+
+
+def load_calib_images_uint8(image_dir, input_h, input_w, max_samples=0):
+    extensions = ("*.jpg", "*.jpeg", "*.png", "*.bmp", "*.ppm")
     image_paths = []
     for ext in extensions:
         image_paths.extend(glob.glob(os.path.join(image_dir, ext)))
     image_paths.sort()
 
-    if not image_paths:
+    kcap_paths = sorted(glob.glob(os.path.join(image_dir, "*.kcap")))
+
+    if not image_paths and not kcap_paths:
         return []
 
+    # 大きなバースト集合は等間隔に間引く。ファイル名とフレーム番号だけで
+    # 選び、選んだものだけをデコード・リサイズする
+    sources = [(path, None) for path in image_paths]
+    for path in kcap_paths:
+        frames = load_kcap_frames(path)
+        sources.extend((frames, i) for i in range(len(frames)))
+    if max_samples and len(sources) > max_samples:
+        step = len(sources) / max_samples
+        sources = [sources[int(i * step)] for i in range(max_samples)]
+        print(f"    {max_samples} サンプルに間引き")
+
     samples = []
-    for path in image_paths:
-        img = Image.open(path).convert("RGB")
+    for src, index in sources:
+        if index is None:
+            img = Image.open(src).convert("RGB")
+            size = img.size
+        else:
+            # バーストはフレームを CHW で並べているのでファイル全体を読まずに取り出せる
+            img = Image.fromarray(
+                np.ascontiguousarray(src[index].transpose(1, 2, 0)))
         img = img.resize((input_w, input_h), Image.BILINEAR)
+        # HWC uint8 -> NCHW uint8
         arr = np.array(img, dtype=np.uint8)
-        arr = arr.transpose(2, 0, 1)[np.newaxis, ...]
+        arr = arr.transpose(2, 0, 1)[np.newaxis, ...]  # (1, 3, H, W)
         samples.append(arr)
-        print(f"    {os.path.basename(path):25s} {img.size} -> {arr.shape}")
+        if index is None:
+            print(f"    {os.path.basename(src):25s} {size} -> {arr.shape}")
 
     return samples
 
 
+def batch_samples(samples, batch):
+    """キャリブレーション画像を batch 枚ずつ 1 サンプルにまとめる (端数は先頭から補う)"""
+    if batch == 1:
+        return samples
+    count = max(1, len(samples) // batch)
+    return [np.concatenate([samples[(i * batch + j) % len(samples)]
+                            for j in range(batch)], axis=0)
+            for i in range(count)]
+
+
+def make_batch_onnx(batch):
+    """simplified.onnx の入力バッチを batch に書き換えて簡略化し直す"""
+    import onnx
+    import onnxsim
+    onnx_model = onnx.load(SIMPLIFIED_PATH)
+    inp = onnx_model.graph.input[0]
+    shape = [d.dim_value for d in inp.type.tensor_type.shape.dim]
+    shape[0] = batch
+    onnx_model, check = onnxsim.simplify(
+        onnx_model, overwrite_input_shapes={inp.name: shape})
+    assert check, "バッチ変更後のモデル検証に失敗"
+    path = os.path.join(OUTPUT_DIR, f"simplified_b{batch}.onnx")
+    onnx.save_model(onnx_model, path)
+    return path
+
+
+def output_ranges(model_bytes, samples, mean, std):
+    """キャリブレーションデータで各出力の値域 (min, max) を求める (onnxruntime)
+
+    kmodel の前処理と同じく uint8 を [0, 1] にしてから mean/std で正規化する。
+    """
+    import onnxruntime as ort
+    sess = ort.InferenceSession(model_bytes, providers=["CPUExecutionProvider"])
+    input_name = sess.get_inputs()[0].name
+    mean = np.array(mean, dtype=np.float32).reshape(1, 3, 1, 1)
+    std = np.array(std, dtype=np.float32).reshape(1, 3, 1, 1)
+    ranges = None
+    for sample in samples:
+        x = (sample.astype(np.float32) / 255.0 - mean) / std
+        outputs = sess.run(None, {input_name: x})
+        cur = [(float(o.min()), float(o.max())) for o in outputs]
+        if ranges is None:
+            ranges = cur
+        else:
+            ranges = [(min(a[0], b[0]), max(a[1], b[1]))
+                      for a, b in zip(ranges, cur)]
+    return ranges
+
+
+def quantize_outputs(model_bytes, ranges, qtype):
+    """各出力の後ろに QuantizeLinear を挿入した ONNX と量子化パラメータを返す
+
+    出力名は変えない (step4 / アプリの出力順と名前を保つ)。
+    """
+    import onnx
+    from onnx import TensorProto, helper
+
+    qmin, qmax = (0, 255) if qtype == "uint8" else (-128, 127)
+    elem = TensorProto.UINT8 if qtype == "uint8" else TensorProto.INT8
+
+    model = onnx.load_from_string(model_bytes)
+    graph = model.graph
+    params = []
+    for i, (out, (lo, hi)) in enumerate(zip(graph.output, ranges)):
+        lo, hi = min(lo, 0.0), max(hi, 0.0)
+        scale = (hi - lo) / (qmax - qmin) if hi > lo else 1.0
+        zero_point = int(np.clip(qmin - round(lo / scale), qmin, qmax))
+        params.append((qtype, scale, zero_point))
+
+        # 元の出力を <name>_f にリネームし、QuantizeLinear で <name> を作る
+        float_name = out.name + "_f"
+        for node in graph.node:
+            for j, name in enumerate(node.output):
+                if name == out.name:
+                    node.output[j] = float_name
+        graph.initializer.extend([
+            helper.make_tensor(f"{out.name}_scale", TensorProto.FLOAT, [],
+                               [scale]),
+            helper.make_tensor(f"{out.name}_zero_point", elem, [],
+                               [zero_point]),
+        ])
+        graph.node.append(helper.make_node(
+            "QuantizeLinear",
+            [float_name, f"{out.name}_scale", f"{out.name}_zero_point"],
+            [out.name], name=f"output_quantize_{i}"))
+        out.type.tensor_type.elem_type = elem
+    return model.SerializeToString(), params
+
+
+def write_quant_params(path, params):
+    """<kmodel>.quant: 1 行 1 出力で <index> <type> <scale> <zero_point>"""
+    with open(path, "w") as f:
+        for i, (qtype, scale, zero_point) in enumerate(params):
+            f.write(f"{i} {qtype} {scale:.9g} {zero_point}\n")
+
+
 def main():
     parser = argparse.ArgumentParser(description="実機用 kmodel コンパイル")
     parser.add_argument("--calib-dir", type=str, default=None,
-                        help="キャリブレーション用画像ディレクトリ")
+                        help="キャリブレーション用画像ディレクトリ (画像, バースト .kcap)")
+    parser.add_argument("--calib-max", type=int, default=0,
+                        help="キャリブレーションサンプル数の上限 (0: 全部)")
+    parser.add_argument("--batch", type=int, default=1,
+                        help="kmodel の入力バッチ数 (face_detect -b 用)")
+    parser.add_argument("--quant-outputs", choices=["uint8", "int8"],
+                        default=None,
+                        help="出力ロジットを 8bit 量子化のまま出力する")
     args = parser.parse_args()
+    if args.batch < 1:
+        parser.error("--batch は 1 以上")
 
     print("=" * 60)
     print("Step 3: 実機用 kmodel コンパイル (PTQ量子化)")
@@ -68,6 +224,13 @@ def main():
         print("先に step2_simplify_model.py を実行してください。")
         return
 
+    onnx_path = SIMPLIFIED_PATH
+    kmodel_path = KMODEL_PATH
+    if args.batch > 1:
+        onnx_path = make_batch_onnx(args.batch)
+        kmodel_path = os.path.join(DUMP_PATH,
+                                   f"veg_classify_b{args.batch}.kmodel")
+
     # CompileOptions
     print("\n[1/5] CompileOptions 設定")
     compile_options = nncase.CompileOptions()
@@ -82,7 +245,7 @@ def main():
     compile_options.input_range = [0, 1]
     compile_options.mean = MEAN
     compile_options.std = STD
-    compile_options.input_shape = [1, 3, INPUT_H, INPUT_W]
+    compile_options.input_shape = [args.batch, 3, INPUT_H, INPUT_W]
     compile_options.input_layout = "NCHW"
     compile_options.output_layout = "NCHW"
 
@@ -92,6 +255,7 @@ def main():
     print(f"  input_range = {compile_options.input_range}")
     print(f"  mean        = {compile_options.mean}")
     print(f"  std         = {compile_options.std}")
+    print(f"  batch       = {args.batch}")
 
     # PTQTensorOptions
     print("\n[2/5] PTQTensorOptions 設定")
@@ -111,7 +275,8 @@ def main():
     if args.calib_dir:
         print(f"\n[3/5] キャリブレーションデータ生成 (実画像)")
         print(f"  画像ディレクトリ: {args.calib_dir}")
-        samples = load_calib_images_uint8(args.calib_dir, INPUT_H, INPUT_W)
+        samples = load_calib_images_uint8(args.calib_dir, INPUT_H, INPUT_W,
+                                          args.calib_max)
         if not samples:
             print("  WARNING: 画像が見つかりません。ランダムデータで代用します。")
             samples = [np.random.randint(0, 256, (1, 3, INPUT_H, INPUT_W)).astype(np.uint8)
@@ -121,6 +286,7 @@ def main():
         samples = [np.random.randint(0, 256, (1, 3, INPUT_H, INPUT_W)).astype(np.uint8)
                    for _ in range(5)]
 
+    samples = batch_samples(samples, args.batch)
     calib_data = [samples]
     ptq_options.samples_count = len(samples)
     ptq_options.set_tensor_data(calib_data)
@@ -128,19 +294,34 @@ def main():
     # Compile
     print("\n[4/5] コンパイル実行中...")
     compiler = nncase.Compiler(compile_options)
-    with open(SIMPLIFIED_PATH, "rb") as f:
-        compiler.import_onnx(f.read(), nncase.ImportOptions())
+    with open(onnx_path, "rb") as f:
+        model_content = f.read()
+
+    if args.quant_outputs:
+        ranges = output_ranges(model_content, samples, MEAN, STD)
+        model_content, quant_params = quantize_outputs(
+            model_content, ranges, args.quant_outputs)
+        print(f"  出力量子化: {args.quant_outputs}")
+        for i, (qtype, scale, zero_point) in enumerate(quant_params):
+            print(f"    [{i}] scale={scale:.6g} zero_point={zero_point}")
+    else:
+        # 分類モデルの出力はロジット 1 つ
+        quant_params = [("float32", 1.0, 0)]
+    compiler.import_onnx(model_content, nncase.ImportOptions())
     compiler.use_ptq(ptq_options)
     compiler.compile()
     kmodel = compiler.gencode_tobytes()
 
     # Save
-    with open(KMODEL_PATH, "wb") as f:
+    with open(kmodel_path, "wb") as f:
         f.write(kmodel)
+    quant_path = kmodel_path + ".quant"
+    write_quant_params(quant_path, quant_params)
 
     print(f"\n[5/5] kmodel 保存完了")
-    print(f"  パス: {KMODEL_PATH}")
+    print(f"  パス: {kmodel_path}")
     print(f"  サイズ: {len(kmodel):,} bytes ({len(kmodel)/1024:.1f} KB)")
+    print(f"  量子化パラメータ: {quant_path}")
     print("Done.")
 
 
@@ -29,6 +29,7 @@ SCRIPT_DIR = os.path.dirname(__file__)
 OUTPUT_DIR = os.path.join(SCRIPT_DIR, "..", "output")
 DUMP_PATH = os.path.join(OUTPUT_DIR, "dump")
 KMODEL_PATH = os.path.join(DUMP_PATH, "veg_classify.kmodel")
+QUANT_PATH = KMODEL_PATH + ".quant"
 DATA_DIR = os.path.join(SCRIPT_DIR, "..", "data")
 
 INPUT_H, INPUT_W = 224, 224
@@ -54,6 +55,17 @@ def load_test_image_uint8(image_path, input_h, input_w):
     return arr
 
 
+def load_quant_params(path):
+    """step3 が書いた <kmodel>.quant を読む (無ければ空)"""
+    params = {}
+    if os.path.exists(path):
+        with open(path) as f:
+            for line in f:
+                idx, qtype, scale, zero_point = line.split()
+                params[int(idx)] = (qtype, float(scale), int(zero_point))
+    return params
+
+
 def main():
     parser = argparse.ArgumentParser(description="kmodel シミュレーション")
     parser.add_argument("--image", type=str, default=None)
@@ -101,8 +113,14 @@ def main():
 
     # Get outputs
     print("\n[4/4] 出力テンソル取得")
+    # --quant-outputs の kmodel は float32 に戻して保存する (step5 用)
+    quant_params = load_quant_params(QUANT_PATH)
     for idx in range(simulator.outputs_size):
         result = simulator.get_output_tensor(idx).to_numpy()
+        if result.dtype in (np.uint8, np.int8) and idx in quant_params:
+            _, scale, zero_point = quant_params[idx]
+            result = (scale * (result.astype(np.float32) - zero_point)).astype(
+                np.float32)
         npy_path = os.path.join(DUMP_PATH, f"kmodel_result_{idx}.npy")
         np.save(npy_path, result)
         print(f"  [{idx}] shape={result.shape}, "
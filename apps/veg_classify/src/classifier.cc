@@ -36,7 +36,7 @@ Classifier::Classifier(const char *kmodel_file, const char *labels_file,
   ai2d_out_tensor_ = InputTensor(0);
 
   // AI2D config: stretch resize (no padding, no aspect ratio preservation)
-  dims_t in_shape{1, ai2d_input_c_, ai2d_input_h_, ai2d_input_w_};
+  ai2d_in_shape_ = {1, ai2d_input_c_, ai2d_input_h_, ai2d_input_w_};
   auto out_shape = InputShape(0);
 
   ai2d_datatype_t ai2d_dtype{ai2d_format::NCHW_FMT, ai2d_format::NCHW_FMT,
@@ -51,70 +51,27 @@ Classifier::Classifier(const char *kmodel_file, const char *labels_file,
                                    ai2d_interp_mode::half_pixel};
   ai2d_affine_param_t affine_param{false};
 
-  ai2d_builder_.reset(new ai2d_builder(in_shape, out_shape, ai2d_dtype,
+  ai2d_builder_.reset(new ai2d_builder(ai2d_in_shape_, out_shape, ai2d_dtype,
                                        crop_param, shift_param, pad_param,
                                        resize_param, affine_param));
-  ai2d_builder_->build_schedule();
+  BuildAi2dSchedule();
 }
 
 Classifier::~Classifier() {}
 
-void Classifier::Preprocess(uintptr_t vaddr, uintptr_t paddr) {
-#if ENABLE_PROFILING
-  ScopedTiming st(ModelName() + " " + __FUNCTION__);
-#endif
+void Classifier::Preprocess(runtime_tensor &input) {
+  ScopedTiming st(Stage::kAi2d);
 
-  dims_t in_shape{1, ai2d_input_c_, ai2d_input_h_, ai2d_input_w_};
-  auto ai2d_in_tensor =
-      host_runtime_tensor::create(
-          typecode_t::dt_uint8, in_shape,
-          {reinterpret_cast<gsl::byte *>(vaddr), compute_size(in_shape)}, false,
-          hrt::pool_shared, paddr)
-          .expect("cannot create input tensor");
-  hrt::sync(ai2d_in_tensor, sync_op_t::sync_write_back, true)
-      .expect("sync write_back failed");
-
-  ai2d_builder_->invoke(ai2d_in_tensor, ai2d_out_tensor_)
+  ai2d_builder_->invoke(input, ai2d_out_tensor_)
       .expect("error occurred in ai2d running");
 }
 
 void Classifier::Postprocess() {
-#if ENABLE_PROFILING
-  ScopedTiming st(ModelName() + " " + __FUNCTION__);
-#endif
-
-  auto tensor = OutputTensor(0);
-  auto buf = tensor.impl()
-                 ->to_host()
-                 .unwrap()
-                 ->buffer()
-                 .as_host()
-                 .unwrap()
-                 .map(map_access_::map_read)
-                 .unwrap()
-                 .buffer();
-  float *output = reinterpret_cast<float *>(buf.data());
+  ScopedTiming st(Stage::kDecode);
 
+  InvalidateOutputs();
   auto out_shape = OutputShape(0);
   int num_classes = static_cast<int>(out_shape[1]);
-
-  // Softmax
-  float max_val = *std::max_element(output, output + num_classes);
-  float sum = 0.0f;
-  for (int i = 0; i < num_classes; i++) {
-    output[i] = std::exp(output[i] - max_val);
-    sum += output[i];
-  }
-  for (int i = 0; i < num_classes; i++) {
-    output[i] /= sum;
-  }
-
-  // Argmax
-  int max_idx =
-      static_cast<int>(std::max_element(output, output + num_classes) - output);
-
-  result_.class_id = max_idx;
-  result_.confidence = output[max_idx];
-  result_.label =
-      (max_idx < static_cast<int>(labels_.size())) ? labels_[max_idx] : "???";
+  ClassifierPostprocess(OutputData(0), OutputQuantParams(0), num_classes,
+                        labels_, &result_);
 }
@@ -4,14 +4,9 @@
 #include <string>
 #include <vector>
 
+#include "classifier_postprocess.h"
 #include "model.h"
 
-struct ClassifyResult {
-  int class_id;
-  float confidence;
-  std::string label;
-};
-
 class Classifier : public Model {
  public:
   Classifier(const char *kmodel_file, const char *labels_file, size_t channel,
@@ -20,7 +15,7 @@ class Classifier : public Model {
   ClassifyResult GetResult() const { return result_; }
 
  protected:
-  void Preprocess(uintptr_t vaddr, uintptr_t paddr) override;
+  void Preprocess(nr::runtime_tensor &input) override;
   void Postprocess() override;
 
  private:
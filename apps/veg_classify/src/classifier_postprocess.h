@@ -0,0 +1,29 @@
+#ifndef APPS_VEG_CLASSIFY_SRC_CLASSIFIER_POSTPROCESS_H_
+#define APPS_VEG_CLASSIFY_SRC_CLASSIFIER_POSTPROCESS_H_
+
+#include <string>
+#include <vector>
+
+#include "quant_params.h"
+
+struct ClassifyResult {
+  int class_id;
+  float confidence;
+  std::string label;
+};
+
+// CPU side of Classifier: top-1 of the logits and its softmax probability.
+// The logits are only read, so they can live in a mapped KPU output.
+// Has no SDK dependency so recorded outputs can be replayed on a host.
+void ClassifierPostprocess(const float *logits, int num_classes,
+                           const std::vector<std::string> &labels,
+                           ClassifyResult *result);
+
+// Same for an output of any OutputType. For int8/uint8 the top-1 is taken
+// on the raw integers and only its confidence is computed in float.
+void ClassifierPostprocess(const void *output, const OutputQuant &quant,
+                           int num_classes,
+                           const std::vector<std::string> &labels,
+                           ClassifyResult *result);
+
+#endif  // APPS_VEG_CLASSIFY_SRC_CLASSIFIER_POSTPROCESS_H_
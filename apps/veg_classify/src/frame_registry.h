@@ -0,0 +1,100 @@
+#ifndef APPS_VEG_CLASSIFY_SRC_FRAME_REGISTRY_H_
+#define APPS_VEG_CLASSIFY_SRC_FRAME_REGISTRY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <utility>
+#include <vector>
+
+// Maps physical frame buffers into the process. The device implementation
+// wraps kd_mpi_sys_mmap/munmap; a host fake can count calls.
+class FrameMapper {
+ public:
+  virtual ~FrameMapper() = default;
+  virtual void *Map(uint64_t paddr, size_t size) = 0;
+  virtual void Unmap(void *vaddr, size_t size) = 0;
+};
+
+// Caches the mapping of each VB block, plus a per-block payload such as the
+// AI2D input tensor wrapper, keyed by physical address. VICAP cycles through
+// a small fixed set of blocks, so after warm-up every frame is a lookup
+// instead of an mmap/munmap pair and a tensor creation.
+//
+// Entries are evicted least-recently-used beyond `capacity`; keep capacity
+// above the number of frames that can be in flight at once. Not thread-safe:
+// acquire frames from a single thread.
+template <class Payload>
+class FrameRegistry {
+ public:
+  struct Entry {
+    uint64_t paddr;
+    void *vaddr;
+    Payload payload;
+    uint64_t last_use;
+  };
+  using MakePayload = std::function<Payload(void *vaddr, uint64_t paddr)>;
+
+  FrameRegistry(FrameMapper &mapper, size_t frame_size, size_t capacity,
+                MakePayload make_payload)
+      : mapper_(mapper),
+        frame_size_(frame_size),
+        capacity_(capacity ? capacity : 1),
+        make_payload_(std::move(make_payload)) {
+    entries_.reserve(capacity_);
+  }
+
+  ~FrameRegistry() {
+    for (auto &e : entries_) {
+      mapper_.Unmap(e.vaddr, frame_size_);
+    }
+  }
+
+  FrameRegistry(const FrameRegistry &) = delete;
+  FrameRegistry &operator=(const FrameRegistry &) = delete;
+
+  Entry &Acquire(uint64_t paddr) {
+    ++clock_;
+    for (auto &e : entries_) {
+      if (e.paddr == paddr) {
+        e.last_use = clock_;
+        hits_++;
+        return e;
+      }
+    }
+
+    misses_++;
+    if (entries_.size() >= capacity_) {
+      size_t lru = 0;
+      for (size_t i = 1; i < entries_.size(); i++) {
+        if (entries_[i].last_use < entries_[lru].last_use) lru = i;
+      }
+      mapper_.Unmap(entries_[lru].vaddr, frame_size_);
+      entries_.erase(entries_.begin() + lru);
+      evictions_++;
+    }
+
+    void *vaddr = mapper_.Map(paddr, frame_size_);
+    entries_.push_back({paddr, vaddr, make_payload_(vaddr, paddr), clock_});
+    return entries_.back();
+  }
+
+  size_t Size() const { return entries_.size(); }
+  uint64_t Hits() const { return hits_; }
+  uint64_t Misses() const { return misses_; }
+  uint64_t Evictions() const { return evictions_; }
+
+ private:
+  FrameMapper &mapper_;
+  const size_t frame_size_;
+  const size_t capacity_;
+  MakePayload make_payload_;
+  std::vector<Entry> entries_;
+  uint64_t clock_ = 0;
+  uint64_t hits_ = 0;
+  uint64_t misses_ = 0;
+  uint64_t evictions_ = 0;
+};
+
+#endif  // APPS_VEG_CLASSIFY_SRC_FRAME_REGISTRY_H_
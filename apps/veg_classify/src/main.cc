@@ -13,12 +13,13 @@
 #include <ctime>
 #include <fstream>
 #include <iostream>
-#include <opencv2/core.hpp>
-#include <opencv2/imgcodecs.hpp>
-#include <opencv2/imgproc.hpp>
+#include <memory>
 #include <thread>
 
+#include "burst_capture.h"
+#include "capture_writer.h"
 #include "classifier.h"
+#include "frame_registry.h"
 #include "k_connector_comm.h"
 #include "k_module.h"
 #include "k_sys_comm.h"
@@ -26,6 +27,7 @@
 #include "k_vb_comm.h"
 #include "k_video_comm.h"
 #include "k_vo_comm.h"
+#include "motion_gate.h"
 #include "mpi_connector_api.h"
 #include "mpi_isp_api.h"
 #include "mpi_sys_api.h"
@@ -41,6 +43,16 @@
 #define ISP_CHN1_WIDTH (1280)
 #define ISP_CHN0_WIDTH (1920)
 #define ISP_CHN0_HEIGHT (1080)
+// The AI2D input pool; NOCACHE lets the registry skip the per-frame sync
+#define CHN1_POOL_MODE VB_REMAP_MODE_NOCACHE
+#define CHN1_POOL_BLOCKS 5
+// Mapped chn1 buffers kept by the frame registry (the pool has 5 blocks)
+#define FRAME_REGISTRY_CAPACITY 8
+// Captured frames held in RAM until the writer thread saves them
+#define CAPTURE_RING_SLOTS 4
+// Burst frames keep every 2nd pixel and row: 640x360, still above the
+// 224x224 classifier input
+#define BURST_SCALE 2
 
 #define ISP_INPUT_WIDTH (1920)
 #define ISP_INPUT_HEIGHT (1080)
@@ -54,6 +66,7 @@ std::atomic<bool> quit(true);
 
 bool app_run = true;
 std::atomic<bool> capture_requested(false);
+std::atomic<bool> burst_requested(false);
 
 void fun_sig(int sig) {
   if (sig == SIGINT) {
@@ -191,6 +204,20 @@ int sample_sys_bind_init(void) {
   return ret;
 }
 
+// Maps VB blocks for the frame registry. The chn1 pool is NOCACHE and
+// kd_mpi_sys_mmap returns an uncached mapping, so frames never need a cache
+// write-back before AI2D reads them.
+class VbFrameMapper : public FrameMapper {
+ public:
+  void *Map(uint64_t paddr, size_t size) override {
+    ScopedTiming st(Stage::kMmap);
+    return kd_mpi_sys_mmap(paddr, size);
+  }
+  void Unmap(void *vaddr, size_t size) override {
+    kd_mpi_sys_munmap(vaddr, size);
+  }
+};
+
 int sample_vb_init(void) {
   k_s32 ret;
   k_vb_config config;
@@ -203,8 +230,8 @@ int sample_vb_init(void) {
       (ISP_CHN0_WIDTH * ISP_CHN0_HEIGHT * 3 / 2), VICAP_ALIGN_1K);
 
   // VB for RGB888 output
-  config.comm_pool[1].blk_cnt = 5;
-  config.comm_pool[1].mode = VB_REMAP_MODE_NOCACHE;
+  config.comm_pool[1].blk_cnt = CHN1_POOL_BLOCKS;
+  config.comm_pool[1].mode = CHN1_POOL_MODE;
   config.comm_pool[1].blk_size =
       VICAP_ALIGN_UP((ISP_CHN1_HEIGHT * ISP_CHN1_WIDTH * 3), VICAP_ALIGN_1K);
 
@@ -327,26 +354,8 @@ int sample_vivcap_init(void) {
   return ret;
 }
 
-static void save_frame_as_png(void *vaddr, int h, int w,
-                              const char *capture_dir, int count) {
-  auto *base = reinterpret_cast<uint8_t *>(vaddr);
-  std::vector<cv::Mat> channels = {
-      cv::Mat(h, w, CV_8UC1, base + 2 * h * w),  // B plane
-      cv::Mat(h, w, CV_8UC1, base + 1 * h * w),  // G plane
-      cv::Mat(h, w, CV_8UC1, base + 0 * h * w),  // R plane
-  };
-  cv::Mat bgr;
-  cv::merge(channels, bgr);
-
-  char filename[256];
-  snprintf(filename, sizeof(filename), "%s/capture_%04d.png", capture_dir,
-           count);
-  cv::imwrite(filename, bgr);
-  printf("Captured: %s\n", filename);
-}
-
 static void *input_thread(void *arg) {
-  printf("press 'q' to exit, 'c' to capture frame\n");
+  printf("press 'q' to exit, 'c' to capture frame, 'b' to flush a burst\n");
   while (app_run) {
     int ch = getchar();
     if (ch == 'q') {
@@ -354,29 +363,94 @@ static void *input_thread(void *arg) {
       break;
     } else if (ch == 'c') {
       capture_requested.store(true);
+    } else if (ch == 'b') {
+      burst_requested.store(true);
     }
   }
   return nullptr;
 }
 
+static void usage(const char *prog) {
+  std::cerr << "Usage: " << prog
+            << " [-m frames] [-u] [-k frames [-g trigger]] <kmodel>"
+            << " <labels.txt> [capture_dir]" << std::endl;
+  std::cerr << "  -m frames: reuse the last result while the scene is"
+            << " static, for at most <frames> frames (default 0 = off)"
+            << std::endl;
+  std::cerr << "  -u: save captures as uncompressed PPM instead of PNG"
+            << std::endl;
+  std::cerr << "  -k frames: keep the last <frames> frames for burst capture"
+            << " to capture_dir" << std::endl;
+  std::cerr << "  -g trigger: burst trigger, key ('b', default) or count"
+            << " (every <frames> frames)" << std::endl;
+  std::cerr << "  labels.txt: class label file (one label per line)"
+            << std::endl;
+  std::cerr << "  capture_dir: directory to save captures to (optional)"
+            << std::endl;
+}
+
 int main(int argc, char *argv[]) {
   k_u32 display_ms = 1000 / 33;
   int ret;
   const char *capture_dir = nullptr;
-  int capture_count = 0;
+  CaptureConfig capture_config;
+  capture_config.slots = CAPTURE_RING_SLOTS;
+  BurstConfig burst_config;
+  burst_config.scale = BURST_SCALE;
+  int burst_frames = 0;
+  int motion_stale = 0;
+  const char *prog = argv[0];
+
+  int opt;
+  while ((opt = getopt(argc, argv, "m:uk:g:")) != -1) {
+    switch (opt) {
+      case 'm':
+        motion_stale = atoi(optarg);
+        if (motion_stale < 0) {
+          usage(prog);
+          return -1;
+        }
+        break;
+      case 'u':
+        capture_config.raw = true;
+        break;
+      case 'k':
+        burst_frames = atoi(optarg);
+        if (burst_frames <= 0) {
+          usage(prog);
+          return -1;
+        }
+        break;
+      case 'g':
+        if (strcmp(optarg, "key") == 0) {
+          burst_config.continuous = false;
+        } else if (strcmp(optarg, "count") == 0) {
+          burst_config.continuous = true;
+        } else {
+          usage(prog);
+          return -1;
+        }
+        break;
+      default:
+        usage(prog);
+        return -1;
+    }
+  }
+  // Shift so the positional arguments keep their original indices
+  argc -= optind - 1;
+  argv += optind - 1;
 
   if (argc < 3 || argc > 4) {
-    std::cerr << "Usage: " << argv[0] << " <kmodel> <labels.txt> [capture_dir]"
-              << std::endl;
-    std::cerr << "  labels.txt: class label file (one label per line)"
-              << std::endl;
-    std::cerr << "  capture_dir: directory to save PNG captures (optional)"
-              << std::endl;
+    usage(prog);
     return -1;
   }
   if (argc == 4) {
     capture_dir = argv[3];
   }
+  if (burst_frames > 0 && !capture_dir) {
+    usage(prog);
+    return -1;
+  }
 
   /****fixed operation for ctrl+c****/
   struct sigaction sa;
@@ -385,6 +459,9 @@ int main(int argc, char *argv[]) {
   sigfillset(&sa.sa_mask);
   sigaction(SIGINT, &sa, nullptr);
 
+  // SIGUSR1 prints per-stage latency, SIGUSR2 toggles recording
+  StageProfiler::Get().StartReporter(0);
+
   pthread_t vo_thread_handle;
   pthread_t input_thread_handle;
   pthread_create(&input_thread_handle, nullptr, input_thread, nullptr);
@@ -392,6 +469,7 @@ int main(int argc, char *argv[]) {
   size_t size = CHANNEL * ISP_CHN1_HEIGHT * ISP_CHN1_WIDTH;
 
   Classifier model(argv[1], argv[2], CHANNEL, ISP_CHN1_HEIGHT, ISP_CHN1_WIDTH);
+  model.PrintStartup();
 
   ret = sample_vb_init();
   if (ret) {
@@ -407,47 +485,128 @@ int main(int argc, char *argv[]) {
 
   {
     ClassifyResult cls_result;
+    VbFrameMapper mapper;
+    FrameRegistry<nr::runtime_tensor> frames(
+        mapper, size, FRAME_REGISTRY_CAPACITY,
+        [&](void *vaddr, uint64_t paddr) {
+          return model.WrapInput(reinterpret_cast<uintptr_t>(vaddr), paddr);
+        });
+    const bool sync_input = CHN1_POOL_MODE != VB_REMAP_MODE_NOCACHE;
+
+    // With -m frames of a static scene keep the last result
+    std::unique_ptr<MotionGate> motion_gate;
+    if (motion_stale > 0) {
+      MotionGateConfig config;
+      config.max_stale = motion_stale;
+      motion_gate.reset(
+          new MotionGate(ISP_CHN1_WIDTH, ISP_CHN1_HEIGHT, config));
+    }
+
+    std::unique_ptr<CaptureWriter> capture;
+    if (capture_dir != nullptr) {
+      // The writer may hold what the loop's frame and the one VICAP is
+      // filling leave of the chn1 pool
+      capture_config.max_held = CHN1_POOL_BLOCKS - 2;
+      capture.reset(new CaptureWriter(capture_dir, ISP_CHN1_WIDTH,
+                                      ISP_CHN1_HEIGHT, capture_config));
+    }
+    // With a key trigger, half the burst comes from after it
+    std::unique_ptr<BurstCapture> burst;
+    if (burst_frames > 0) {
+      burst_config.frames = burst_frames;
+      burst_config.post_frames =
+          burst_config.continuous ? 0 : burst_frames / 2;
+      burst.reset(new BurstCapture(capture_dir, ISP_CHN1_WIDTH,
+                                   ISP_CHN1_HEIGHT, burst_config));
+    }
 
     while (app_run) {
       memset(&dump_info, 0, sizeof(k_video_frame_info));
-      ret = kd_mpi_vicap_dump_frame(vicap_dev, VICAP_CHN_ID_1, VICAP_DUMP_YUV,
-                                    &dump_info, 1000);
+      {
+        ScopedTiming st(Stage::kDumpFrame);
+        ret = kd_mpi_vicap_dump_frame(vicap_dev, VICAP_CHN_ID_1,
+                                      VICAP_DUMP_YUV, &dump_info, 1000);
+      }
       if (ret) {
+        StageProfiler::Get().Count(Counter::kDumpErrors);
         quit.store(false);
         printf("sample_vicap...kd_mpi_vicap_dump_frame failed.\n");
         break;
       }
 
-      auto vbvaddr = kd_mpi_sys_mmap(dump_info.v_frame.phys_addr[0], size);
+      auto &buf = frames.Acquire(dump_info.v_frame.phys_addr[0]);
+
+      bool still = false;
+      if (motion_gate) {
+        ScopedTiming st(Stage::kMotion);
+        still = !motion_gate->Check(static_cast<const uint8_t *>(buf.vaddr));
+      }
 
       // run inference
-      model.Run(reinterpret_cast<uintptr_t>(vbvaddr),
-                reinterpret_cast<uintptr_t>(dump_info.v_frame.phys_addr[0]));
-      cls_result = model.GetResult();
+      if (!still) {
+        model.Run(buf.payload, sync_input);
+        cls_result = model.GetResult();
+      }
+      StageProfiler::Get().Count(Counter::kFrames);
 
       // Display classification result via VO draw frame (text overlay)
       // Clear previous frame annotation
-      vo_frame.draw_en = 0;
-      vo_frame.frame_num = 1;
-      kd_mpi_vo_draw_frame(&vo_frame);
+      {
+        ScopedTiming st(Stage::kVoDraw);
+        vo_frame.draw_en = 0;
+        vo_frame.frame_num = 1;
+        kd_mpi_vo_draw_frame(&vo_frame);
+      }
 
       // Print to console
       printf("Class: %s (%.1f%%)\n", cls_result.label.c_str(),
              cls_result.confidence * 100.0f);
 
-      // Capture if requested
-      if (capture_requested.load() && capture_dir != nullptr) {
-        save_frame_as_png(vbvaddr, ISP_CHN1_HEIGHT, ISP_CHN1_WIDTH, capture_dir,
-                          capture_count++);
+      if (burst) {
+        ScopedTiming st(Stage::kCapture);
+        burst->Add(buf.vaddr);
+        if (burst_requested.exchange(false)) burst->Trigger();
+      }
+
+      // Capture if requested. An accepted frame is copied and released by
+      // the writer thread, so it is not released here
+      bool handed_off = false;
+      if (capture_requested.load() && capture) {
+        ScopedTiming st(Stage::kCapture);
+        k_video_frame_info info = dump_info;
+        handed_off = capture->Submit(buf.vaddr, [info]() mutable {
+          if (kd_mpi_vicap_dump_release(vicap_dev, VICAP_CHN_ID_1, &info)) {
+            printf("sample_vicap...kd_mpi_vicap_dump_release failed.\n");
+          }
+        });
         capture_requested.store(false);
       }
 
-      kd_mpi_sys_munmap(vbvaddr, size);
-      ret = kd_mpi_vicap_dump_release(vicap_dev, VICAP_CHN_ID_1, &dump_info);
-      if (ret) {
-        printf("sample_vicap...kd_mpi_vicap_dump_release failed.\n");
+      if (!handed_off) {
+        ret = kd_mpi_vicap_dump_release(vicap_dev, VICAP_CHN_ID_1, &dump_info);
+        if (ret) {
+          printf("sample_vicap...kd_mpi_vicap_dump_release failed.\n");
+        }
       }
     }
+    if (motion_gate) {
+      printf("motion gate: inferred %llu of %llu frames\n",
+             static_cast<unsigned long long>(motion_gate->Inferred()),
+             static_cast<unsigned long long>(motion_gate->Frames()));
+    }
+    if (capture) {
+      capture->PrintStats();
+    }
+    if (burst) {
+      burst->PrintStats();
+    }
+    printf("frame registry: %zu buffers, %llu hits, %llu misses\n",
+           frames.Size(), static_cast<unsigned long long>(frames.Hits()),
+           static_cast<unsigned long long>(frames.Misses()));
+    StageProfiler::Get().StopReporter();
+    if (StageProfiler::Get().Enabled()) {
+      StageProfiler::Get().Dump(stdout);
+    }
   }
 
   pthread_join(input_thread_handle, nullptr);